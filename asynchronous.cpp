@@ -0,0 +1,168 @@
+/*
+ * file: asynchronous.cpp
+ * purpose: Implementation of the bounded, asynchronous CLAHE front end.
+ */
+
+#include <algorithm>
+#include <memory>
+#include "asynchronous.hpp"
+
+AsyncClahe::AsyncClahe(unsigned int _workerCount,
+                       unsigned int _maxFramesInFlight,
+                       BackpressurePolicy _policy /* = BLOCK */,
+                       GrayLevelMappingFunction _mapping /* = nullptr */,
+                       double _clipLimit /* = 40.0 */,
+                       cv::MatAllocator * _outputAllocator /* = nullptr */)
+  : mapping(std::move(_mapping)),
+    clipLimit(_clipLimit),
+    maxFramesInFlight(std::max(_maxFramesInFlight, 1u)),
+    policy(_policy),
+    outputAllocator(_outputAllocator),
+    runningJobs(0),
+    completingJobs(0),
+    droppedJobs(0),
+    stopping(false)
+{
+    for (auto i = 0u; i < std::max(_workerCount, 1u); ++i)
+    {
+        workers.emplace_back(&AsyncClahe::workerLoop, this);
+    }
+}
+
+AsyncClahe::~AsyncClahe()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+
+    for (auto & worker : workers)
+    {
+        worker.join();
+    }
+}
+
+std::future<ClaheResult> AsyncClahe::submit(cv::Mat const & input, cv::Mat output /* = cv::Mat() */)
+{
+    // std::function must be copyable, so the promise is shared with the callback
+    auto promise = std::make_shared<std::promise<ClaheResult>>();
+    auto future = promise->get_future();
+
+    submit(input,
+           [promise](ClaheResult & result) { promise->set_value(std::move(result)); },
+           std::move(output));
+
+    return future;
+}
+
+void AsyncClahe::submit(cv::Mat const & input,
+                        ClaheCompletionCallback callback,
+                        cv::Mat output /* = cv::Mat() */)
+{
+    enqueue({input, std::move(output), std::move(callback)});
+}
+
+void AsyncClahe::waitUntilIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    slotAvailable.wait(lock,
+                       [this]() { return pendingJobs.empty() && runningJobs == 0 && completingJobs == 0; });
+}
+
+unsigned int AsyncClahe::framesInFlight() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<unsigned int>(pendingJobs.size()) + runningJobs;
+}
+
+unsigned long AsyncClahe::framesDropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedJobs;
+}
+
+void AsyncClahe::enqueue(Job && job)
+{
+    std::deque<Job> droppedJobsToComplete;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (pendingJobs.size() + runningJobs >= maxFramesInFlight)
+        {
+            if (policy == DROP_OLDEST && !pendingJobs.empty())
+            {
+                droppedJobsToComplete.push_back(std::move(pendingJobs.front()));
+                pendingJobs.pop_front();
+                ++droppedJobs;
+            }
+            else
+            {
+                // Either blocking was requested or every frame in flight is
+                // already being processed, so there is nothing to drop
+                slotAvailable.wait(lock);
+            }
+        }
+        pendingJobs.push_back(std::move(job));
+    }
+    jobAvailable.notify_one();
+
+    // Complete dropped frames outside of the lock in case a callback submits
+    for (auto & dropped : droppedJobsToComplete)
+    {
+        ClaheResult result{-1, true, std::move(dropped.output)};
+        dropped.complete(result);
+    }
+}
+
+void AsyncClahe::workerLoop()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !pendingJobs.empty(); });
+            if (pendingJobs.empty())
+            {
+                // Only reached when stopping and all submitted frames are done
+                return;
+            }
+            job = std::move(pendingJobs.front());
+            pendingJobs.pop_front();
+            ++runningJobs;
+        }
+
+        ClaheResult result{-1, false, std::move(job.output)};
+        if (result.output.empty() && nullptr != outputAllocator)
+        {
+            result.output.allocator = outputAllocator;
+        }
+        if (mapping)
+        {
+            result.status = clahe(job.input, result.output, mapping, clipLimit);
+        }
+        else
+        {
+            result.status = clahe(job.input, result.output, clipLimit);
+        }
+        // Release the reference to the input before signaling completion
+        job.input.release();
+
+        // The frame's slot is free before its callback runs, so a callback
+        // which submits cannot wait under BLOCK on a slot only it would free
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --runningJobs;
+            ++completingJobs;
+        }
+        slotAvailable.notify_all();
+
+        job.complete(result);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --completingJobs;
+        }
+        slotAvailable.notify_all();
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * file: asynchronous.hpp
+ * purpose: Declaration of an asynchronous front end to the CLAHE algorithm
+ *          which equalizes submitted frames on an internal pool of worker
+ *          threads while bounding the number of frames in flight.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+
+/*
+ * What to do when a frame is submitted while the maximum number of frames
+ * are already in flight.
+ */
+enum BackpressurePolicy : uint8_t
+{
+    // Block the submitting thread until a frame completes
+    BLOCK = 0,
+    // Discard the oldest frame which has not started processing yet
+    DROP_OLDEST = 1,
+};
+
+struct ClaheResult
+{
+    // Return value of clahe() for the frame, -1 if the frame was dropped
+    int status;
+    // Whether the frame was discarded by the DROP_OLDEST policy
+    bool dropped;
+    // The equalized frame, shares its buffer with a caller-provided output
+    cv::Mat output;
+};
+
+using ClaheCompletionCallback = std::function<void(ClaheResult & result)>;
+
+/*
+ * Runs clahe() on frames submitted from another thread (i.e. a capture
+ * thread) without blocking it on the equalization itself.
+ *
+ * At most maxFramesInFlight frames are queued or being processed at any time,
+ * so memory use is bounded regardless of how fast frames are submitted. The
+ * input frame's buffer is referenced rather than copied, so the caller must
+ * not write to it until the frame has completed.
+ */
+class AsyncClahe
+{
+public:
+    /*
+     * _workerCount- The number of threads equalizing frames.
+     * _maxFramesInFlight- The limit on queued plus in-progress frames.
+     * _policy- How to handle a submission when the limit is reached.
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     * _outputAllocator- Optional allocator (i.e. a BufferPool) for the output
+     *                   frames which are not provided by the caller.
+     */
+    AsyncClahe(unsigned int _workerCount,
+               unsigned int _maxFramesInFlight,
+               BackpressurePolicy _policy = BLOCK,
+               GrayLevelMappingFunction _mapping = nullptr,
+               double _clipLimit = 40.0,
+               cv::MatAllocator * _outputAllocator = nullptr);
+
+    /*
+     * Finishes all frames already submitted before joining the workers.
+     */
+    ~AsyncClahe();
+
+    AsyncClahe(AsyncClahe const &) = delete;
+    AsyncClahe & operator=(AsyncClahe const &) = delete;
+
+    /*
+     * Submits a frame and returns a future for its result.
+     *
+     * output- Optional caller-provided buffer for the result. If it already
+     *         matches the input's size and type it is written in place,
+     *         otherwise a new buffer is allocated for the result.
+     */
+    std::future<ClaheResult> submit(cv::Mat const & input, cv::Mat output = cv::Mat());
+
+    /*
+     * Submits a frame and invokes the callback with its result. The callback
+     * is called from a worker thread, or from the submitting thread for a
+     * frame dropped by the DROP_OLDEST policy. The frame no longer counts
+     * against maxFramesInFlight while its callback runs, so a callback may
+     * submit the next frame under either policy.
+     */
+    void submit(cv::Mat const & input,
+                ClaheCompletionCallback callback,
+                cv::Mat output = cv::Mat());
+
+    /*
+     * Blocks until every submitted frame has completed or been dropped, and
+     * its callback has returned.
+     */
+    void waitUntilIdle();
+
+    unsigned int framesInFlight() const;
+
+    unsigned long framesDropped() const;
+
+private:
+    struct Job
+    {
+        cv::Mat input;
+        cv::Mat output;
+        ClaheCompletionCallback complete;
+    };
+
+    void enqueue(Job && job);
+
+    void workerLoop();
+
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    unsigned int const maxFramesInFlight;
+    BackpressurePolicy const policy;
+    cv::MatAllocator * const outputAllocator;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable slotAvailable;
+    std::deque<Job> pendingJobs;
+    unsigned int runningJobs;
+    // Finished frames whose callback is running, no longer in flight
+    unsigned int completingJobs;
+    unsigned long droppedJobs;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,293 @@
+/*
+ * file: autotune.cpp
+ * purpose: Implementation of the ParallelClahe tuner and its cache file.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "autotune.hpp"
+#include "parallel.hpp"
+
+static unsigned int const defaultBandHeight(32);
+static unsigned int const bandHeights[] = {8, 16, 32, 64, 128, 256};
+
+// Each configuration is timed for at least this many frames, and at most for
+// this many frames or this long, whichever comes first
+static unsigned int const minimumFrames(3), maximumFrames(9);
+static double const measurementBudgetSeconds(0.15);
+
+/*
+ * Everything a configuration depends on besides the code itself, tab
+ * separated as in the cache file.
+ */
+static std::string getTuningKey(unsigned int columns, unsigned int rows);
+
+static bool readCachedConfiguration(std::string const & cachePath,
+                                    std::string const & key,
+                                    TunedConfiguration & configuration);
+
+static void writeCachedConfiguration(std::string const & cachePath,
+                                     std::string const & key,
+                                     TunedConfiguration const & configuration);
+
+/*
+ * A frame with the mix of content the engine sees in practice: texture,
+ * smooth gradients and a flat area whose regions get the cheap kernels.
+ */
+static cv::Mat createSyntheticFrame(unsigned int columns, unsigned int rows);
+
+/*
+ * The median frame time of a configuration in microseconds, a negative value
+ * if it could not run.
+ */
+static double measureConfiguration(cv::Mat const & frame, unsigned int threadCount, unsigned int bandHeight);
+
+[[nodiscard]] int autoTune(unsigned int columns,
+                           unsigned int rows,
+                           std::string const & cachePath,
+                           TunedConfiguration & configuration,
+                           bool retune /* = false */) noexcept
+{
+    if (columns < 8 || rows < 8)
+    {
+        return -1;
+    }
+
+    try
+    {
+        auto const key = getTuningKey(columns, rows);
+        if (!retune && !cachePath.empty() && readCachedConfiguration(cachePath, key, configuration))
+        {
+            return 0;
+        }
+
+        auto const frame = createSyntheticFrame(columns, rows);
+        TunedConfiguration best{0, defaultBandHeight, -1.0};
+        auto const consider = [&frame, &best](unsigned int threadCount, unsigned int bandHeight) {
+            auto const time = measureConfiguration(frame, threadCount, bandHeight);
+            if (time >= 0.0 && (best.frameMicroseconds < 0.0 || time < best.frameMicroseconds))
+            {
+                best = TunedConfiguration{threadCount, bandHeight, time};
+            }
+        };
+
+        // The two knobs barely interact, so each is searched with the other fixed
+        auto const processors = std::max(std::thread::hardware_concurrency(), 1u);
+        for (auto threadCount = 1u; threadCount < processors; threadCount *= 2)
+        {
+            consider(threadCount, defaultBandHeight);
+        }
+        consider(processors, defaultBandHeight);
+
+        auto const threadCount = best.threadCount;
+        for (auto bandHeight : bandHeights)
+        {
+            if (bandHeight != defaultBandHeight && bandHeight <= rows)
+            {
+                consider(threadCount, bandHeight);
+            }
+        }
+
+        if (best.frameMicroseconds < 0.0)
+        {
+            return -1;
+        }
+
+        configuration = best;
+        if (!cachePath.empty())
+        {
+            writeCachedConfiguration(cachePath, key, configuration);
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+std::string getDefaultTuningCachePath()
+{
+    if (auto const cacheHome = std::getenv("XDG_CACHE_HOME"); nullptr != cacheHome && '\0' != cacheHome[0])
+    {
+        return std::string(cacheHome) + "/clahe-tuning";
+    }
+    if (auto const home = std::getenv("HOME"); nullptr != home && '\0' != home[0])
+    {
+        return std::string(home) + "/.cache/clahe-tuning";
+    }
+    return std::string();
+}
+
+std::string getProcessorModel()
+{
+    std::ifstream cpuInfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuInfo, line))
+    {
+        if (line.compare(0, 10, "model name") == 0)
+        {
+            auto const separator = line.find(':');
+            if (separator != std::string::npos && separator + 2 <= line.size())
+            {
+                auto model = line.substr(separator + 2);
+                // Tabs separate the fields of the cache file
+                std::replace(model.begin(), model.end(), '\t', ' ');
+                return model;
+            }
+        }
+    }
+    return "unknown";
+}
+
+static std::string getTuningKey(unsigned int columns, unsigned int rows)
+{
+    return getProcessorModel() + '\t' + std::to_string(std::thread::hardware_concurrency()) + '\t' +
+           std::to_string(columns) + 'x' + std::to_string(rows);
+}
+
+static bool readCachedConfiguration(std::string const & cachePath,
+                                    std::string const & key,
+                                    TunedConfiguration & configuration)
+{
+    std::ifstream cache(cachePath);
+    std::string line;
+    bool found(false);
+    while (std::getline(cache, line))
+    {
+        // key, thread count, band height, microseconds
+        if (line.size() <= key.size() || line.compare(0, key.size(), key) != 0 || line[key.size()] != '\t')
+        {
+            continue;
+        }
+
+        std::istringstream values(line.substr(key.size() + 1));
+        TunedConfiguration cached{};
+        if (values >> cached.threadCount >> cached.bandHeight >> cached.frameMicroseconds && cached.threadCount > 0 &&
+            cached.bandHeight > 0)
+        {
+            // A later line is a later tuning of the same key
+            configuration = cached;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void writeCachedConfiguration(std::string const & cachePath,
+                                     std::string const & key,
+                                     TunedConfiguration const & configuration)
+{
+    // Keep the other hosts' and geometries' lines, drop this key's old one
+    std::vector<std::string> lines;
+    {
+        std::ifstream cache(cachePath);
+        std::string line;
+        while (std::getline(cache, line))
+        {
+            if (line.compare(0, key.size() + 1, key + '\t') != 0)
+            {
+                lines.push_back(line);
+            }
+        }
+    }
+
+    std::ostringstream entry;
+    entry << key << '\t' << configuration.threadCount << '\t' << configuration.bandHeight << '\t'
+          << configuration.frameMicroseconds;
+    lines.push_back(entry.str());
+
+    std::error_code error;
+    auto const parent = std::filesystem::path(cachePath).parent_path();
+    if (!parent.empty())
+    {
+        std::filesystem::create_directories(parent, error);
+    }
+
+    // Replace the file in one step so a concurrent reader never sees half of it
+    auto const temporaryPath = cachePath + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream cache(temporaryPath, std::ios::trunc);
+        for (auto const & line : lines)
+        {
+            cache << line << '\n';
+        }
+        if (!cache.good())
+        {
+            cache.close();
+            std::remove(temporaryPath.c_str());
+            return;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+    {
+        std::remove(temporaryPath.c_str());
+    }
+}
+
+static cv::Mat createSyntheticFrame(unsigned int columns, unsigned int rows)
+{
+    cv::Mat frame(rows, columns, CV_8UC1);
+    uint32_t noise(0x9e3779b9);
+    for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+    {
+        auto frameRow = frame.ptr<uint8_t>(rowIdx);
+        for (auto colIdx = 0u; colIdx < columns; ++colIdx)
+        {
+            noise = noise * 1664525u + 1013904223u;
+            if (rowIdx < rows / 8)
+            {
+                frameRow[colIdx] = 16;
+            }
+            else
+            {
+                auto const gradient = 64 + (colIdx * 96) / columns + (rowIdx * 64) / rows;
+                frameRow[colIdx] = static_cast<uint8_t>(gradient + (noise >> 28));
+            }
+        }
+    }
+    return frame;
+}
+
+static double measureConfiguration(cv::Mat const & frame, unsigned int threadCount, unsigned int bandHeight)
+{
+    ParallelClahe engine(threadCount, false, nullptr, 40.0, bandHeight);
+    cv::Mat output;
+
+    // The first frame allocates the output and scratch, and wakes the workers
+    if (engine.apply(frame, output) != 0)
+    {
+        return -1.0;
+    }
+
+    std::vector<double> times;
+    auto const start = std::chrono::steady_clock::now();
+    while (times.size() < maximumFrames)
+    {
+        auto const frameStart = std::chrono::steady_clock::now();
+        if (engine.apply(frame, output) != 0)
+        {
+            return -1.0;
+        }
+        auto const frameEnd = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::micro>(frameEnd - frameStart).count());
+
+        if (times.size() >= minimumFrames &&
+            std::chrono::duration<double>(frameEnd - start).count() >= measurementBudgetSeconds)
+        {
+            break;
+        }
+    }
+
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
@@ -0,0 +1,62 @@
+/*
+ * file: autotune.hpp
+ * purpose: Declaration of a tuner which picks the thread count and band
+ *          height of ParallelClahe for the machine and frame size by timing
+ *          short benchmarks, and remembers the result per host and geometry.
+ */
+
+#pragma once
+
+#include <string>
+
+struct TunedConfiguration
+{
+    unsigned int threadCount;
+    unsigned int bandHeight;
+    // Median time of a frame with this configuration when it was measured
+    double frameMicroseconds;
+};
+
+/*
+ * Finds the fastest ParallelClahe configuration for frames of the given size
+ * on this machine:
+ *
+ *     TunedConfiguration configuration;
+ *     if (autoTune(columns, rows, getDefaultTuningCachePath(), configuration) == 0)
+ *     {
+ *         ParallelClahe engine(configuration.threadCount, false, nullptr, 40.0, configuration.bandHeight);
+ *     }
+ *
+ * The cache file is looked up first, by processor model, processor count and
+ * frame size, so only the first run on a host pays for tuning. Otherwise the
+ * thread counts (powers of two up to the processor count) are timed with the
+ * default band height, then the band heights with the best thread count, on a
+ * synthetic frame of the size mixing texture, gradients and flat areas. A
+ * full tuning takes on the order of a second for a 1080p frame. The result is
+ * added to the cache file, which is a text file of one configuration per line.
+ *
+ * The kernels need no tuning, the cheapest one is already picked per region
+ * of every image from its tables.
+ *
+ * cachePath- The cache file, an empty path neither reads nor writes one.
+ * retune- Whether to measure even when the cache has an entry.
+ *
+ * Returns 0 on success and -1 if the frame size is not usable or no
+ * configuration could be measured. Failing to write the cache is not an error.
+ */
+[[nodiscard]] int autoTune(unsigned int columns,
+                           unsigned int rows,
+                           std::string const & cachePath,
+                           TunedConfiguration & configuration,
+                           bool retune = false) noexcept;
+
+/*
+ * $XDG_CACHE_HOME/clahe-tuning, or ~/.cache/clahe-tuning, or an empty path
+ * when neither is known.
+ */
+std::string getDefaultTuningCachePath();
+
+/*
+ * The processor model from /proc/cpuinfo, or "unknown".
+ */
+std::string getProcessorModel();
@@ -0,0 +1,566 @@
+/*
+ * file: benchmark.cpp
+ * purpose: Implements a benchmark which times the phases of the CLAHE
+ *          algorithm and, where the platform allows it, attributes their time
+ *          with hardware performance counters. It also serves as a gate which
+ *          fails when the phases have become slower than a stored baseline.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "autotune.hpp"
+#include "clahe.hpp"
+#include "fixedclahe.hpp"
+#include "perfcounters.hpp"
+#include "perfgate.hpp"
+#include "tiles.hpp"
+#include "wcetclahe.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// The cache line size, for turning last level cache misses into memory traffic
+static unsigned int const cacheLineBytes(64);
+
+// A gate fails on a kernel that is slower with less than this probability of chance
+static double const gateSignificance(0.01);
+
+// The exit status of a gate which found a regression
+static int const regressionExitStatus(3);
+
+struct PhaseResult
+{
+    std::string name;
+    // The bytes per pixel the phase has to move at the least
+    unsigned int nominalBytesPerPixel;
+    PerformanceSample total;
+    // The time of every counted repetition
+    std::vector<double> microseconds;
+};
+
+/*
+ * Runs the phases of clahe() the way it runs them, clahe() itself and, for
+ * the sizes it is instantiated for, FixedClahe, the given number of times
+ * after one uncounted repetition. Returns 0 on success and -1 if either
+ * fails.
+ */
+static int runPhases(cv::Mat const & input,
+                     double clipLimit,
+                     unsigned int repetitions,
+                     PerformanceCounters & counters,
+                     std::vector<PhaseResult> & results);
+
+/*
+ * Times every phase on a fixed matrix of workloads and either records the
+ * samples as a baseline or compares them with one. Returns the exit status.
+ */
+static int runGate(std::string const & baselinePath, bool record, unsigned int repetitions, double threshold);
+
+/*
+ * Times WcetClahe and clahe() frame by frame over inputs chosen to provoke
+ * their slowest paths and reports the spread of the frame times. Returns the
+ * exit status.
+ */
+static int runWorstCase(unsigned int columns, unsigned int rows, unsigned int frames);
+
+/*
+ * Whether FixedClahe is instantiated for frames of the size, which are those
+ * of the gate's workloads.
+ */
+static bool hasFixedClahe(cv::Size const & size);
+
+/*
+ * Equalizes input with the FixedClahe of its size, returns 0 on success and
+ * -1 on failure or for a size without one.
+ */
+static int applyFixedClahe(cv::Mat const & input, cv::Mat & output, double clipLimit);
+
+static cv::Mat createSyntheticImage(unsigned int columns, unsigned int rows);
+
+static void printResults(std::vector<PhaseResult> const & results,
+                         unsigned int repetitions,
+                         double pixels,
+                         bool withCounters);
+
+static void printUsage()
+{
+    std::cerr << "Usage: clahe-benchmark [--counters] [--repeat <count>] [image path]" << std::endl
+              << "       clahe-benchmark --record <baseline.json> [--repeat <count>]" << std::endl
+              << "       clahe-benchmark --gate <baseline.json> [--threshold <percent>] [--repeat <count>]" << std::endl
+              << "       clahe-benchmark --wcet <columns> <rows> [--repeat <frames>]" << std::endl
+              << "Without an image a synthetic 3840 x 2160 frame is used." << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    bool withCounters(false);
+    unsigned int repetitions(0);
+    std::string imagePath, recordPath, gatePath;
+    double thresholdPercent(10.0);
+    unsigned int worstCaseColumns(0), worstCaseRows(0);
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--counters") == 0)
+        {
+            withCounters = true;
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repetitions = static_cast<unsigned int>(std::max(std::atoi(argv[++i]), 1));
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc && gatePath.empty())
+        {
+            recordPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--gate") == 0 && i + 1 < argc && recordPath.empty())
+        {
+            gatePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            thresholdPercent = std::max(std::atof(argv[++i]), 0.0);
+        }
+        else if (std::strcmp(argv[i], "--wcet") == 0 && i + 2 < argc)
+        {
+            worstCaseColumns = static_cast<unsigned int>(std::max(std::atoi(argv[++i]), 0));
+            worstCaseRows = static_cast<unsigned int>(std::max(std::atoi(argv[++i]), 0));
+        }
+        else if (argv[i][0] != '-' && imagePath.empty())
+        {
+            imagePath = argv[i];
+        }
+        else
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    if (worstCaseColumns > 0 || worstCaseRows > 0)
+    {
+        if (withCounters || !imagePath.empty() || !recordPath.empty() || !gatePath.empty())
+        {
+            printUsage();
+            return 2;
+        }
+        return runWorstCase(worstCaseColumns, worstCaseRows, (repetitions == 0) ? 1000 : repetitions);
+    }
+
+    if (!recordPath.empty() || !gatePath.empty())
+    {
+        if (withCounters || !imagePath.empty())
+        {
+            printUsage();
+            return 2;
+        }
+        // The rank test needs about ten samples on each side
+        return runGate(recordPath.empty() ? gatePath : recordPath, !recordPath.empty(),
+                       (repetitions == 0) ? 15 : std::max(repetitions, 10u), thresholdPercent / 100.0);
+    }
+    repetitions = (repetitions == 0) ? 20 : repetitions;
+
+    auto const input = imagePath.empty() ? createSyntheticImage(3840, 2160)
+                                         : cv::imread(imagePath, cv::IMREAD_GRAYSCALE);
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical))
+    {
+        std::cerr << "Cannot use the image " << imagePath << std::endl;
+        return 1;
+    }
+
+    PerformanceCounters counters;
+    if (withCounters && !counters.anyAvailable())
+    {
+        // i.e. inside a container, or with perf_event_paranoid above 2
+        std::cerr << "Hardware counters are not available, reporting time only." << std::endl;
+        withCounters = false;
+    }
+
+    std::vector<PhaseResult> results;
+    if (runPhases(input, 40.0, repetitions, counters, results) != 0)
+    {
+        std::cerr << "clahe failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << input.cols << " x " << input.rows << ", " << repetitions << " repetitions" << std::endl;
+    printResults(results, repetitions, static_cast<double>(input.cols) * input.rows, withCounters);
+
+    return 0;
+}
+
+static int runPhases(cv::Mat const & input,
+                     double clipLimit,
+                     unsigned int repetitions,
+                     PerformanceCounters & counters,
+                     std::vector<PhaseResult> & results)
+{
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+    cv::Mat output(input.size(), CV_8UC1);
+    TileLookupTables tables(TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+    InterpolationPlan const plan(tables.grid);
+    results = {{"histograms", 1, PerformanceSample(), {}},
+               {"interpolation", 2, PerformanceSample(), {}},
+               {"clahe", 3, PerformanceSample(), {}}};
+    if (hasFixedClahe(input.size()))
+    {
+        results.push_back({"fixed", 3, PerformanceSample(), {}});
+    }
+    for (auto & result : results)
+    {
+        result.total.available.fill(true);
+    }
+
+    for (auto repetition = 0u; repetition <= repetitions; ++repetition)
+    {
+        // The first repetition warms the caches and the allocator and is not counted
+        bool const counted(repetition > 0);
+        auto const count = [counted, &results](unsigned int phase, PerformanceSample const & sample) {
+            if (counted)
+            {
+                results[phase].total += sample;
+                results[phase].microseconds.push_back(sample.seconds * 1e6);
+            }
+        };
+
+        counters.start();
+        for (auto tileY = 0u; tileY < tilesVertical; ++tileY)
+        {
+            for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+            {
+                generateTileLookupTable(input, tileX, tileY, nullptr, clipLimit, tables, nullptr);
+            }
+        }
+        selectRegionKernels(tables);
+        count(0, counters.stop());
+
+        counters.start();
+        interpolateRows(input, output, tables, plan, 0, input.rows, nullptr);
+        count(1, counters.stop());
+
+        counters.start();
+        auto const retVal = clahe(input, output, clipLimit);
+        auto const sample = counters.stop();
+        if (retVal != 0)
+        {
+            return -1;
+        }
+        count(2, sample);
+
+        if (results.size() > 3)
+        {
+            counters.start();
+            auto const fixedRetVal = applyFixedClahe(input, output, clipLimit);
+            auto const fixedSample = counters.stop();
+            if (fixedRetVal != 0)
+            {
+                return -1;
+            }
+            count(3, fixedSample);
+        }
+    }
+
+    return 0;
+}
+
+static bool hasFixedClahe(cv::Size const & size)
+{
+    return size == cv::Size(640, 480) || size == cv::Size(1920, 1080) || size == cv::Size(3840, 2160);
+}
+
+static int applyFixedClahe(cv::Mat const & input, cv::Mat & output, double clipLimit)
+{
+    if (input.size() == cv::Size(640, 480))
+    {
+        return FixedClahe<640, 480>(clipLimit).apply(input, output);
+    }
+    if (input.size() == cv::Size(1920, 1080))
+    {
+        return FixedClahe<1920, 1080>(clipLimit).apply(input, output);
+    }
+    if (input.size() == cv::Size(3840, 2160))
+    {
+        return FixedClahe<3840, 2160>(clipLimit).apply(input, output);
+    }
+    return -1;
+}
+
+static int runGate(std::string const & baselinePath, bool record, unsigned int repetitions, double threshold)
+{
+    // Grids other than 8 x 8 are not configurable, so the matrix spans sizes and clip limits
+    std::vector<cv::Size> const sizes{{640, 480}, {1920, 1080}, {3840, 2160}};
+    std::vector<double> const clipLimits{4.0, 40.0, 400.0};
+
+    std::vector<KernelSamples> baseline;
+    std::string baselineProcessor;
+    if (!record && readPerformanceBaseline(baselinePath, baselineProcessor, baseline) != 0)
+    {
+        std::cerr << "Cannot read the baseline " << baselinePath << std::endl;
+        return 1;
+    }
+    auto const processor = getProcessorModel();
+    if (!record && baselineProcessor != processor)
+    {
+        std::cerr << "The baseline was recorded on \"" << baselineProcessor << "\", not on \"" << processor
+                  << "\", so differences may be the machine's." << std::endl;
+    }
+
+    PerformanceCounters counters;
+    std::vector<KernelSamples> current;
+    for (auto const & size : sizes)
+    {
+        auto const input = createSyntheticImage(size.width, size.height);
+        for (auto clipLimit : clipLimits)
+        {
+            std::ostringstream workload;
+            workload << size.width << 'x' << size.height << " clip " << clipLimit;
+
+            std::vector<PhaseResult> results;
+            if (runPhases(input, clipLimit, repetitions, counters, results) != 0)
+            {
+                std::cerr << "clahe failed on " << workload.str() << std::endl;
+                return 1;
+            }
+            for (auto & result : results)
+            {
+                current.push_back(KernelSamples{workload.str(), result.name, std::move(result.microseconds)});
+            }
+        }
+    }
+
+    if (record)
+    {
+        if (writePerformanceBaseline(baselinePath, processor, current) != 0)
+        {
+            std::cerr << "Cannot write the baseline " << baselinePath << std::endl;
+            return 1;
+        }
+        std::cout << "Recorded " << current.size() << " kernels with " << repetitions << " samples each to "
+                  << baselinePath << std::endl;
+        return 0;
+    }
+
+    std::cout << std::left << std::setw(24) << "workload" << std::setw(16) << "kernel" << std::right
+              << std::setw(16) << "baseline (us)" << std::setw(16) << "current (us)" << std::setw(10) << "change"
+              << std::setw(10) << "p" << "  verdict" << std::endl;
+
+    unsigned int regressions(0);
+    for (auto const & kernel : current)
+    {
+        auto const stored = std::find_if(baseline.begin(), baseline.end(), [&kernel](KernelSamples const & entry) {
+            return entry.workload == kernel.workload && entry.kernel == kernel.kernel;
+        });
+        std::cout << std::left << std::setw(24) << kernel.workload << std::setw(16) << kernel.kernel << std::right
+                  << std::fixed;
+        if (stored == baseline.end())
+        {
+            std::cout << std::setw(16) << "-" << std::setw(16) << std::setprecision(1) << getMedian(kernel.microseconds)
+                      << std::setw(10) << "-" << std::setw(10) << "-" << "  new" << std::endl;
+            continue;
+        }
+
+        auto const comparison = compareKernelSamples(stored->microseconds, kernel.microseconds, threshold,
+                                                     gateSignificance);
+        regressions += comparison.regressed ? 1 : 0;
+        std::cout << std::setprecision(1) << std::setw(16) << comparison.baselineMedian << std::setw(16)
+                  << comparison.currentMedian << std::setw(9) << std::showpos << comparison.change * 100.0 << '%'
+                  << std::noshowpos << std::setprecision(4) << std::setw(10) << comparison.pValue << "  "
+                  << (comparison.regressed ? "REGRESSED" : "ok") << std::endl;
+    }
+
+    if (regressions > 0)
+    {
+        std::cout << regressions << " kernels regressed by more than " << std::setprecision(1) << threshold * 100.0
+                  << '%' << std::endl;
+        return regressionExitStatus;
+    }
+    return 0;
+}
+
+static int runWorstCase(unsigned int columns, unsigned int rows, unsigned int frames)
+{
+    WcetClahe equalizer(columns, rows);
+    cv::Mat output(rows, columns, CV_8UC1);
+    if (equalizer.apply(createSyntheticImage(columns, rows), output) != 0)
+    {
+        std::cerr << "Cannot equalize frames of " << columns << " x " << rows << std::endl;
+        return 1;
+    }
+
+    // Page faults in the middle of a frame are not the algorithm's
+    bool locked(equalizer.lockMemory() == 0);
+#ifdef __linux__
+    locked = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) && locked;
+#endif
+    if (!locked)
+    {
+        std::cerr << "Memory could not be locked, frame times include any page faults." << std::endl;
+    }
+
+    // Flat frames put every count on one counter and select the fill kernels,
+    // noise reads the tables at random, checkers maximize the difference
+    // between neighboring tables and gradients select the copy kernels
+    std::vector<std::pair<char const *, cv::Mat>> inputs;
+    inputs.emplace_back("black", cv::Mat(rows, columns, CV_8UC1, cv::Scalar(0)));
+    inputs.emplace_back("white", cv::Mat(rows, columns, CV_8UC1, cv::Scalar(255)));
+    cv::Mat noise(rows, columns, CV_8UC1), checkers(rows, columns, CV_8UC1), gradient(rows, columns, CV_8UC1),
+        stripes(rows, columns, CV_8UC1);
+    uint32_t state(0x9e3779b9);
+    for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+    {
+        for (auto colIdx = 0u; colIdx < columns; ++colIdx)
+        {
+            state = state * 1664525u + 1013904223u;
+            noise.at<uint8_t>(rowIdx, colIdx) = static_cast<uint8_t>(state >> 24);
+            // Alternate flat and noisy tiles
+            checkers.at<uint8_t>(rowIdx, colIdx) =
+                ((colIdx * 8 / columns + rowIdx * 8 / rows) % 2 != 0) ? 255 : static_cast<uint8_t>(state >> 28);
+            gradient.at<uint8_t>(rowIdx, colIdx) = static_cast<uint8_t>((colIdx * 255) / columns);
+            // Period 4 columns, so every interleaved histogram counts one value
+            stripes.at<uint8_t>(rowIdx, colIdx) = static_cast<uint8_t>((colIdx % 4) * 85);
+        }
+    }
+    inputs.emplace_back("noise", noise);
+    inputs.emplace_back("checkers", checkers);
+    inputs.emplace_back("gradient", gradient);
+    inputs.emplace_back("stripes", stripes);
+
+    // The inputs take turns so drift in the machine affects them alike
+    std::vector<std::vector<double>> worstCaseTimes(inputs.size()), claheTimes(inputs.size());
+    for (auto frame = 0u; frame < frames * inputs.size(); ++frame)
+    {
+        auto const index = frame % inputs.size();
+        auto const & input = inputs[index].second;
+
+        auto const start = std::chrono::steady_clock::now();
+        auto const retVal = equalizer.apply(input, output);
+        auto const middle = std::chrono::steady_clock::now();
+        auto const claheRetVal = clahe(input, output);
+        auto const end = std::chrono::steady_clock::now();
+        if (retVal != 0 || claheRetVal != 0)
+        {
+            std::cerr << "Equalization failed" << std::endl;
+            return 1;
+        }
+
+        worstCaseTimes[index].push_back(std::chrono::duration<double, std::micro>(middle - start).count());
+        claheTimes[index].push_back(std::chrono::duration<double, std::micro>(end - middle).count());
+    }
+
+    std::cout << columns << " x " << rows << ", " << frames << " frames per input" << std::endl;
+    if (frames < 10000)
+    {
+        std::cout << "Fewer than 10000 frames per input, p99.99 is the maximum." << std::endl;
+    }
+    std::cout << std::left << std::setw(10) << "engine" << std::setw(12) << "input" << std::right << std::setw(12)
+              << "min (us)" << std::setw(12) << "median" << std::setw(12) << "p99.99" << std::setw(12) << "max"
+              << std::endl;
+
+    auto const printTimes = [](char const * engine, char const * input, std::vector<double> times) {
+        std::sort(times.begin(), times.end());
+        // Nearest rank
+        auto const percentile = times[static_cast<size_t>(std::ceil(times.size() * 0.9999)) - 1];
+        std::cout << std::left << std::setw(10) << engine << std::setw(12) << input << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << times.front() << std::setw(12) << getMedian(times)
+                  << std::setw(12) << percentile << std::setw(12) << times.back() << std::endl;
+    };
+
+    std::vector<double> allWorstCaseTimes, allClaheTimes;
+    for (auto index = 0u; index < inputs.size(); ++index)
+    {
+        printTimes("wcet", inputs[index].first, worstCaseTimes[index]);
+        allWorstCaseTimes.insert(allWorstCaseTimes.end(), worstCaseTimes[index].begin(), worstCaseTimes[index].end());
+    }
+    printTimes("wcet", "all", allWorstCaseTimes);
+    for (auto index = 0u; index < inputs.size(); ++index)
+    {
+        printTimes("clahe", inputs[index].first, claheTimes[index]);
+        allClaheTimes.insert(allClaheTimes.end(), claheTimes[index].begin(), claheTimes[index].end());
+    }
+    printTimes("clahe", "all", allClaheTimes);
+
+    return 0;
+}
+
+static cv::Mat createSyntheticImage(unsigned int columns, unsigned int rows)
+{
+    // Texture over gradients, with a flat band so every kernel is exercised
+    cv::Mat image(rows, columns, CV_8UC1);
+    uint32_t noise(0x9e3779b9);
+    for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+    {
+        auto imageRow = image.ptr<uint8_t>(rowIdx);
+        for (auto colIdx = 0u; colIdx < columns; ++colIdx)
+        {
+            noise = noise * 1664525u + 1013904223u;
+            imageRow[colIdx] = (rowIdx < rows / 8) ? 16
+                                                   : static_cast<uint8_t>(64 + (colIdx * 96) / columns +
+                                                                          (rowIdx * 64) / rows + (noise >> 28));
+        }
+    }
+    return image;
+}
+
+static void printResults(std::vector<PhaseResult> const & results,
+                         unsigned int repetitions,
+                         double pixels,
+                         bool withCounters)
+{
+    std::cout << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "time (us)"
+              << std::setw(12) << "ns/pixel";
+    if (withCounters)
+    {
+        std::cout << std::setw(8) << "IPC" << std::setw(12) << "cycles/px" << std::setw(12) << "L1D miss/px"
+                  << std::setw(12) << "LLC miss/px" << std::setw(12) << "br miss/px" << std::setw(12) << "LLC B/px";
+    }
+    std::cout << std::setw(12) << "min B/px" << std::endl;
+
+    auto const printPerPixel = [repetitions, pixels](PerformanceSample const & total, PerformanceEvent event,
+                                                      double scale) {
+        if (total.available[event])
+        {
+            std::cout << std::setw(12) << std::fixed << std::setprecision(3)
+                      << total.counts[event] * scale / (pixels * repetitions);
+        }
+        else
+        {
+            std::cout << std::setw(12) << "n/a";
+        }
+    };
+
+    for (auto const & result : results)
+    {
+        auto const & total = result.total;
+        std::cout << std::left << std::setw(16) << result.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << total.seconds * 1e6 / repetitions << std::setprecision(3) << std::setw(12)
+                  << total.seconds * 1e9 / (pixels * repetitions);
+        if (withCounters)
+        {
+            if (total.available[CYCLES_EVENT] && total.available[INSTRUCTIONS_EVENT] && total.counts[CYCLES_EVENT] > 0)
+            {
+                std::cout << std::setw(8) << std::setprecision(2)
+                          << static_cast<double>(total.counts[INSTRUCTIONS_EVENT]) / total.counts[CYCLES_EVENT];
+            }
+            else
+            {
+                std::cout << std::setw(8) << "n/a";
+            }
+            printPerPixel(total, CYCLES_EVENT, 1.0);
+            printPerPixel(total, L1_DATA_MISSES_EVENT, 1.0);
+            printPerPixel(total, LAST_LEVEL_CACHE_MISSES_EVENT, 1.0);
+            printPerPixel(total, BRANCH_MISSES_EVENT, 1.0);
+            printPerPixel(total, LAST_LEVEL_CACHE_MISSES_EVENT, cacheLineBytes);
+        }
+        std::cout << std::setw(12) << result.nominalBytesPerPixel << std::endl;
+    }
+}
@@ -0,0 +1,258 @@
+/*
+ * file: bufferpool.cpp
+ * purpose: Implementation of the recycling buffer pool.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "bufferpool.hpp"
+
+static size_t const hugePageSize(2u << 20);
+
+// Every buffer is at least aligned to this, which covers cache lines and AVX-512
+static size_t const minimumAlignment(64);
+
+static size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+BufferPool::BufferPool(HugePageMode _hugePages /* = TRANSPARENT_HUGE_PAGES */,
+                       size_t _maxCachedBytes /* = 256u << 20 */)
+  : hugePages(_hugePages), maxCachedBytes(_maxCachedBytes), statistics()
+{
+    // Empty
+}
+
+BufferPool::~BufferPool()
+{
+    trim();
+
+    // Buffers still in use at this point belong to matrices which outlived
+    // the pool, they are leaked rather than unmapped under their owners
+}
+
+void * BufferPool::acquire(size_t size) const noexcept
+{
+    size = std::max<size_t>(size, 1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++statistics.acquisitions;
+
+        // Take the smallest cached buffer which fits without wasting more
+        // than the request itself
+        auto cached = cachedBuffers.lower_bound(size);
+        if (cached != cachedBuffers.end() && cached->first <= 2 * size)
+        {
+            auto buffer = cached->second;
+            cachedBuffers.erase(cached);
+            buffersInUse.emplace(buffer.data, buffer);
+            statistics.bytesCached -= buffer.capacity;
+            statistics.bytesInUse += buffer.capacity;
+            ++statistics.reuses;
+            return buffer.data;
+        }
+    }
+
+    // Map fresh memory outside of the lock, this is the slow path
+    auto buffer = mapBuffer(size);
+    if (nullptr == buffer.data)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    buffersInUse.emplace(buffer.data, buffer);
+    statistics.bytesInUse += buffer.capacity;
+    ++statistics.systemAllocations;
+    if (buffer.hugePages)
+    {
+        ++statistics.hugePageAllocations;
+    }
+    return buffer.data;
+}
+
+void BufferPool::release(void * data) const noexcept
+{
+    if (nullptr == data)
+    {
+        return;
+    }
+
+    Buffer buffer{};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto inUse = buffersInUse.find(data);
+        if (inUse == buffersInUse.end())
+        {
+            // Not from this pool
+            return;
+        }
+        buffer = inUse->second;
+        buffersInUse.erase(inUse);
+        statistics.bytesInUse -= buffer.capacity;
+
+        if (statistics.bytesCached + buffer.capacity <= maxCachedBytes)
+        {
+            cachedBuffers.emplace(buffer.capacity, buffer);
+            statistics.bytesCached += buffer.capacity;
+            return;
+        }
+        ++statistics.systemReleases;
+    }
+
+    unmapBuffer(buffer);
+}
+
+void BufferPool::trim() noexcept
+{
+    std::multimap<size_t, Buffer> buffersToUnmap;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffersToUnmap.swap(cachedBuffers);
+        statistics.bytesCached = 0;
+        statistics.systemReleases += buffersToUnmap.size();
+    }
+
+    for (auto const & cached : buffersToUnmap)
+    {
+        unmapBuffer(cached.second);
+    }
+}
+
+BufferPoolStatistics BufferPool::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+cv::UMatData * BufferPool::allocate(int dims,
+                                    const int * sizes,
+                                    int type,
+                                    void * data,
+                                    size_t * step,
+                                    MatAccessFlags /* flags */,
+                                    cv::UMatUsageFlags /* usageFlags */) const
+{
+    // Same layout rules as OpenCV's default allocator
+    size_t total = CV_ELEM_SIZE(type);
+    for (auto i = dims - 1; i >= 0; --i)
+    {
+        if (nullptr != step)
+        {
+            if (nullptr != data && step[i] != CV_AUTOSTEP)
+            {
+                total = step[i];
+            }
+            else
+            {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    auto buffer = static_cast<uint8_t *>((nullptr != data) ? data : acquire(total));
+    if (nullptr == buffer)
+    {
+        throw std::bad_alloc();
+    }
+
+    auto matData = new cv::UMatData(this);
+    matData->data = matData->origdata = buffer;
+    matData->size = total;
+    if (nullptr != data)
+    {
+        matData->flags |= cv::UMatData::USER_ALLOCATED;
+    }
+    return matData;
+}
+
+bool BufferPool::allocate(cv::UMatData * data,
+                          MatAccessFlags /* accessFlags */,
+                          cv::UMatUsageFlags /* usageFlags */) const
+{
+    return nullptr != data;
+}
+
+void BufferPool::deallocate(cv::UMatData * data) const
+{
+    if (nullptr == data)
+    {
+        return;
+    }
+
+    if (!(data->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        release(data->origdata);
+        data->origdata = nullptr;
+    }
+    delete data;
+}
+
+BufferPool::Buffer BufferPool::mapBuffer(size_t size) const noexcept
+{
+#ifdef __linux__
+    if (hugePages == EXPLICIT_HUGE_PAGES)
+    {
+        size_t const capacity(roundUp(size, hugePageSize));
+        void * data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            return {data, capacity, true};
+        }
+        // No huge pages reserved, fall through to transparent huge pages
+    }
+
+    if (hugePages != NO_HUGE_PAGES && size >= hugePageSize)
+    {
+        // Over-map so that the buffer can start on a huge page boundary, then
+        // give back the unaligned head and the unused tail
+        size_t const capacity(roundUp(size, hugePageSize));
+        auto mapping = static_cast<uint8_t *>(
+            mmap(nullptr, capacity + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapping == MAP_FAILED)
+        {
+            return {nullptr, 0, false};
+        }
+
+        auto data = reinterpret_cast<uint8_t *>(roundUp(reinterpret_cast<size_t>(mapping), hugePageSize));
+        size_t const head(data - mapping);
+        if (head > 0)
+        {
+            munmap(mapping, head);
+        }
+        munmap(data + capacity, hugePageSize - head);
+
+        // Advice only, the kernel may still use regular pages
+        madvise(data, capacity, MADV_HUGEPAGE);
+        return {data, capacity, true};
+    }
+
+    size_t const capacity(roundUp(size, static_cast<size_t>(sysconf(_SC_PAGESIZE))));
+    void * data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        return {nullptr, 0, false};
+    }
+    return {data, capacity, false};
+#else
+    size_t const capacity(roundUp(size, minimumAlignment));
+    return {std::aligned_alloc(minimumAlignment, capacity), capacity, false};
+#endif
+}
+
+void BufferPool::unmapBuffer(Buffer const & buffer) const noexcept
+{
+#ifdef __linux__
+    munmap(buffer.data, buffer.capacity);
+#else
+    std::free(buffer.data);
+#endif
+}
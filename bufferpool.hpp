@@ -0,0 +1,128 @@
+/*
+ * file: bufferpool.hpp
+ * purpose: Declaration of a pool of aligned, optionally huge-page backed
+ *          buffers which recycles image frames between calls so streaming
+ *          does not keep faulting in fresh pages.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+
+#if CV_VERSION_MAJOR >= 4
+using MatAccessFlags = cv::AccessFlag;
+#else
+using MatAccessFlags = int;
+#endif
+
+enum HugePageMode : uint8_t
+{
+    // Regular pages only
+    NO_HUGE_PAGES = 0,
+    // Advise the kernel to back large buffers with transparent huge pages
+    TRANSPARENT_HUGE_PAGES = 1,
+    // Map buffers from the hugetlbfs pool, falling back to transparent huge
+    // pages when none are reserved
+    EXPLICIT_HUGE_PAGES = 2,
+};
+
+struct BufferPoolStatistics
+{
+    // Buffers handed out by the pool
+    unsigned long acquisitions;
+    // Acquisitions served by a recycled buffer
+    unsigned long reuses;
+    // Acquisitions which had to map fresh memory
+    unsigned long systemAllocations;
+    // Fresh mappings backed (or advised to be backed) by huge pages
+    unsigned long hugePageAllocations;
+    // Buffers returned to the system instead of being kept for reuse
+    unsigned long systemReleases;
+    size_t bytesInUse;
+    size_t bytesCached;
+};
+
+/*
+ * Hands out buffers aligned to at least a page, so they are suitably aligned
+ * for cache lines and any SIMD width, and keeps released buffers for reuse.
+ *
+ * The pool is also an OpenCV allocator. Setting it as the allocator of an
+ * output matrix before calling clahe() makes the output frame come from, and
+ * return to, the pool:
+ *
+ *     cv::Mat output;
+ *     output.allocator = &pool;
+ *     clahe(input, output);
+ *
+ * The pool must outlive every matrix allocated from it.
+ */
+class BufferPool : public cv::MatAllocator
+{
+public:
+    /*
+     * _hugePages- What kind of pages should back the buffers.
+     * _maxCachedBytes- The most memory kept around in released buffers.
+     */
+    explicit BufferPool(HugePageMode _hugePages = TRANSPARENT_HUGE_PAGES,
+                        size_t _maxCachedBytes = 256u << 20);
+
+    ~BufferPool() override;
+
+    BufferPool(BufferPool const &) = delete;
+    BufferPool & operator=(BufferPool const &) = delete;
+
+    /*
+     * Gets a buffer of at least the given size, returns nullptr if no memory
+     * is available.
+     */
+    void * acquire(size_t size) const noexcept;
+
+    /*
+     * Gives a buffer from acquire() back to the pool.
+     */
+    void release(void * buffer) const noexcept;
+
+    /*
+     * Returns every cached buffer to the system.
+     */
+    void trim() noexcept;
+
+    BufferPoolStatistics getStatistics() const;
+
+    cv::UMatData * allocate(int dims,
+                            const int * sizes,
+                            int type,
+                            void * data,
+                            size_t * step,
+                            MatAccessFlags flags,
+                            cv::UMatUsageFlags usageFlags) const override;
+
+    bool allocate(cv::UMatData * data, MatAccessFlags accessFlags, cv::UMatUsageFlags usageFlags) const override;
+
+    void deallocate(cv::UMatData * data) const override;
+
+private:
+    struct Buffer
+    {
+        void * data;
+        size_t capacity;
+        bool hugePages;
+    };
+
+    Buffer mapBuffer(size_t size) const noexcept;
+
+    void unmapBuffer(Buffer const & buffer) const noexcept;
+
+    HugePageMode const hugePages;
+    size_t const maxCachedBytes;
+
+    // OpenCV's allocator interface is const, the pool's bookkeeping is not
+    mutable std::mutex mutex;
+    mutable std::multimap<size_t, Buffer> cachedBuffers;
+    mutable std::unordered_map<void *, Buffer> buffersInUse;
+    mutable BufferPoolStatistics statistics;
+};
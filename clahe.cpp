@@ -3,325 +3,180 @@
  * purpose: Implementation of a generic adaptive histogram equalization algorithm.
  */
 
-#include <array>
-#include <memory>
 #include "opencv2/opencv.hpp"
 #include "clahe.hpp"
+#include "tiles.hpp"
+#include "trace.hpp"
 
-struct TileCoordinates
-{
-    unsigned int x;
-    unsigned int y;
-};
-
-static void areaBasedGrayLevelMapping(ImageHistogram const & histogram,
-                                      LookupTable * outputTable);
+static int equalize(cv::Mat const & input,
+                    cv::Mat & output,
+                    GrayLevelMappingFunction const & mapping,
+                    double clipLimit,
+                    ClaheStatistics * statistics,
+                    ClahePointOperations const * operations = nullptr) noexcept;
 
-static bool isCornerRegion(unsigned int x,
-                           unsigned int y,
-                           unsigned int tilesHorizontal,
-                           unsigned int tilesVertical,
-                           unsigned int inputColumns,
-                           unsigned int inputRows,
-                           std::array<TileCoordinates, 4> & outputTile);
+[[nodiscard]] int clahe(cv::Mat const & input, cv::Mat & output, double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, nullptr, clipLimit, nullptr);
+}
 
-static bool isBorderRegion(unsigned int x,
-                           unsigned int y,
-                           unsigned int tilesHorizontal,
-                           unsigned int tilesVertical,
-                           unsigned int inputColumns,
-                           unsigned int inputRows,
-                           std::array<TileCoordinates, 4> & outputTile);
+[[nodiscard]] int clahe(cv::Mat const & input, cv::Mat & output, GrayLevelMappingFunction mapping, double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, mapping, clipLimit, nullptr);
+}
 
-static void getFourClosestTiles(unsigned int x,
-                                unsigned int y,
-                                unsigned int tilesHorizontal,
-                                unsigned int tilesVertical,
-                                unsigned int inputColumns,
-                                unsigned int inputRows,
-                                std::array<TileCoordinates, 4> & outputTile);
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClaheStatistics & statistics,
+                        double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, nullptr, clipLimit, &statistics);
+}
 
-static unsigned int getPixelCoordinateFromTileCoordinate(unsigned int tileCoordinate,
-                                                         unsigned int pixelsPerTile);
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClaheStatistics & statistics,
+                        GrayLevelMappingFunction mapping,
+                        double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, mapping, clipLimit, &statistics);
+}
 
-static unsigned int getLowerTileCoordinate(float pixelDimension, float tileDimension);
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClahePointOperations const & operations,
+                        double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, nullptr, clipLimit, nullptr, &operations);
+}
 
-[[nodiscard]] int clahe(cv::Mat const & input, cv::Mat & output, double clipLimit /* = 40.0 */) noexcept
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClahePointOperations const & operations,
+                        GrayLevelMappingFunction mapping,
+                        double clipLimit /* = 40.0 */) noexcept
 {
-    return clahe(input, output, areaBasedGrayLevelMapping, clipLimit);
+    return equalize(input, output, mapping, clipLimit, nullptr, &operations);
 }
 
-[[nodiscard]] int clahe(cv::Mat const & input, cv::Mat & output, GrayLevelMappingFunction mapping, double clipLimit /* = 40.0 */) noexcept
+static int equalize(cv::Mat const & input,
+                    cv::Mat & output,
+                    GrayLevelMappingFunction const & mapping,
+                    double clipLimit,
+                    ClaheStatistics * statistics,
+                    ClahePointOperations const * operations /* = nullptr */) noexcept
 {
     // Data on the tiles the image will be split into
     unsigned int const tilesHorizontal(8), tilesVertical(8);
-    unsigned int const tileWidth(input.cols / tilesHorizontal);
-    unsigned int const tileHeight(input.rows / tilesVertical);
 
-    // Make the underlying data of the output the same as the input
-    output.create(input.size(), input.type());
-
-    std::unique_ptr<LookupTable> claheLookupTables[tilesVertical][tilesHorizontal];
+    if (nullptr != statistics)
+    {
+        *statistics = ClaheStatistics();
+    }
 
-    for (auto & column : claheLookupTables)
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical))
     {
-        for (auto & table : column)
-        {
-            table = std::make_unique<LookupTable>();
-            assert(nullptr != table);
-        }
+        return -1;
     }
 
+    // Make the underlying data of the output the same as the input
+    output.create(input.size(), input.type());
+
+    TileLookupTables claheLookupTables(TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+    unsigned int * inputHistogram = (nullptr != statistics) ? statistics->inputHistogram.histogram.data() : nullptr;
+    unsigned int * outputHistogram = (nullptr != statistics) ? statistics->outputHistogram.histogram.data() : nullptr;
+
     // Generate the look up table (mapping function) for each tile
     for (auto rowIdx = 0u; rowIdx < tilesVertical; ++rowIdx)
     {
         for (auto colIdx = 0u; colIdx < tilesHorizontal; ++colIdx)
         {
-            // Determine the X-Y bounds of the tile
-            unsigned int regionWidth = tileWidth;
-            unsigned int regionHeight = tileHeight;
-            // Grab the last few pixels if on the right edge of the image
-            if (colIdx == tilesHorizontal - 1)
-            {
-                regionWidth += input.cols % tilesHorizontal;
-            }
-            // Grab the last few pixels if on the bottom edge of the image
-            if (rowIdx == tilesVertical - 1)
-            {
-                regionHeight += input.rows % tilesVertical;
-            }
-
-            // Get the histogram for the tile
-            auto tileBounds = Rectangle(tileWidth * colIdx, tileHeight * rowIdx,
-                                       regionWidth, regionHeight);
-            auto tileHistogram(generateGrayscaleHistogramForSubregion(input, tileBounds));
-
-            // Clip the histogram and redistribute
-            clipHistogram(tileHistogram, clipLimit);
-
-            // Perform gray level mapping
-            mapping(tileHistogram, claheLookupTables[rowIdx][colIdx].get());
+            CLAHE_TRACE_SPAN("tile", rowIdx * tilesHorizontal + colIdx);
+            generateTileLookupTable(input, colIdx, rowIdx, mapping, clipLimit, claheLookupTables, inputHistogram,
+                                    operations);
         }
     }
+    selectRegionKernels(claheLookupTables);
 
     // Now for each pixel, interpolate an intensity value from the gray level mappings of the closest tiles
-    for (auto rowIdx = 0u; rowIdx < input.rows; ++rowIdx)
+    CLAHE_TRACE_SPAN("interpolation", 0);
+    interpolateRows(input, output, claheLookupTables, InterpolationPlan(claheLookupTables.grid), 0, input.rows,
+                    outputHistogram);
+
+    if (nullptr != statistics)
     {
-        for (auto colIdx = 0u; colIdx < input.cols; ++colIdx)
-        {
-            // Find the four closest tile centers and the tile coordinates
-            std::array<TileCoordinates, 4> closestTiles{};
-            if (isCornerRegion(colIdx, rowIdx, tilesHorizontal, tilesVertical, input.cols, input.rows, closestTiles))
-            {
-                // The closest tile is in index 0
-                uint8_t currentPixelIntensity = input.at<uint8_t>(rowIdx, colIdx);
-                uint8_t newPixelIntensity =
-                    claheLookupTables[closestTiles[0].y][closestTiles[0].x]->operator[](currentPixelIntensity);
-                output.at<uint8_t>(rowIdx, colIdx) = newPixelIntensity;
-            }
-            else if (isBorderRegion(colIdx, rowIdx, tilesHorizontal,
-                                    tilesVertical, input.cols, input.rows, closestTiles))
-            {
-                // The two closest tiles are indices 0 and 1
-                Pixel pixel0 = {
-                    // Get the tile center's xy-coordinates
-                    getPixelCoordinateFromTileCoordinate(closestTiles[0].x, tileWidth),
-                    getPixelCoordinateFromTileCoordinate(closestTiles[0].y, tileHeight),
-                    // Plug the input pixel's intensity into the tile's lookup table
-                    claheLookupTables[closestTiles[0].y][closestTiles[0].x]->operator[](
-                        input.at<uint8_t>(rowIdx, colIdx))};
-                Pixel pixel1 = {
-                    // Get the tile center's xy-coordinates
-                    getPixelCoordinateFromTileCoordinate(closestTiles[1].x, tileWidth),
-                    getPixelCoordinateFromTileCoordinate(closestTiles[1].y, tileHeight),
-                    // Plug the input pixel's intensity into the tile's lookup table
-                    claheLookupTables[closestTiles[1].y][closestTiles[1].x]->operator[](
-                        input.at<uint8_t>(rowIdx, colIdx))};
-                output.at<uint8_t>(rowIdx, colIdx) = static_cast<uint8_t>(
-                    linearInterpolate(pixel0, pixel1, colIdx, rowIdx).intensity);
-            }
-            else
-            {
-                // Grab the tile coordinates from all 4 indices
-                getFourClosestTiles(colIdx, rowIdx, tilesHorizontal,
-                                    tilesVertical, input.cols, input.rows, closestTiles);
-                // Create a pixel for each tile center with an intensity from
-                // mapping the current input pixel
-                std::vector<Pixel> tileCenters;
-                for (auto & tile : closestTiles)
-                {
-                    tileCenters.push_back(
-                        // Get the x-coordinate, y-coordinate of each tile center
-                        {getPixelCoordinateFromTileCoordinate(tile.x, tileWidth),
-                         getPixelCoordinateFromTileCoordinate(tile.y, tileHeight),
-                         // Get the look-up table for this tile and plug this pixel's intensity in
-                         claheLookupTables[tile.y][tile.x]->operator[](
-                             input.at<uint8_t>(rowIdx, colIdx))});
-                }
-                // Interpolate between the four pixels and assign it to the output image
-                output.at<uint8_t>(rowIdx, colIdx) = static_cast<uint8_t>(
-                    bilinearInterpolate(tileCenters, colIdx, rowIdx).intensity);
-            }
-        }
+        summarizeClaheStatistics(*statistics);
     }
 
     return 0;
 }
 
-static void areaBasedGrayLevelMapping(ImageHistogram const & histogram, LookupTable * outputTable)
+LookupTableKind classifyLookupTable(LookupTable const & table) noexcept
 {
-    unsigned int numberOfPixels(0);
-
-    // Get the total number of pixels in the histogram
-    for (auto i = 0u; i < 256; ++i)
+    bool isConstant(true), isIdentity(true);
+    for (auto i = 0u; i < table.size(); ++i)
     {
-        numberOfPixels += histogram[i];
+        isConstant = isConstant && (table[i] == table[0]);
+        isIdentity = isIdentity && (table[i] == i);
     }
 
-    unsigned int numberOfPixelsSeen(0);
-    for (auto i = 0u; i < outputTable->size(); ++i)
+    if (isConstant)
     {
-        numberOfPixelsSeen += histogram[i];
-        // How many of the pixels in this histogram have we seen?
-        float ratioOfPixelsSeenToTotal = static_cast<float>(numberOfPixelsSeen) / numberOfPixels;
-        // Readjust towards a more balanced image by moving pixels to where they "should" be
-        outputTable->operator[](i) = static_cast<unsigned char>(
-            ratioOfPixelsSeenToTotal * (outputTable->size() - 1));
+        return CONSTANT_TABLE;
     }
+    return isIdentity ? IDENTITY_TABLE : GENERAL_TABLE;
 }
 
-static bool isCornerRegion(unsigned int x,
-                           unsigned int y,
-                           unsigned int tilesHorizontal,
-                           unsigned int tilesVertical,
-                           unsigned int inputColumns,
-                           unsigned int inputRows,
-                           std::array<TileCoordinates, 4> & outputTile)
+LookupTable makeLookupTable(PointFunction const & pointFunction)
 {
-    unsigned int const tileWidth(inputColumns / tilesHorizontal);
-    unsigned int const tileHeight(inputRows / tilesVertical);
-    // Is it in the top left corner?
-    if (x <= (tileWidth / 2) && y <= (tileHeight / 2))
-    {
-        // Tile coordinate is 0, 0
-        outputTile[0] = {0, 0};
-        return true;
-    }
-    // Is it in the top right corner?
-    else if (x > ((tileWidth * tilesHorizontal) - tileWidth / 2) && y <= (tileHeight / 2))
+    LookupTable table;
+    for (auto i = 0u; i < table.size(); ++i)
     {
-        outputTile[0] = {tilesHorizontal - 1, 0};
-        return true;
+        table[i] = pointFunction ? pointFunction(static_cast<uint8_t>(i)) : static_cast<uint8_t>(i);
     }
-    // Is it in the bottom right corner?
-    else if (x >= ((tileWidth * tilesHorizontal) - tileWidth / 2) &&
-             y >= ((tileHeight * tilesVertical) - tileHeight / 2))
-    {
-        outputTile[0] = {tilesHorizontal - 1, tilesVertical - 1};
-        return true;
-    }
-    // Is it in the bottom left corner?
-    else if (x <= (tileWidth / 2) && y > ((tileHeight * tilesVertical) - tileHeight / 2))
-    {
-        outputTile[0] = {0, tilesVertical - 1};
-        return true;
-    }
-    // The pixel is not in a corner
-    return false;
+    return table;
 }
 
-static bool isBorderRegion(unsigned int x,
-                           unsigned int y,
-                           unsigned int tilesHorizontal,
-                           unsigned int tilesVertical,
-                           unsigned int inputColumns,
-                           unsigned int inputRows,
-                           std::array<TileCoordinates, 4> & outputTile)
+ClahePointOperations::ClahePointOperations()
+  : preOperation(makeLookupTable(nullptr)), postOperation(makeLookupTable(nullptr))
 {
-    unsigned int const tileWidth(inputColumns / tilesHorizontal);
-    unsigned int const tileHeight(inputRows / tilesVertical);
-
-    // Is it on the top border?
-    if (y <= (tileHeight / 2))
-    {
-        // Tile coordinates in y direction are 0
-        // Now find tile x-coordinates
-        unsigned int leftX = getLowerTileCoordinate(x, tileWidth);
-        unsigned int rightX = leftX + 1;
-        outputTile[0] = {leftX, 0};
-        outputTile[1] = {rightX, 0};
-        return true;
-    }
-    // Is it on the bottom border?
-    else if (y >= ((tilesVertical * tileHeight) - tileHeight / 2))
-    {
-        // Tile coordinates in y direction are tilesVertical - 1
-        // Now find the x-coordinates
-        unsigned int leftX = getLowerTileCoordinate(x, tileWidth);
-        unsigned int rightX = leftX + 1;
-        outputTile[0] = {leftX, tilesVertical - 1};
-        outputTile[1] = {rightX, tilesVertical - 1};
-        return true;
-    }
-    // Is it on the left border?
-    else if (x <= (tileWidth / 2))
-    {
-        // Tile coordinates in x direction are 0
-        // Now find the y-coordinates
-        unsigned int topY = getLowerTileCoordinate(y, tileHeight);
-        unsigned int bottomY = topY + 1;
-        outputTile[0] = {0, topY};
-        outputTile[1] = {0, bottomY};
-        return true;
-    }
-    // Is it on the right border?
-    else if (x >= ((tilesHorizontal * tileWidth) - tileWidth / 2))
-    {
-        // Tile coordinates in x direction are tilesHorizontal - 1
-        // Now find the y-coordinates
-        unsigned int topY = getLowerTileCoordinate(y, tileHeight);
-        unsigned int bottomY = topY + 1;
-        outputTile[0] = {tilesHorizontal - 1, topY};
-        outputTile[1] = {tilesHorizontal - 1, bottomY};
-        return true;
-    }
-    // The pixel is not in a border
-    return false;
+    // Empty
 }
 
-static void getFourClosestTiles(unsigned int x,
-                                unsigned int y,
-                                unsigned int tilesHorizontal,
-                                unsigned int tilesVertical,
-                                unsigned int inputColumns,
-                                unsigned int inputRows,
-                                std::array<TileCoordinates, 4> & outputTile)
+ClahePointOperations::ClahePointOperations(LookupTable const & _preOperation, LookupTable const & _postOperation)
+  : preOperation(_preOperation), postOperation(_postOperation)
 {
-    unsigned int const tileWidth(inputColumns / tilesHorizontal);
-    unsigned int const tileHeight(inputRows / tilesVertical);
-
-    unsigned int leftX = getLowerTileCoordinate(x, tileWidth);
-    unsigned int rightX = leftX + 1;
-    unsigned int topY = getLowerTileCoordinate(y, tileHeight);
-    unsigned int bottomY = topY + 1;
-
-    // Top left closest
-    outputTile[0] = {leftX, topY};
-    // Top right closest
-    outputTile[1] = {rightX, topY};
-    // Bottom right closest
-    outputTile[2] = {rightX, bottomY};
-    // Bottom left closest
-    outputTile[3] = {leftX, bottomY};
+    // Empty
 }
 
-static unsigned int getPixelCoordinateFromTileCoordinate(unsigned int tileCoordinate,
-                                                         unsigned int pixelsPerTile)
+ClahePointOperations::ClahePointOperations(PointFunction const & _preOperation, PointFunction const & _postOperation)
+  : preOperation(makeLookupTable(_preOperation)), postOperation(makeLookupTable(_postOperation))
 {
-    return (pixelsPerTile / 2) + (tileCoordinate * pixelsPerTile);
+    // Empty
 }
 
-static unsigned int getLowerTileCoordinate(float pixelDimension, float tileDimension)
+template <typename CounterType>
+void areaBasedGrayLevelMapping(Histogram<CounterType> const & histogram, LookupTable * outputTable)
 {
-    return static_cast<unsigned int>((pixelDimension - (tileDimension / 2)) / tileDimension);
-}
\ No newline at end of file
+    unsigned int numberOfPixels(0);
+
+    // Get the total number of pixels in the histogram
+    for (auto i = 0u; i < 256; ++i)
+    {
+        numberOfPixels += histogram[i];
+    }
+
+    unsigned int numberOfPixelsSeen(0);
+    for (auto i = 0u; i < outputTable->size(); ++i)
+    {
+        numberOfPixelsSeen += histogram[i];
+        // How many of the pixels in this histogram have we seen?
+        float ratioOfPixelsSeenToTotal = static_cast<float>(numberOfPixelsSeen) / numberOfPixels;
+        // Readjust towards a more balanced image by moving pixels to where they "should" be
+        outputTable->operator[](i) = static_cast<unsigned char>(
+            ratioOfPixelsSeenToTotal * (outputTable->size() - 1));
+    }
+}
+
+template void areaBasedGrayLevelMapping(CompactHistogram const & histogram, LookupTable * outputTable);
+template void areaBasedGrayLevelMapping(ImageHistogram const & histogram, LookupTable * outputTable);
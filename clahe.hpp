@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <array>
 #include <functional>
 #include "utility.hpp"
 
@@ -20,7 +21,86 @@ class Mat;
 
 using LookupTable = std::array<uint8_t, 256>;
 
-using GrayLevelMappingFunction = std::function<void(ImageHistogram const & histogram, LookupTable * outputTable)>;
+template <typename CounterType>
+using BasicGrayLevelMappingFunction =
+    std::function<void(Histogram<CounterType> const & histogram, LookupTable * outputTable)>;
+
+using GrayLevelMappingFunction = BasicGrayLevelMappingFunction<unsigned int>;
+
+enum LookupTableKind : uint8_t
+{
+    // Every intensity maps to the same output intensity
+    CONSTANT_TABLE = 0,
+    // Every intensity maps to itself
+    IDENTITY_TABLE = 1,
+    // Any other mapping
+    GENERAL_TABLE = 2,
+};
+
+/*
+ * The default gray level mapping, which maps each intensity in proportion to
+ * the fraction of the tile's pixels at or below it. Instantiated for uint16_t
+ * and unsigned int counters.
+ */
+template <typename CounterType>
+void areaBasedGrayLevelMapping(Histogram<CounterType> const & histogram, LookupTable * outputTable);
+
+/*
+ * Classifies a gray level mapping so that regions of the image which only
+ * depend on degenerate tables can be produced with cheaper kernels.
+ */
+LookupTableKind classifyLookupTable(LookupTable const & table) noexcept;
+
+using PointFunction = std::function<uint8_t(uint8_t intensity)>;
+
+/*
+ * Tabulates a point operation on intensities.
+ */
+LookupTable makeLookupTable(PointFunction const & pointFunction);
+
+/*
+ * Point operations fused into a CLAHE run, i.e. a gamma correction or black
+ * level offset before it and a display transfer curve after it, at no extra
+ * pass over the image.
+ *
+ * The pre-operation is applied to the bins of each tile histogram and then
+ * composed into the front of the tile's table, so the result is exactly that
+ * of equalizing the pre-processed image. The post-operation is composed into
+ * the back of each tile's table, which is exact where a pixel depends on a
+ * single table and for affine post-operations. Elsewhere it is applied to the
+ * tables before they are blended rather than to the blended value.
+ */
+struct ClahePointOperations
+{
+    LookupTable preOperation;
+    LookupTable postOperation;
+
+    // Identity operations
+    ClahePointOperations();
+
+    ClahePointOperations(LookupTable const & _preOperation, LookupTable const & _postOperation);
+
+    // An empty function stands for the identity
+    ClahePointOperations(PointFunction const & _preOperation, PointFunction const & _postOperation);
+};
+
+/*
+ * Quality metrics of a CLAHE run, gathered while the algorithm is already
+ * reading the input (from the tile histograms) and writing the output.
+ */
+struct ClaheStatistics
+{
+    ImageHistogram inputHistogram;
+    ImageHistogram outputHistogram;
+    double inputMean;
+    double inputVariance;
+    double inputEntropy;
+    double outputMean;
+    double outputVariance;
+    double outputEntropy;
+    // Absolute difference between the input and output mean intensities
+    double meanBrightnessError;
+};
 
 /*
  * Takes a grayscale image and runs a CLAHE algorithm on it.
@@ -40,3 +120,38 @@ using GrayLevelMappingFunction = std::function<void(ImageHistogram const & histo
                         cv::Mat & output,
                         GrayLevelMappingFunction mapping,
                         double clipLimit = 40.0) noexcept;
+
+/*
+ * Takes a grayscale image and runs a CLAHE algorithm on it, additionally
+ * collecting the input and output histograms and their statistics without
+ * any extra passes over either image.
+ *
+ * statistics- The structure in which the metrics are to be populated.
+ */
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClaheStatistics & statistics,
+                        double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClaheStatistics & statistics,
+                        GrayLevelMappingFunction mapping,
+                        double clipLimit = 40.0) noexcept;
+
+/*
+ * Takes a grayscale image and runs a CLAHE algorithm on it with point
+ * operations before and after it, in a single read and write of the image.
+ *
+ * operations- The pre- and post-operations to fuse into the tile tables.
+ */
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClahePointOperations const & operations,
+                        double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int clahe(cv::Mat const & input,
+                        cv::Mat & output,
+                        ClahePointOperations const & operations,
+                        GrayLevelMappingFunction mapping,
+                        double clipLimit = 40.0) noexcept;
@@ -0,0 +1,244 @@
+/*
+ * file: client.cpp
+ * purpose: Implements a small client for the CLAHE server which sends file
+ *          jobs, or times a stream of shared memory frames, over the server's
+ *          Unix domain socket.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+static int connectToServer(std::string const & socketPath);
+
+/*
+ * Sends one request line and waits for the response line, false if the
+ * connection failed.
+ */
+static bool exchange(int descriptor, std::string const & request, std::string & response);
+
+/*
+ * Times count round trips of a synthetic frame through shared memory.
+ */
+static int sendFrames(int descriptor, unsigned int columns, unsigned int rows, unsigned int count, char const * clipLimit);
+#endif
+
+static void printUsage()
+{
+    std::cerr << "Usage:" << std::endl
+              << "  clahe-client <socket> file <input path> <output path> [clip limit]" << std::endl
+              << "  clahe-client <socket> frames <columns> <rows> <count> [clip limit]" << std::endl
+              << "  clahe-client <socket> ping" << std::endl
+              << "  clahe-client <socket> shutdown" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+#ifdef __linux__
+    if (argc < 3)
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::string const command(argv[2]);
+    int const descriptor = connectToServer(argv[1]);
+    if (descriptor < 0)
+    {
+        std::cerr << "Cannot connect to " << argv[1] << std::endl;
+        return 1;
+    }
+
+    int retVal(0);
+    std::string response;
+    if (command == "file" && (argc == 5 || argc == 6))
+    {
+        std::string request = std::string("FILE ") + argv[3] + " " + argv[4];
+        if (argc == 6)
+        {
+            request += std::string(" ") + argv[5];
+        }
+        retVal = exchange(descriptor, request, response) && response.compare(0, 2, "OK") == 0 ? 0 : 1;
+        std::cout << response << std::endl;
+    }
+    else if (command == "frames" && (argc == 6 || argc == 7))
+    {
+        retVal = sendFrames(descriptor, std::atoi(argv[3]), std::atoi(argv[4]), std::atoi(argv[5]),
+                            argc == 7 ? argv[6] : nullptr);
+    }
+    else if (command == "ping" || command == "shutdown")
+    {
+        retVal = exchange(descriptor, command == "ping" ? "PING" : "SHUTDOWN", response) && response == "OK" ? 0 : 1;
+        std::cout << response << std::endl;
+    }
+    else
+    {
+        printUsage();
+        retVal = 2;
+    }
+
+    if (command != "shutdown")
+    {
+        exchange(descriptor, "QUIT", response);
+    }
+    close(descriptor);
+    return retVal;
+#else
+    (void)argc;
+    (void)argv;
+    printUsage();
+    std::cerr << "The CLAHE server is only available on Linux." << std::endl;
+    return 1;
+#endif
+}
+
+#ifdef __linux__
+static int connectToServer(std::string const & socketPath)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int const descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (descriptor < 0)
+    {
+        return -1;
+    }
+    if (connect(descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+static bool exchange(int descriptor, std::string const & request, std::string & response)
+{
+    auto const message = request + '\n';
+    size_t sent(0);
+    while (sent < message.size())
+    {
+        auto const written = send(descriptor, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+
+    // Responses are single short lines, so reading a byte at a time is fine
+    response.clear();
+    char character;
+    while (read(descriptor, &character, 1) == 1)
+    {
+        if (character == '\n')
+        {
+            return true;
+        }
+        response += character;
+    }
+    return false;
+}
+
+static int sendFrames(int descriptor, unsigned int columns, unsigned int rows, unsigned int count, char const * clipLimit)
+{
+    if (columns == 0 || rows == 0 || count == 0)
+    {
+        printUsage();
+        return 2;
+    }
+
+    auto const name = "/clahe-client-" + std::to_string(getpid());
+    auto const frameSize = static_cast<size_t>(columns) * rows;
+    int const memory = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (memory < 0 || ftruncate(memory, static_cast<off_t>(2 * frameSize)) != 0)
+    {
+        std::cerr << "Cannot create shared memory " << name << std::endl;
+        if (memory >= 0)
+        {
+            close(memory);
+            shm_unlink(name.c_str());
+        }
+        return 1;
+    }
+    auto const data = static_cast<uint8_t *>(
+        mmap(nullptr, 2 * frameSize, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0));
+    if (MAP_FAILED == static_cast<void *>(data))
+    {
+        close(memory);
+        shm_unlink(name.c_str());
+        return 1;
+    }
+
+    // A low contrast gradient with some texture, something worth equalizing
+    for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+    {
+        for (auto colIdx = 0u; colIdx < columns; ++colIdx)
+        {
+            data[rowIdx * static_cast<size_t>(columns) + colIdx] =
+                static_cast<uint8_t>(96 + (colIdx * 64) / columns + ((colIdx ^ rowIdx) & 7));
+        }
+    }
+
+    std::string request = "SHM " + name + " " + std::to_string(columns) + " " + std::to_string(rows);
+    if (nullptr != clipLimit)
+    {
+        request += std::string(" ") + clipLimit;
+    }
+
+    int retVal(0);
+    std::string response;
+    std::vector<double> roundTrips, serverTimes;
+    for (auto frame = 0u; frame < count; ++frame)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        if (!exchange(descriptor, request, response) || response.compare(0, 3, "OK ") != 0)
+        {
+            std::cerr << "Frame " << frame << ": " << response << std::endl;
+            retVal = 1;
+            break;
+        }
+        auto const stop = std::chrono::steady_clock::now();
+        roundTrips.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+        serverTimes.push_back(std::atof(response.c_str() + 3));
+    }
+
+    if (!roundTrips.empty())
+    {
+        auto const report = [](char const * label, std::vector<double> & times) {
+            std::sort(times.begin(), times.end());
+            double total(0.0);
+            for (auto time : times)
+            {
+                total += time;
+            }
+            std::cout << label << " (us): min " << times.front() << ", median " << times[times.size() / 2]
+                      << ", mean " << total / times.size() << ", max " << times.back() << std::endl;
+        };
+        std::cout << roundTrips.size() << " frames of " << columns << "x" << rows << std::endl;
+        report("Round trip", roundTrips);
+        report("Server", serverTimes);
+    }
+
+    munmap(data, 2 * frameSize);
+    close(memory);
+    shm_unlink(name.c_str());
+    return retVal;
+}
+#endif
@@ -0,0 +1,150 @@
+/*
+ * file: downscale.cpp
+ * purpose: Implementation of the fused downscale and equalize front end.
+ */
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "downscale.hpp"
+#include "tiles.hpp"
+
+/*
+ * The state of one reduced output while the input rows stream past.
+ */
+struct ScaledOutput
+{
+    unsigned int scale;
+    InterpolationPlan plan;
+    // Sum of each block of the current block row
+    std::vector<unsigned int> blockSums;
+    std::vector<uint8_t> averagedRow;
+    // The vertical region of the current block row
+    unsigned int regionY;
+
+    ScaledOutput(unsigned int _scale, InterpolationPlan const & _fullPlan, unsigned int _columns)
+      : scale(_scale),
+        plan(_fullPlan, _scale),
+        blockSums((_columns + _scale - 1) / _scale, 0),
+        averagedRow(blockSums.size()),
+        regionY(0)
+    {
+        // Empty
+    }
+};
+
+static int equalizeDownscaled(cv::Mat const & input,
+                              std::vector<unsigned int> const & scales,
+                              std::vector<cv::Mat> & outputs,
+                              GrayLevelMappingFunction const & mapping,
+                              double clipLimit) noexcept;
+
+[[nodiscard]] int claheDownscaled(cv::Mat const & input,
+                                  std::vector<unsigned int> const & scales,
+                                  std::vector<cv::Mat> & outputs,
+                                  double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeDownscaled(input, scales, outputs, nullptr, clipLimit);
+}
+
+[[nodiscard]] int claheDownscaled(cv::Mat const & input,
+                                  std::vector<unsigned int> const & scales,
+                                  std::vector<cv::Mat> & outputs,
+                                  GrayLevelMappingFunction mapping,
+                                  double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeDownscaled(input, scales, outputs, mapping, clipLimit);
+}
+
+static int equalizeDownscaled(cv::Mat const & input,
+                              std::vector<unsigned int> const & scales,
+                              std::vector<cv::Mat> & outputs,
+                              GrayLevelMappingFunction const & mapping,
+                              double clipLimit) noexcept
+{
+    // Data on the tiles the image will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical) || scales.empty() ||
+        std::find(scales.cbegin(), scales.cend(), 0u) != scales.cend())
+    {
+        return -1;
+    }
+
+    unsigned int const columns(input.cols), rows(input.rows);
+
+    try
+    {
+        // The tables come from the full resolution image, as in clahe()
+        TileLookupTables claheLookupTables(TileGrid(tilesHorizontal, tilesVertical, columns, rows));
+        for (auto rowIdx = 0u; rowIdx < tilesVertical; ++rowIdx)
+        {
+            for (auto colIdx = 0u; colIdx < tilesHorizontal; ++colIdx)
+            {
+                generateTileLookupTable(input, colIdx, rowIdx, mapping, clipLimit, claheLookupTables, nullptr);
+            }
+        }
+        selectRegionKernels(claheLookupTables);
+
+        InterpolationPlan const fullPlan(claheLookupTables.grid);
+        std::vector<ScaledOutput> scaledOutputs;
+        outputs.resize(scales.size());
+        for (auto i = 0u; i < scales.size(); ++i)
+        {
+            scaledOutputs.emplace_back(scales[i], fullPlan, columns);
+            outputs[i].create((rows + scales[i] - 1) / scales[i], (columns + scales[i] - 1) / scales[i], CV_8UC1);
+        }
+
+        // Every input row is read once and added to the current block row of each scale
+        for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+
+            for (auto i = 0u; i < scaledOutputs.size(); ++i)
+            {
+                auto & scaled = scaledOutputs[i];
+                auto const scale = scaled.scale;
+
+                for (auto blockIdx = 0u; blockIdx < scaled.blockSums.size(); ++blockIdx)
+                {
+                    auto const blockEnd = std::min((blockIdx + 1) * scale, columns);
+                    unsigned int sum(0);
+                    for (auto colIdx = blockIdx * scale; colIdx < blockEnd; ++colIdx)
+                    {
+                        sum += inputRow[colIdx];
+                    }
+                    scaled.blockSums[blockIdx] += sum;
+                }
+
+                if ((rowIdx + 1) % scale != 0 && rowIdx + 1 != rows)
+                {
+                    continue;
+                }
+
+                // The block row is complete, average it and produce its output row
+                auto const outputRowIdx = rowIdx / scale;
+                auto const blockHeight = rowIdx + 1 - outputRowIdx * scale;
+                for (auto blockIdx = 0u; blockIdx < scaled.blockSums.size(); ++blockIdx)
+                {
+                    auto const blockWidth = std::min(scale, columns - blockIdx * scale);
+                    auto const blockSize = blockWidth * blockHeight;
+                    scaled.averagedRow[blockIdx] =
+                        static_cast<uint8_t>((scaled.blockSums[blockIdx] + blockSize / 2) / blockSize);
+                    scaled.blockSums[blockIdx] = 0;
+                }
+
+                while (outputRowIdx >= scaled.plan.verticalSpans[scaled.regionY].end)
+                {
+                    ++scaled.regionY;
+                }
+                interpolateRow(scaled.averagedRow.data(), outputs[i].ptr<uint8_t>(outputRowIdx), claheLookupTables,
+                               scaled.plan, scaled.regionY, scaled.plan.rowWeights[outputRowIdx], nullptr);
+            }
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * file: downscale.hpp
+ * purpose: Declaration of a CLAHE front end which writes its output straight
+ *          at reduced resolutions, for thumbnails and previews.
+ */
+
+#pragma once
+
+#include <vector>
+#include "clahe.hpp"
+
+/*
+ * Takes a grayscale image and runs a CLAHE algorithm on it, producing only
+ * reduced resolution outputs without a full resolution intermediate.
+ *
+ * The tile tables are built from the full resolution image as in clahe().
+ * Each output pixel then averages its scale x scale block of input pixels
+ * and maps the average through the blend of the tile tables at the middle of
+ * the block. All of the scales are produced from a single read of the input
+ * rows. A scale of 1 gives the same output as clahe(). Larger scales are
+ * close to, but not the same as, reducing the output of clahe(), since the
+ * tables are applied after averaging; blocks which straddle a strong edge
+ * differ the most.
+ *
+ * input- The matrix holding the input image.
+ * scales- The reduction factor of each output, at least 1.
+ * outputs- Receives one image per scale, with ceil(columns / scale) columns
+ *          and ceil(rows / scale) rows; partial blocks on the right and
+ *          bottom edges average the pixels they have.
+ * clipLimit- The limit for a single bin of the histogram.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int claheDownscaled(cv::Mat const & input,
+                                  std::vector<unsigned int> const & scales,
+                                  std::vector<cv::Mat> & outputs,
+                                  double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int claheDownscaled(cv::Mat const & input,
+                                  std::vector<unsigned int> const & scales,
+                                  std::vector<cv::Mat> & outputs,
+                                  GrayLevelMappingFunction mapping,
+                                  double clipLimit = 40.0) noexcept;
@@ -0,0 +1,283 @@
+/*
+ * file: fixedclahe.hpp
+ * purpose: A CLAHE front end for deployments where the frame size and tile
+ *          grid never change. The geometry is given as template parameters so
+ *          every tile boundary, tile center and interpolation weight is a
+ *          compile time constant.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "opencv2/core.hpp"
+#include "tiles.hpp"
+
+/*
+ * Runs the CLAHE algorithm with the default gray level mapping on frames of
+ * exactly Columns x Rows pixels, the output is identical to clahe().
+ *
+ * The weight tables are generated by constexpr functions and the rows of each
+ * interpolation region are produced by a kernel instantiated for that region,
+ * so the border regions, which only read one or two tables, carry no blending
+ * code for the missing neighbors. Nothing is allocated per frame apart from
+ * the output, and only when it does not already have the right size.
+ *
+ *     FixedClahe<1280, 720> equalizer;
+ *     equalizer.apply(input, output);
+ */
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal = 8, unsigned int TilesVertical = 8>
+class FixedClahe
+{
+    static_assert(TilesHorizontal > 0 && TilesVertical > 0, "The grid needs at least one tile");
+    static_assert(Columns >= TilesHorizontal && Rows >= TilesVertical, "Every tile needs at least one pixel");
+
+public:
+    static constexpr unsigned int tileWidth = Columns / TilesHorizontal;
+    static constexpr unsigned int tileHeight = Rows / TilesVertical;
+
+    /*
+     * _clipLimit- The limit for a single bin of the histogram.
+     */
+    explicit FixedClahe(double _clipLimit = 40.0)
+      : clipLimit(_clipLimit), tables()
+    {
+        // Empty
+    }
+
+    /*
+     * Equalizes a grayscale frame of the fixed size, returns 0 on success and
+     * -1 on failure.
+     */
+    [[nodiscard]] int apply(cv::Mat const & input, cv::Mat & output) noexcept;
+
+private:
+    // The tiles on the right and bottom edges also cover the pixels left over
+    static constexpr unsigned int lastTileWidth = tileWidth + Columns % TilesHorizontal;
+    static constexpr unsigned int lastTileHeight = tileHeight + Rows % TilesVertical;
+
+    // The narrowest counters which can hold the largest tile
+    using CounterType = std::conditional_t<
+        static_cast<unsigned long long>(lastTileWidth) * lastTileHeight <= UINT16_MAX, uint16_t, unsigned int>;
+
+    static constexpr unsigned int getTileCenter(unsigned int tile, unsigned int pixelsPerTile)
+    {
+        return (pixelsPerTile / 2) + (tile * pixelsPerTile);
+    }
+
+    template <unsigned int Tiles>
+    static constexpr std::array<InterpolationSpan, Tiles + 1> getInterpolationSpans(unsigned int pixelsPerTile,
+                                                                                    unsigned int pixels);
+
+    template <unsigned int Pixels>
+    static constexpr std::array<float, Pixels> getInterpolationWeights(unsigned int tiles,
+                                                                       unsigned int pixelsPerTile);
+
+    static constexpr std::array<InterpolationSpan, TilesHorizontal + 1> horizontalSpans =
+        getInterpolationSpans<TilesHorizontal>(tileWidth, Columns);
+    static constexpr std::array<InterpolationSpan, TilesVertical + 1> verticalSpans =
+        getInterpolationSpans<TilesVertical>(tileHeight, Rows);
+    static constexpr std::array<float, Columns> columnWeights =
+        getInterpolationWeights<Columns>(TilesHorizontal, tileWidth);
+    static constexpr std::array<float, Rows> rowWeights = getInterpolationWeights<Rows>(TilesVertical, tileHeight);
+
+    void generateLookupTables(cv::Mat const & input) noexcept;
+
+    template <std::size_t... RegionY>
+    void produceRows(cv::Mat const & input, cv::Mat & output, std::index_sequence<RegionY...>) const noexcept;
+
+    template <std::size_t RegionY>
+    void produceRegionRows(cv::Mat const & input, cv::Mat & output) const noexcept;
+
+    template <std::size_t RegionY, std::size_t... RegionX>
+    void produceRow(uint8_t const * inputRow,
+                    uint8_t * outputRow,
+                    float rowWeight,
+                    std::index_sequence<RegionX...>) const noexcept;
+
+    template <std::size_t RegionY, std::size_t RegionX>
+    void produceRegionRow(uint8_t const * inputRow, uint8_t * outputRow, float rowWeight) const noexcept;
+
+    double const clipLimit;
+    // Row-major, one table per tile
+    std::array<LookupTable, TilesHorizontal * TilesVertical> tables;
+};
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+[[nodiscard]] int FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::apply(cv::Mat const & input,
+                                                                                 cv::Mat & output) noexcept
+{
+    if (input.type() != CV_8UC1 || input.cols != static_cast<int>(Columns) || input.rows != static_cast<int>(Rows))
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(Rows, Columns, CV_8UC1);
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    generateLookupTables(input);
+    produceRows(input, output, std::make_index_sequence<TilesVertical + 1>());
+
+    return 0;
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <unsigned int Tiles>
+constexpr std::array<InterpolationSpan, Tiles + 1>
+FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::getInterpolationSpans(unsigned int pixelsPerTile,
+                                                                                 unsigned int pixels)
+{
+    std::array<InterpolationSpan, Tiles + 1> spans{};
+
+    // Pixels before the first tile center only use the first tile
+    spans[0] = {0, getTileCenter(0, pixelsPerTile), 0, 0};
+    for (auto tile = 0u; tile + 1 < Tiles; ++tile)
+    {
+        spans[tile + 1] = {getTileCenter(tile, pixelsPerTile), getTileCenter(tile + 1, pixelsPerTile), tile, tile + 1};
+    }
+    // Pixels after the last tile center only use the last tile
+    spans[Tiles] = {getTileCenter(Tiles - 1, pixelsPerTile), pixels, Tiles - 1, Tiles - 1};
+
+    return spans;
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <unsigned int Pixels>
+constexpr std::array<float, Pixels>
+FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::getInterpolationWeights(unsigned int tiles,
+                                                                                   unsigned int pixelsPerTile)
+{
+    std::array<float, Pixels> weights{};
+
+    // Pixels outside of the first and last tile centers use a single tile and keep a weight of 0
+    for (auto pixel = getTileCenter(0, pixelsPerTile); pixel < getTileCenter(tiles - 1, pixelsPerTile); ++pixel)
+    {
+        auto const lowerTile = (pixel - pixelsPerTile / 2) / pixelsPerTile;
+        weights[pixel] = static_cast<float>(pixel - getTileCenter(lowerTile, pixelsPerTile)) / pixelsPerTile;
+    }
+
+    return weights;
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+void FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::generateLookupTables(cv::Mat const & input) noexcept
+{
+    for (auto tileY = 0u; tileY < TilesVertical; ++tileY)
+    {
+        // Count a whole row of tiles at a time so every image row is read once, in order
+        std::array<Histogram<CounterType>, TilesHorizontal> histograms;
+        auto const rowBegin = tileY * tileHeight;
+        auto const rowEnd = (tileY + 1 == TilesVertical) ? Rows : rowBegin + tileHeight;
+
+        for (auto rowIdx = rowBegin; rowIdx < rowEnd; ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+            for (auto tileX = 0u; tileX + 1 < TilesHorizontal; ++tileX)
+            {
+                auto const tileRow = inputRow + tileX * tileWidth;
+                for (auto colIdx = 0u; colIdx < tileWidth; ++colIdx)
+                {
+                    ++histograms[tileX].histogram[tileRow[colIdx]];
+                }
+            }
+
+            auto const lastTileRow = inputRow + (TilesHorizontal - 1) * tileWidth;
+            for (auto colIdx = 0u; colIdx < lastTileWidth; ++colIdx)
+            {
+                ++histograms[TilesHorizontal - 1].histogram[lastTileRow[colIdx]];
+            }
+        }
+
+        for (auto tileX = 0u; tileX < TilesHorizontal; ++tileX)
+        {
+            clipHistogram(histograms[tileX], clipLimit);
+            areaBasedGrayLevelMapping(histograms[tileX], &tables[tileY * TilesHorizontal + tileX]);
+        }
+    }
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <std::size_t... RegionY>
+void FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::produceRows(cv::Mat const & input,
+                                                                            cv::Mat & output,
+                                                                            std::index_sequence<RegionY...>) const
+    noexcept
+{
+    (produceRegionRows<RegionY>(input, output), ...);
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <std::size_t RegionY>
+void FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::produceRegionRows(cv::Mat const & input,
+                                                                                  cv::Mat & output) const noexcept
+{
+    constexpr auto span = verticalSpans[RegionY];
+    for (auto rowIdx = span.begin; rowIdx < span.end; ++rowIdx)
+    {
+        produceRow<RegionY>(input.ptr<uint8_t>(rowIdx), output.ptr<uint8_t>(rowIdx), rowWeights[rowIdx],
+                            std::make_index_sequence<TilesHorizontal + 1>());
+    }
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <std::size_t RegionY, std::size_t... RegionX>
+void FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::produceRow(uint8_t const * inputRow,
+                                                                           uint8_t * outputRow,
+                                                                           float rowWeight,
+                                                                           std::index_sequence<RegionX...>) const
+    noexcept
+{
+    (produceRegionRow<RegionY, RegionX>(inputRow, outputRow, rowWeight), ...);
+}
+
+template <unsigned int Columns, unsigned int Rows, unsigned int TilesHorizontal, unsigned int TilesVertical>
+template <std::size_t RegionY, std::size_t RegionX>
+void FixedClahe<Columns, Rows, TilesHorizontal, TilesVertical>::produceRegionRow(uint8_t const * inputRow,
+                                                                                 uint8_t * outputRow,
+                                                                                 float rowWeight) const noexcept
+{
+    constexpr auto horizontal = horizontalSpans[RegionX];
+    constexpr auto vertical = verticalSpans[RegionY];
+    constexpr bool blendHorizontal = horizontal.lowerTile != horizontal.upperTile;
+    constexpr bool blendVertical = vertical.lowerTile != vertical.upperTile;
+
+    auto const & topLeft = tables[vertical.lowerTile * TilesHorizontal + horizontal.lowerTile];
+    auto const & topRight = tables[vertical.lowerTile * TilesHorizontal + horizontal.upperTile];
+    auto const & bottomLeft = tables[vertical.upperTile * TilesHorizontal + horizontal.lowerTile];
+    auto const & bottomRight = tables[vertical.upperTile * TilesHorizontal + horizontal.upperTile];
+
+    for (auto colIdx = horizontal.begin; colIdx < horizontal.end; ++colIdx)
+    {
+        auto const intensity = inputRow[colIdx];
+
+        // Same a + (b - a) * t form as clahe(), a border region simply skips
+        // the terms whose weight is always 0
+        float top = topLeft[intensity];
+        float bottom = bottomLeft[intensity];
+        if constexpr (blendHorizontal)
+        {
+            top += (static_cast<float>(topRight[intensity]) - topLeft[intensity]) * columnWeights[colIdx];
+            if constexpr (blendVertical)
+            {
+                bottom += (static_cast<float>(bottomRight[intensity]) - bottomLeft[intensity]) * columnWeights[colIdx];
+            }
+        }
+
+        if constexpr (blendVertical)
+        {
+            outputRow[colIdx] = static_cast<uint8_t>(top + (bottom - top) * rowWeight);
+        }
+        else
+        {
+            outputRow[colIdx] = static_cast<uint8_t>(top);
+        }
+    }
+}
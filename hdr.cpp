@@ -0,0 +1,367 @@
+/*
+ * file: hdr.cpp
+ * purpose: Implementation of the floating point high dynamic range CLAHE
+ *          front end.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "hdr.hpp"
+#include "tiles.hpp"
+
+// A bin index has to fit the 16-bit bin image
+static unsigned int const maximumBinCount(1u << 16);
+
+static int equalizeHdr(cv::Mat const & input,
+                       cv::Mat & output,
+                       int outputDepth,
+                       HdrBinning const & binning,
+                       double clipLimit) noexcept;
+
+/*
+ * The smallest positive and the largest finite radiance of the image, or 1
+ * and 2 if it has none.
+ */
+static void findRadianceRange(cv::Mat const & input, float & minimum, float & maximum);
+
+/*
+ * log2 from the exponent of a normal float and a polynomial of its mantissa,
+ * good to 3e-5, without a branch or a library call so loops using it vectorize.
+ */
+static inline float approximateLog2(float value) noexcept;
+
+/*
+ * Computes the bin of every radiance of a row.
+ */
+static void computeBins(float const * radiances,
+                        uint16_t * bins,
+                        unsigned int count,
+                        float minimum,
+                        float maximum,
+                        float logMinimum,
+                        float binsPerStop,
+                        int lastBin) noexcept;
+
+/*
+ * Clips a tile histogram and maps it into display values, with the rules of
+ * clipHistogram() and areaBasedGrayLevelMapping() over any number of bins.
+ */
+template <typename OutputType>
+static void mapHdrHistogram(unsigned int * histogram,
+                            unsigned int binCount,
+                            double clipLimit,
+                            OutputType * outputTable) noexcept;
+
+template <typename OutputType>
+static void interpolateHdr(cv::Mat const & bins,
+                           cv::Mat & output,
+                           std::vector<OutputType> const & tables,
+                           unsigned int binCount,
+                           TileGrid const & grid,
+                           InterpolationPlan const & plan) noexcept;
+
+template <typename OutputType>
+static void equalizeBins(cv::Mat const & input,
+                         cv::Mat & output,
+                         cv::Mat & bins,
+                         HdrBinning const & binning,
+                         double clipLimit,
+                         TileGrid const & grid);
+
+[[nodiscard]] int claheHdr(cv::Mat const & input,
+                           cv::Mat & output,
+                           int outputDepth,
+                           HdrBinning const & binning /* = HdrBinning() */,
+                           double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeHdr(input, output, outputDepth, binning, clipLimit);
+}
+
+static int equalizeHdr(cv::Mat const & input,
+                       cv::Mat & output,
+                       int outputDepth,
+                       HdrBinning const & binning,
+                       double clipLimit) noexcept
+{
+    // Data on the tiles the image will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    if (input.type() != CV_32FC1 || (outputDepth != CV_8U && outputDepth != CV_16U) || binning.binCount < 2 ||
+        binning.binCount > maximumBinCount || static_cast<unsigned int>(input.cols) < tilesHorizontal ||
+        static_cast<unsigned int>(input.rows) < tilesVertical)
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), CV_MAKETYPE(outputDepth, 1));
+        cv::Mat bins(input.size(), CV_16UC1);
+        TileGrid const grid(tilesHorizontal, tilesVertical, input.cols, input.rows);
+
+        if (outputDepth == CV_8U)
+        {
+            equalizeBins<uint8_t>(input, output, bins, binning, clipLimit, grid);
+        }
+        else
+        {
+            equalizeBins<uint16_t>(input, output, bins, binning, clipLimit, grid);
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+template <typename OutputType>
+static void equalizeBins(cv::Mat const & input,
+                         cv::Mat & output,
+                         cv::Mat & bins,
+                         HdrBinning const & binning,
+                         double clipLimit,
+                         TileGrid const & grid)
+{
+    auto const binCount = binning.binCount;
+    auto minimum(binning.minimum), maximum(binning.maximum);
+    if (!(minimum < maximum))
+    {
+        findRadianceRange(input, minimum, maximum);
+    }
+    // The exponent trick of approximateLog2() needs normal floats
+    minimum = std::max(minimum, std::numeric_limits<float>::min());
+    maximum = std::max(maximum, minimum * 2.0f);
+
+    auto const logMinimum = approximateLog2(minimum);
+    auto const binsPerStop = binCount / (approximateLog2(maximum) - logMinimum);
+    // The same multiple of a tile's mean bin count as clipLimit is of its mean
+    // over 256 bins, kept at a whole pixel or more, as a fine binning would
+    // otherwise truncate the limit to nothing and clip every bin to zero
+    auto const scaledClipLimit = std::max(clipLimit * 256.0 / binCount, 1.0);
+
+    // One row of tiles at a time, so the histograms being filled stay in cache
+    std::vector<unsigned int> histograms(grid.tilesHorizontal * binCount);
+    std::vector<OutputType> tables(grid.tilesHorizontal * grid.tilesVertical * binCount);
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        auto const rows = grid.getTileBounds(0, tileY);
+        for (auto rowIdx = rows.y; rowIdx < rows.y + rows.height; ++rowIdx)
+        {
+            auto const binRow = bins.ptr<uint16_t>(rowIdx);
+            computeBins(input.ptr<float>(rowIdx), binRow, static_cast<unsigned int>(input.cols), minimum, maximum,
+                        logMinimum, binsPerStop, static_cast<int>(binCount) - 1);
+
+            for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+            {
+                auto const columns = grid.getTileBounds(tileX, tileY);
+                auto const histogram = histograms.data() + tileX * binCount;
+                for (auto colIdx = columns.x; colIdx < columns.x + columns.width; ++colIdx)
+                {
+                    ++histogram[binRow[colIdx]];
+                }
+            }
+        }
+
+        for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+        {
+            auto const histogram = histograms.data() + tileX * binCount;
+            mapHdrHistogram(histogram, binCount, scaledClipLimit,
+                            tables.data() + (tileY * grid.tilesHorizontal + tileX) * binCount);
+            std::fill(histogram, histogram + binCount, 0u);
+        }
+    }
+
+    interpolateHdr(bins, output, tables, binCount, grid, InterpolationPlan(grid));
+}
+
+static void findRadianceRange(cv::Mat const & input, float & minimum, float & maximum)
+{
+    // Non-negative floats order the same as their bits, and the integer
+    // reductions vectorize where float ones, having to keep NaN, do not
+    int32_t const infinityBits(0x7f800000);
+    int32_t smallestBits(infinityBits), largestBits(0);
+    for (auto rowIdx = 0; rowIdx < input.rows; ++rowIdx)
+    {
+        auto const inputRow = input.ptr<float>(rowIdx);
+        for (auto colIdx = 0; colIdx < input.cols; ++colIdx)
+        {
+            int32_t bits;
+            std::memcpy(&bits, inputRow + colIdx, sizeof(bits));
+            // Negative radiances have the sign bit set, NaN and infinity are at or above infinityBits
+            auto const finite = (bits < infinityBits) ? bits : 0;
+            smallestBits = std::min(smallestBits, (finite > 0) ? finite : infinityBits);
+            largestBits = std::max(largestBits, finite);
+        }
+    }
+
+    if (largestBits == 0)
+    {
+        minimum = 1.0f;
+        maximum = 2.0f;
+        return;
+    }
+    std::memcpy(&minimum, &smallestBits, sizeof(minimum));
+    std::memcpy(&maximum, &largestBits, sizeof(maximum));
+}
+
+static inline float approximateLog2(float value) noexcept
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto const exponent = static_cast<float>(static_cast<int>((bits >> 23) & 0xffu) - 127);
+
+    uint32_t const mantissaBits = (bits & 0x7fffffu) | 0x3f800000u;
+    float mantissa;
+    std::memcpy(&mantissa, &mantissaBits, sizeof(mantissa));
+
+    // Least squares fit of log2(1 + t) over [0, 1)
+    auto const t = mantissa - 1.0f;
+    auto const polynomial =
+        t * (1.44182550f + t * (-0.70867891f + t * (0.41541119f + t * (-0.19440832f + t * 0.04587895f))));
+    return exponent + polynomial;
+}
+
+static void computeBins(float const * radiances,
+                        uint16_t * bins,
+                        unsigned int count,
+                        float minimum,
+                        float maximum,
+                        float logMinimum,
+                        float binsPerStop,
+                        int lastBin) noexcept
+{
+    for (auto i = 0u; i < count; ++i)
+    {
+        // Selects rather than std::max and std::min, which would let NaN through
+        auto radiance = radiances[i];
+        radiance = (radiance > minimum) ? radiance : minimum;
+        radiance = (radiance < maximum) ? radiance : maximum;
+
+        auto const bin = static_cast<int>((approximateLog2(radiance) - logMinimum) * binsPerStop);
+        bins[i] = static_cast<uint16_t>(std::min(std::max(bin, 0), lastBin));
+    }
+}
+
+template <typename OutputType>
+static void mapHdrHistogram(unsigned int * histogram,
+                            unsigned int binCount,
+                            double clipLimit,
+                            OutputType * outputTable) noexcept
+{
+    unsigned int numberOfPixelsOverLimit(0);
+    for (auto bin = 0u; bin < binCount; ++bin)
+    {
+        if (histogram[bin] > clipLimit)
+        {
+            numberOfPixelsOverLimit += histogram[bin] - clipLimit;
+            histogram[bin] = static_cast<unsigned int>(clipLimit);
+        }
+    }
+
+    unsigned int const excessPixelsPerBin(numberOfPixelsOverLimit / binCount);
+    unsigned int numberOfPixels(0);
+    for (auto bin = 0u; bin < binCount; ++bin)
+    {
+        histogram[bin] += excessPixelsPerBin;
+        numberOfPixels += histogram[bin];
+    }
+
+    // The cumulative share of the tile's pixels, stretched over the display range
+    float const outputMaximum(std::numeric_limits<OutputType>::max());
+    if (numberOfPixels == 0)
+    {
+        // Cannot happen with a limit of a pixel or more, but never divide by zero
+        for (auto bin = 0u; bin < binCount; ++bin)
+        {
+            outputTable[bin] = static_cast<OutputType>(static_cast<float>(bin) / (binCount - 1) * outputMaximum);
+        }
+        return;
+    }
+    unsigned int numberOfPixelsSeen(0);
+    for (auto bin = 0u; bin < binCount; ++bin)
+    {
+        numberOfPixelsSeen += histogram[bin];
+        float ratioOfPixelsSeenToTotal = static_cast<float>(numberOfPixelsSeen) / numberOfPixels;
+        outputTable[bin] = static_cast<OutputType>(ratioOfPixelsSeenToTotal * outputMaximum);
+    }
+}
+
+template <typename OutputType>
+static void interpolateHdr(cv::Mat const & bins,
+                           cv::Mat & output,
+                           std::vector<OutputType> const & tables,
+                           unsigned int binCount,
+                           TileGrid const & grid,
+                           InterpolationPlan const & plan) noexcept
+{
+    auto const tableAt = [&](unsigned int tileX, unsigned int tileY) {
+        return tables.data() + (tileY * grid.tilesHorizontal + tileX) * binCount;
+    };
+
+    for (auto const & verticalSpan : plan.verticalSpans)
+    {
+        auto const top(verticalSpan.lowerTile), bottom(verticalSpan.upperTile);
+        for (auto rowIdx = verticalSpan.begin; rowIdx < verticalSpan.end; ++rowIdx)
+        {
+            auto const binRow = bins.ptr<uint16_t>(rowIdx);
+            auto const outputRow = output.ptr<OutputType>(rowIdx);
+            auto const rowWeight = plan.rowWeights[rowIdx];
+
+            for (auto const & span : plan.horizontalSpans)
+            {
+                auto const left(span.lowerTile), right(span.upperTile);
+                auto const topLeft(tableAt(left, top)), topRight(tableAt(right, top));
+                auto const bottomLeft(tableAt(left, bottom)), bottomRight(tableAt(right, bottom));
+
+                // Border regions skip the blends between a table and itself, which would change nothing
+                if (left == right && top == bottom)
+                {
+                    for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                    {
+                        outputRow[colIdx] = topLeft[binRow[colIdx]];
+                    }
+                    continue;
+                }
+                if (top == bottom)
+                {
+                    for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                    {
+                        auto const bin = binRow[colIdx];
+                        auto const columnWeight = plan.columnWeights[colIdx];
+                        outputRow[colIdx] = static_cast<OutputType>(
+                            topLeft[bin] + (static_cast<float>(topRight[bin]) - topLeft[bin]) * columnWeight);
+                    }
+                    continue;
+                }
+                if (left == right)
+                {
+                    for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                    {
+                        auto const bin = binRow[colIdx];
+                        outputRow[colIdx] = static_cast<OutputType>(
+                            topLeft[bin] + (static_cast<float>(bottomLeft[bin]) - topLeft[bin]) * rowWeight);
+                    }
+                    continue;
+                }
+
+                // Same a + (b - a) * t form as the 8-bit kernels
+                for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                {
+                    auto const bin = binRow[colIdx];
+                    auto const columnWeight = plan.columnWeights[colIdx];
+                    float const upper =
+                        topLeft[bin] + (static_cast<float>(topRight[bin]) - topLeft[bin]) * columnWeight;
+                    float const lower =
+                        bottomLeft[bin] + (static_cast<float>(bottomRight[bin]) - bottomLeft[bin]) * columnWeight;
+                    outputRow[colIdx] = static_cast<OutputType>(upper + (lower - upper) * rowWeight);
+                }
+            }
+        }
+    }
+}
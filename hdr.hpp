@@ -0,0 +1,60 @@
+/*
+ * file: hdr.hpp
+ * purpose: Declaration of a CLAHE front end for floating point high dynamic
+ *          range images, which bins the tile histograms by the logarithm of
+ *          the radiance and produces 8 or 16-bit display values.
+ */
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+/*
+ * How radiances are binned. The range [minimum, maximum] is split into
+ * binCount bins of equal width in log2 space, so every bin covers the same
+ * fraction of a stop. Radiances outside of it, zero, negative and NaN ones
+ * included, go to the first or last bin.
+ */
+struct HdrBinning
+{
+    // Between 2 and 65536
+    unsigned int binCount;
+    // A range with minimum >= maximum is taken from each image, from its
+    // smallest positive to its largest finite radiance
+    float minimum;
+    float maximum;
+
+    explicit HdrBinning(unsigned int _binCount = 1024, float _minimum = 0.0f, float _maximum = 0.0f)
+      : binCount(_binCount), minimum(_minimum), maximum(_maximum)
+    {
+        // Empty
+    }
+};
+
+/*
+ * Takes a single channel floating point radiance map (CV_32FC1) and runs a
+ * CLAHE algorithm on its log2 histogram bins, i.e. as the local tone mapping
+ * of an HDR fusion stage, in place of a global tone curve followed by clahe().
+ *
+ * The first pass computes every pixel's bin once, with a polynomial log2 in
+ * a loop without branches the compiler can vectorize, counts it into its
+ * tile's histogram and keeps it in a 16-bit bin image. The tables map bins to
+ * display values with the semantics of clipHistogram() and
+ * areaBasedGrayLevelMapping(), and the second pass interpolates them from the
+ * bin image, so the float image is read only once.
+ *
+ * input- The matrix holding the radiance map.
+ * output- The matrix for the display image, CV_8UC1 or CV_16UC1.
+ * outputDepth- CV_8U or CV_16U.
+ * binning- The number of bins and the range they cover.
+ * clipLimit- The limit for a single bin, given for 256 bins. It is kept at
+ *            the same multiple of a tile's mean bin count for any count, so
+ *            a limit clips as much of a tile, but never below one pixel.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int claheHdr(cv::Mat const & input,
+                           cv::Mat & output,
+                           int outputDepth,
+                           HdrBinning const & binning = HdrBinning(),
+                           double clipLimit = 40.0) noexcept;
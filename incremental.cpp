@@ -0,0 +1,157 @@
+/*
+ * file: incremental.cpp
+ * purpose: Implementation of the incrementally updated CLAHE front end.
+ */
+
+#include <algorithm>
+#include <array>
+#include "opencv2/opencv.hpp"
+#include "incremental.hpp"
+#include "tiles.hpp"
+
+// Data on the tiles the image will be split into
+static unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+IncrementalClahe::IncrementalClahe(GrayLevelMappingFunction _mapping /* = nullptr */, double _clipLimit /* = 40.0 */)
+  : mapping(std::move(_mapping)), clipLimit(_clipLimit)
+{
+    // Empty
+}
+
+IncrementalClahe::~IncrementalClahe() = default;
+
+[[nodiscard]] int IncrementalClahe::apply(cv::Mat const & input, cv::Mat & output) noexcept
+{
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical))
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), input.type());
+        input.copyTo(previousInput);
+
+        if (!lookupTables || lookupTables->grid.columns != static_cast<unsigned int>(input.cols) ||
+            lookupTables->grid.rows != static_cast<unsigned int>(input.rows))
+        {
+            lookupTables = std::make_unique<TileLookupTables>(
+                TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+            plan = std::make_unique<InterpolationPlan>(lookupTables->grid);
+            tileHistograms.assign(tilesHorizontal * tilesVertical, ImageHistogram());
+        }
+    }
+    catch (std::exception const &)
+    {
+        // Without complete state there is nothing for update() to build on
+        lookupTables.reset();
+        return -1;
+    }
+
+    auto & tables = *lookupTables;
+    for (auto tileY = 0u; tileY < tilesVertical; ++tileY)
+    {
+        for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+        {
+            auto & tileHistogram = tileHistograms[tileY * tilesHorizontal + tileX];
+            tileHistogram = generateGrayscaleHistogramForSubregion(input, tables.grid.getTileBounds(tileX, tileY));
+
+            // Mapping clips the histogram, the raw one is kept for updates
+            auto clippedHistogram(tileHistogram);
+            generateTileLookupTable(clippedHistogram, tileX, tileY, mapping, clipLimit, tables);
+        }
+    }
+    selectRegionKernels(tables);
+
+    interpolateRows(input, output, tables, *plan, 0, input.rows, nullptr);
+
+    return 0;
+}
+
+[[nodiscard]] int IncrementalClahe::update(cv::Mat const & input,
+                                           Rectangle const & changedRegion,
+                                           cv::Mat & output) noexcept
+{
+    if (!lookupTables || input.type() != CV_8UC1 || input.size() != previousInput.size() ||
+        output.type() != CV_8UC1 || output.size() != previousInput.size())
+    {
+        return -1;
+    }
+
+    auto & tables = *lookupTables;
+    auto const & grid = tables.grid;
+    if (changedRegion.x > grid.columns || changedRegion.width > grid.columns - changedRegion.x ||
+        changedRegion.y > grid.rows || changedRegion.height > grid.rows - changedRegion.y)
+    {
+        return -1;
+    }
+
+    // Move every changed pixel from its old bin to its new one
+    std::array<bool, tilesHorizontal * tilesVertical> dirtyTiles{};
+    for (auto rowIdx = changedRegion.y; rowIdx < changedRegion.y + changedRegion.height; ++rowIdx)
+    {
+        auto const inputRow = input.ptr<uint8_t>(rowIdx);
+        auto previousRow = previousInput.ptr<uint8_t>(rowIdx);
+        auto const tileY = std::min(rowIdx / grid.tileHeight, grid.tilesVertical - 1);
+
+        for (auto colIdx = changedRegion.x; colIdx < changedRegion.x + changedRegion.width; ++colIdx)
+        {
+            if (inputRow[colIdx] == previousRow[colIdx])
+            {
+                continue;
+            }
+
+            auto const tileX = std::min(colIdx / grid.tileWidth, grid.tilesHorizontal - 1);
+            auto & histogram = tileHistograms[tileY * grid.tilesHorizontal + tileX].histogram;
+            --histogram[previousRow[colIdx]];
+            ++histogram[inputRow[colIdx]];
+            previousRow[colIdx] = inputRow[colIdx];
+            dirtyTiles[tileY * grid.tilesHorizontal + tileX] = true;
+        }
+    }
+
+    // Rebuild the tables of the touched tiles and find the ones which changed
+    unsigned int firstTileX(grid.tilesHorizontal), lastTileX(0), firstTileY(grid.tilesVertical), lastTileY(0);
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+        {
+            if (!dirtyTiles[tileY * grid.tilesHorizontal + tileX])
+            {
+                continue;
+            }
+
+            auto const previousTable = tables.at(tileX, tileY);
+            auto clippedHistogram(tileHistograms[tileY * grid.tilesHorizontal + tileX]);
+            generateTileLookupTable(clippedHistogram, tileX, tileY, mapping, clipLimit, tables);
+
+            if (tables.at(tileX, tileY) != previousTable)
+            {
+                firstTileX = std::min(firstTileX, tileX);
+                lastTileX = std::max(lastTileX, tileX);
+                firstTileY = std::min(firstTileY, tileY);
+                lastTileY = std::max(lastTileY, tileY);
+            }
+        }
+    }
+
+    if (firstTileX <= lastTileX)
+    {
+        selectRegionKernels(tables);
+
+        // A tile's table is used from the center of the tile before it to the
+        // center of the tile after it
+        auto const & firstColumns = plan->horizontalSpans[firstTileX];
+        auto const & lastColumns = plan->horizontalSpans[lastTileX + 1];
+        auto const & firstRows = plan->verticalSpans[firstTileY];
+        auto const & lastRows = plan->verticalSpans[lastTileY + 1];
+        interpolateRectangle(input, output, tables, *plan,
+                             Rectangle(firstColumns.begin, firstRows.begin, lastColumns.end - firstColumns.begin,
+                                       lastRows.end - firstRows.begin));
+    }
+
+    // The changed pixels need new output even where no table changed
+    interpolateRectangle(input, output, tables, *plan, changedRegion);
+
+    return 0;
+}
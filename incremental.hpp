@@ -0,0 +1,75 @@
+/*
+ * file: incremental.hpp
+ * purpose: Declaration of a CLAHE front end which keeps its state between
+ *          calls so that an edit to a small part of an image only redoes the
+ *          work that the edit affects.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+
+struct InterpolationPlan;
+struct TileLookupTables;
+
+/*
+ * Equalizes an image once and then keeps the output up to date as parts of
+ * the image change, i.e. after each stroke in a paint tool.
+ *
+ * The engine keeps a copy of the last input it saw and the raw histogram of
+ * every tile. An update subtracts the old values of the changed pixels from
+ * their tiles' histograms and adds the new ones, so its histogram cost is
+ * proportional to the changed area. Only tiles whose lookup table actually
+ * changed have their area of influence, the span between the centers of the
+ * neighboring tiles, produced again; everything else in the output is left
+ * alone apart from the changed pixels themselves.
+ *
+ * The output after any sequence of updates is identical to clahe() on the
+ * current image.
+ */
+class IncrementalClahe
+{
+public:
+    /*
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     */
+    explicit IncrementalClahe(GrayLevelMappingFunction _mapping = nullptr, double _clipLimit = 40.0);
+
+    ~IncrementalClahe();
+
+    IncrementalClahe(IncrementalClahe const &) = delete;
+    IncrementalClahe & operator=(IncrementalClahe const &) = delete;
+
+    /*
+     * Equalizes a whole grayscale image and remembers it as the state later
+     * updates apply to. Returns 0 on success and -1 on failure.
+     */
+    [[nodiscard]] int apply(cv::Mat const & input, cv::Mat & output) noexcept;
+
+    /*
+     * Brings the output of the last apply() or update() in line with an input
+     * in which only the pixels inside changedRegion differ from the last one.
+     *
+     * input- The whole image after the edit, the same size as before.
+     * changedRegion- Bounds of every pixel which may have changed.
+     * output- The output matrix from the previous call, updated in place.
+     *
+     * Returns 0 on success and -1 on failure, i.e. when there is no previous
+     * state or the region lies outside of the image.
+     */
+    [[nodiscard]] int update(cv::Mat const & input, Rectangle const & changedRegion, cv::Mat & output) noexcept;
+
+private:
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    // The input as of the last call
+    cv::Mat previousInput;
+    // Row-major, the unclipped histogram of every tile
+    std::vector<ImageHistogram> tileHistograms;
+    std::unique_ptr<TileLookupTables> lookupTables;
+    std::unique_ptr<InterpolationPlan> plan;
+};
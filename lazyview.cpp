@@ -0,0 +1,159 @@
+/*
+ * file: lazyview.cpp
+ * purpose: Implementation of the lazily evaluated CLAHE output.
+ */
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "lazyview.hpp"
+#include "tiles.hpp"
+
+// Data on the tiles the image will be split into
+static unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+LazyClaheView::LazyClaheView(cv::Mat const & _input,
+                             GrayLevelMappingFunction _mapping /* = nullptr */,
+                             double _clipLimit /* = 40.0 */,
+                             unsigned int _blockSize /* = 256 */,
+                             unsigned int _maxCachedBlocks /* = 1024 */)
+  : input(_input),
+    mapping(std::move(_mapping)),
+    clipLimit(_clipLimit),
+    blockSize(std::max(_blockSize, 1u)),
+    maxCachedBlocks(std::max(_maxCachedBlocks, 1u)),
+    validInput(isValidClaheInput(_input, tilesHorizontal, tilesVertical)),
+    statistics()
+{
+    if (validInput)
+    {
+        lookupTables = std::make_unique<TileLookupTables>(
+            TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+        plan = std::make_unique<InterpolationPlan>(lookupTables->grid);
+        builtTileRows.assign(tilesVertical, false);
+        selectedRegionRows.assign(tilesVertical + 1, false);
+    }
+}
+
+LazyClaheView::~LazyClaheView() = default;
+
+[[nodiscard]] int LazyClaheView::read(Rectangle const & region, cv::Mat & output) noexcept
+{
+    if (!validInput || region.width == 0 || region.height == 0 ||
+        region.x + static_cast<unsigned long long>(region.width) > static_cast<unsigned int>(input.cols) ||
+        region.y + static_cast<unsigned long long>(region.height) > static_cast<unsigned int>(input.rows))
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(region.height, region.width, CV_8UC1);
+
+        auto const regionEndX = region.x + region.width, regionEndY = region.y + region.height;
+        for (auto blockY = region.y / blockSize; blockY * blockSize < regionEndY; ++blockY)
+        {
+            for (auto blockX = region.x / blockSize; blockX * blockSize < regionEndX; ++blockX)
+            {
+                auto const block = getBlock(blockX, blockY);
+                if (nullptr == block)
+                {
+                    return -1;
+                }
+
+                // The part of the block within the region
+                auto const left = std::max(region.x, blockX * blockSize);
+                auto const top = std::max(region.y, blockY * blockSize);
+                auto const right = std::min(regionEndX, blockX * blockSize + block->cols);
+                auto const bottom = std::min(regionEndY, blockY * blockSize + block->rows);
+                cv::Mat destination = output(cv::Rect(left - region.x, top - region.y, right - left, bottom - top));
+                (*block)(cv::Rect(left - blockX * blockSize, top - blockY * blockSize, right - left, bottom - top))
+                    .copyTo(destination);
+            }
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void LazyClaheView::clearCache() noexcept
+{
+    cachedBlocks.clear();
+    blockIndex.clear();
+}
+
+LazyViewStatistics LazyClaheView::getStatistics() const noexcept
+{
+    auto current = statistics;
+    current.tileRowsBuilt = static_cast<unsigned int>(std::count(builtTileRows.cbegin(), builtTileRows.cend(), true));
+    current.cachedBlocks = cachedBlocks.size();
+    return current;
+}
+
+cv::Mat const * LazyClaheView::getBlock(unsigned int blockX, unsigned int blockY)
+{
+    auto const key = (static_cast<unsigned long long>(blockY) << 32) | blockX;
+    auto const cached = blockIndex.find(key);
+    if (cached != blockIndex.end())
+    {
+        cachedBlocks.splice(cachedBlocks.begin(), cachedBlocks, cached->second);
+        ++statistics.cacheHits;
+        return &cached->second->pixels;
+    }
+
+    Rectangle const bounds(blockX * blockSize, blockY * blockSize,
+                           std::min(blockSize, input.cols - blockX * blockSize),
+                           std::min(blockSize, input.rows - blockY * blockSize));
+    prepareRows(bounds.y, bounds.y + bounds.height);
+
+    // The block is interpolated in its own coordinates, straight from its part of the input
+    cv::Mat const blockInput = input(cv::Rect(bounds.x, bounds.y, bounds.width, bounds.height));
+    cv::Mat pixels(bounds.height, bounds.width, CV_8UC1);
+    interpolateRows(blockInput, pixels, *lookupTables, InterpolationPlan(*plan, bounds), 0, bounds.height, nullptr);
+    ++statistics.blocksRendered;
+
+    if (cachedBlocks.size() >= maxCachedBlocks)
+    {
+        blockIndex.erase(cachedBlocks.back().key);
+        cachedBlocks.pop_back();
+    }
+    cachedBlocks.push_front(CachedBlock{key, pixels});
+    blockIndex.emplace(key, cachedBlocks.begin());
+
+    return &cachedBlocks.front().pixels;
+}
+
+void LazyClaheView::prepareRows(unsigned int rowBegin, unsigned int rowEnd)
+{
+    for (auto regionY = 0u; regionY < plan->verticalSpans.size(); ++regionY)
+    {
+        auto const & span = plan->verticalSpans[regionY];
+        if (selectedRegionRows[regionY] || span.begin >= rowEnd || span.end <= rowBegin || span.begin == span.end)
+        {
+            continue;
+        }
+
+        if (!builtTileRows[span.lowerTile])
+        {
+            buildTileRow(span.lowerTile);
+        }
+        if (!builtTileRows[span.upperTile])
+        {
+            buildTileRow(span.upperTile);
+        }
+        selectRegionKernels(*lookupTables, regionY);
+        selectedRegionRows[regionY] = true;
+    }
+}
+
+void LazyClaheView::buildTileRow(unsigned int tileY)
+{
+    for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+    {
+        generateTileLookupTable(input, tileX, tileY, mapping, clipLimit, *lookupTables, nullptr);
+    }
+    builtTileRows[tileY] = true;
+}
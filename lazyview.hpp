@@ -0,0 +1,113 @@
+/*
+ * file: lazyview.hpp
+ * purpose: Declaration of a lazily evaluated CLAHE output which produces only
+ *          the parts of a very large image that are actually looked at.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+
+struct InterpolationPlan;
+struct TileLookupTables;
+
+struct LazyViewStatistics
+{
+    // Tile rows whose lookup tables have been built
+    unsigned int tileRowsBuilt;
+    // Output blocks interpolated, including ones produced again after eviction
+    unsigned long blocksRendered;
+    // Block reads served from the cache
+    unsigned long cacheHits;
+    unsigned long cachedBlocks;
+};
+
+/*
+ * The output of clahe() for an image, produced on demand, i.e. for a viewer
+ * which only ever shows a small viewport of a multi-gigapixel image.
+ *
+ * The output is divided into square blocks. Reading a rectangle interpolates
+ * the blocks it touches which are not cached yet, building the lookup tables
+ * of only the tile rows those blocks need, so the first pixels cost the
+ * histograms of one or two tile rows and panning costs work proportional to
+ * the pixels newly shown. The most recently used blocks are kept in a cache of
+ * bounded size. The pixels read are the same as those of clahe().
+ *
+ * The input is referenced rather than copied, it must not change while the
+ * view is in use. Only one thread may use a view at a time.
+ */
+class LazyClaheView
+{
+public:
+    /*
+     * _input- The grayscale image to equalize.
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     * _blockSize- The width and height of the output blocks.
+     * _maxCachedBlocks- The most output blocks kept in the cache.
+     */
+    explicit LazyClaheView(cv::Mat const & _input,
+                           GrayLevelMappingFunction _mapping = nullptr,
+                           double _clipLimit = 40.0,
+                           unsigned int _blockSize = 256,
+                           unsigned int _maxCachedBlocks = 1024);
+
+    ~LazyClaheView();
+
+    LazyClaheView(LazyClaheView const &) = delete;
+    LazyClaheView & operator=(LazyClaheView const &) = delete;
+
+    /*
+     * Copies the output pixels within region into output, which is resized to
+     * the region. Returns 0 on success and -1 if the input cannot be equalized
+     * or the region is empty or not within the image.
+     */
+    [[nodiscard]] int read(Rectangle const & region, cv::Mat & output) noexcept;
+
+    /*
+     * Drops every cached output block, the lookup tables are kept.
+     */
+    void clearCache() noexcept;
+
+    LazyViewStatistics getStatistics() const noexcept;
+
+private:
+    struct CachedBlock
+    {
+        unsigned long long key;
+        cv::Mat pixels;
+    };
+
+    /*
+     * Returns the cached block, producing it on a miss, nullptr on failure.
+     */
+    cv::Mat const * getBlock(unsigned int blockX, unsigned int blockY);
+
+    /*
+     * Builds the tables and picks the kernels needed by the rows [rowBegin, rowEnd).
+     */
+    void prepareRows(unsigned int rowBegin, unsigned int rowEnd);
+
+    void buildTileRow(unsigned int tileY);
+
+    cv::Mat const input;
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    unsigned int const blockSize;
+    unsigned int const maxCachedBlocks;
+    bool const validInput;
+
+    std::unique_ptr<TileLookupTables> lookupTables;
+    std::unique_ptr<InterpolationPlan> plan;
+    std::vector<bool> builtTileRows;
+    std::vector<bool> selectedRegionRows;
+
+    // Most recently used first
+    std::list<CachedBlock> cachedBlocks;
+    std::unordered_map<unsigned long long, std::list<CachedBlock>::iterator> blockIndex;
+    LazyViewStatistics statistics;
+};
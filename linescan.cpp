@@ -0,0 +1,208 @@
+/*
+ * file: linescan.cpp
+ * purpose: Implementation of the streaming line-scan CLAHE front end.
+ */
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "linescan.hpp"
+#include "tiles.hpp"
+
+LineScanClahe::LineScanClahe(unsigned int _columns,
+                             unsigned int _tileHeight,
+                             unsigned int _tilesHorizontal /* = 8 */,
+                             GrayLevelMappingFunction _mapping /* = nullptr */,
+                             double _clipLimit /* = 40.0 */)
+  : columns(std::max(_columns, 1u)),
+    tileHeight(std::max(_tileHeight, 1u)),
+    mapping(std::move(_mapping)),
+    clipLimit(_clipLimit),
+    pushedRows(0),
+    emittedRows(0),
+    completedBands(0)
+{
+    auto const tilesHorizontal = std::min(std::max(_tilesHorizontal, 1u), columns);
+
+    // A grid of two tile rows holds the tables of the older and the newer band,
+    // its three vertical regions are the rows above the first center, between
+    // the two centers and below the last center
+    lookupTables = std::make_unique<TileLookupTables>(TileGrid(tilesHorizontal, 2, columns, 2 * tileHeight));
+    plan = std::make_unique<InterpolationPlan>(lookupTables->grid);
+    bandHistograms.resize(tilesHorizontal);
+    heldRows.create(latency() + 1, columns, CV_8UC1);
+}
+
+LineScanClahe::~LineScanClahe() = default;
+
+[[nodiscard]] int LineScanClahe::pushRows(cv::Mat const & rows, cv::Mat & output) noexcept
+{
+    if (rows.type() != CV_8UC1 || rows.cols != static_cast<int>(columns))
+    {
+        return -1;
+    }
+
+    try
+    {
+        // Once the latency is covered every pushed row releases one output row
+        auto const readyRows = std::max(pushedRows + rows.rows, static_cast<unsigned long long>(latency())) -
+                               latency() - emittedRows;
+        output.create(static_cast<int>(readyRows), columns, CV_8UC1);
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    auto const firstEmittedRow = emittedRows;
+    for (auto rowIdx = 0; rowIdx < rows.rows; ++rowIdx)
+    {
+        auto const row = rows.ptr<uint8_t>(rowIdx);
+        std::copy(row, row + columns, heldRows.ptr<uint8_t>(pushedRows % heldRows.rows));
+        countRow(row);
+        ++pushedRows;
+
+        if (pushedRows % tileHeight == 0)
+        {
+            completeBand();
+        }
+
+        if (pushedRows > latency())
+        {
+            emitRow(output.ptr<uint8_t>(static_cast<int>(emittedRows - firstEmittedRow)));
+        }
+    }
+
+    return 0;
+}
+
+[[nodiscard]] int LineScanClahe::finish(cv::Mat & output) noexcept
+{
+    try
+    {
+        output.create(static_cast<int>(pushedRows - emittedRows), columns, CV_8UC1);
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    auto const firstEmittedRow = emittedRows;
+
+    // Rows above the newest center still need the older band's tables, which
+    // a final short band would push out
+    if (completedBands > 0)
+    {
+        while (emittedRows < pushedRows && emittedRows < getTileCenter(completedBands - 1))
+        {
+            emitRow(output.ptr<uint8_t>(static_cast<int>(emittedRows - firstEmittedRow)));
+        }
+    }
+
+    if (pushedRows % tileHeight != 0)
+    {
+        completeBand();
+    }
+
+    while (emittedRows < pushedRows)
+    {
+        emitRow(output.ptr<uint8_t>(static_cast<int>(emittedRows - firstEmittedRow)));
+    }
+
+    reset();
+    return 0;
+}
+
+unsigned int LineScanClahe::latency() const noexcept
+{
+    return 2 * tileHeight - tileHeight / 2 - 1;
+}
+
+unsigned long long LineScanClahe::rowsPushed() const noexcept
+{
+    return pushedRows;
+}
+
+unsigned long long LineScanClahe::rowsEmitted() const noexcept
+{
+    return emittedRows;
+}
+
+unsigned long long LineScanClahe::getTileCenter(unsigned long long tileRow) const noexcept
+{
+    return (tileHeight / 2) + (tileRow * tileHeight);
+}
+
+void LineScanClahe::countRow(uint8_t const * row) noexcept
+{
+    for (auto tileX = 0u; tileX < bandHistograms.size(); ++tileX)
+    {
+        auto const bounds = lookupTables->grid.getTileBounds(tileX, 0);
+        auto & histogram = bandHistograms[tileX].histogram;
+        for (auto colIdx = bounds.x; colIdx < bounds.x + bounds.width; ++colIdx)
+        {
+            ++histogram[row[colIdx]];
+        }
+    }
+}
+
+void LineScanClahe::completeBand() noexcept
+{
+    auto & tables = *lookupTables;
+    auto const tilesHorizontal = tables.grid.tilesHorizontal;
+
+    // The newer band becomes the older one
+    std::copy(tables.tables.begin() + tilesHorizontal, tables.tables.end(), tables.tables.begin());
+    std::copy(tables.kinds.begin() + tilesHorizontal, tables.kinds.end(), tables.kinds.begin());
+
+    for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+    {
+        generateTileLookupTable(bandHistograms[tileX], tileX, 1, mapping, clipLimit, tables);
+        bandHistograms[tileX] = ImageHistogram();
+    }
+
+    // Until there is a second band the first one is also the older band
+    if (completedBands == 0)
+    {
+        std::copy(tables.tables.begin() + tilesHorizontal, tables.tables.end(), tables.tables.begin());
+        std::copy(tables.kinds.begin() + tilesHorizontal, tables.kinds.end(), tables.kinds.begin());
+    }
+
+    selectRegionKernels(tables);
+    ++completedBands;
+}
+
+void LineScanClahe::emitRow(uint8_t * outputRow) noexcept
+{
+    auto const rowIdx = emittedRows;
+    auto const inputRow = heldRows.ptr<uint8_t>(rowIdx % heldRows.rows);
+
+    if (rowIdx < getTileCenter(0))
+    {
+        // Above the first center, only the first band applies
+        interpolateRow(inputRow, outputRow, *lookupTables, *plan, 0, 0.f, nullptr);
+    }
+    else if (rowIdx < getTileCenter(completedBands - 1))
+    {
+        // Between the centers of the older and newer bands
+        float const rowWeight = static_cast<float>(rowIdx - getTileCenter(completedBands - 2)) / tileHeight;
+        interpolateRow(inputRow, outputRow, *lookupTables, *plan, 1, rowWeight, nullptr);
+    }
+    else
+    {
+        // Below the last center, which only happens once the image has ended
+        interpolateRow(inputRow, outputRow, *lookupTables, *plan, 2, 0.f, nullptr);
+    }
+
+    ++emittedRows;
+}
+
+void LineScanClahe::reset() noexcept
+{
+    for (auto & histogram : bandHistograms)
+    {
+        histogram = ImageHistogram();
+    }
+    pushedRows = 0;
+    emittedRows = 0;
+    completedBands = 0;
+}
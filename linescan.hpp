@@ -0,0 +1,108 @@
+/*
+ * file: linescan.hpp
+ * purpose: Declaration of a streaming CLAHE front end for line-scan cameras,
+ *          which equalize an image of unbounded length that arrives a few
+ *          rows at a time.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+
+struct InterpolationPlan;
+struct TileLookupTables;
+
+/*
+ * Runs the CLAHE algorithm on an image which is only ever seen a few rows at
+ * a time and may never end.
+ *
+ * The image is split into bands of tileHeight rows, each band being one row of
+ * tiles. A band's lookup tables are built as soon as its last row arrives, and
+ * an output row is produced once the tables of the band below it are ready.
+ * Output row n is emitted by the call which pushes input row n + latency(),
+ * where
+ *
+ *     latency() = 2 * tileHeight - tileHeight / 2 - 1
+ *
+ * which is the distance from the first row past a tile center to the last row
+ * of the band below it. The latency is the same for every row; only finish()
+ * emits the final rows early. Memory use is constant, holding latency() + 1
+ * input rows and two rows of lookup tables regardless of the image length.
+ *
+ * An image whose length is a multiple of tileHeight with that many bands gives
+ * the same output as clahe(). Otherwise the final, shorter band is a tile row
+ * of its own rather than being merged into the one above it.
+ */
+class LineScanClahe
+{
+public:
+    /*
+     * _columns- The width of every row.
+     * _tileHeight- The number of rows in each band of tiles.
+     * _tilesHorizontal- The number of tiles across a row.
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     */
+    LineScanClahe(unsigned int _columns,
+                  unsigned int _tileHeight,
+                  unsigned int _tilesHorizontal = 8,
+                  GrayLevelMappingFunction _mapping = nullptr,
+                  double _clipLimit = 40.0);
+
+    ~LineScanClahe();
+
+    LineScanClahe(LineScanClahe const &) = delete;
+    LineScanClahe & operator=(LineScanClahe const &) = delete;
+
+    /*
+     * Consumes the rows of a grayscale image, output receives the rows which
+     * became ready, which is one per input row once the first latency() rows
+     * have been pushed. Returns 0 on success and -1 on failure.
+     */
+    [[nodiscard]] int pushRows(cv::Mat const & rows, cv::Mat & output) noexcept;
+
+    /*
+     * Ends the image, output receives every row still held back. The engine
+     * can then be used for a new image.
+     */
+    [[nodiscard]] int finish(cv::Mat & output) noexcept;
+
+    /*
+     * The number of rows between an input row arriving and its output row
+     * being emitted.
+     */
+    unsigned int latency() const noexcept;
+
+    unsigned long long rowsPushed() const noexcept;
+
+    unsigned long long rowsEmitted() const noexcept;
+
+private:
+    unsigned long long getTileCenter(unsigned long long tileRow) const noexcept;
+
+    void countRow(uint8_t const * row) noexcept;
+
+    void completeBand() noexcept;
+
+    void emitRow(uint8_t * outputRow) noexcept;
+
+    void reset() noexcept;
+
+    unsigned int const columns;
+    unsigned int const tileHeight;
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    // The two most recent rows of tables, the older one above the newer one
+    std::unique_ptr<TileLookupTables> lookupTables;
+    std::unique_ptr<InterpolationPlan> plan;
+    // One histogram per tile of the band being received
+    std::vector<ImageHistogram> bandHistograms;
+    // The last latency() + 1 input rows, indexed by row modulo its size
+    cv::Mat heldRows;
+    unsigned long long pushedRows;
+    unsigned long long emittedRows;
+    unsigned long long completedBands;
+};
@@ -0,0 +1,210 @@
+/*
+ * file: lookuptableset.cpp
+ * purpose: Implementation of the analyzable, serializable set of tile lookup
+ *          tables.
+ */
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "lookuptableset.hpp"
+#include "tiles.hpp"
+
+// Data on the tiles the image will be split into
+static unsigned int const defaultTilesHorizontal(8), defaultTilesVertical(8);
+
+static uint8_t const serializationMagic[4] = {'C', 'L', 'U', 'T'};
+static uint32_t const serializationVersion(1);
+static size_t const serializationHeaderSize(24);
+
+// Keeps a corrupt header from requesting an absurd allocation
+static uint32_t const maximumSerializedTiles(1u << 16);
+
+static void writeUnsigned32(uint8_t * destination, uint32_t value);
+
+static uint32_t readUnsigned32(uint8_t const * source);
+
+TileLookupTableSet::TileLookupTableSet() = default;
+
+TileLookupTableSet::~TileLookupTableSet() = default;
+
+TileLookupTableSet::TileLookupTableSet(TileLookupTableSet &&) noexcept = default;
+
+TileLookupTableSet & TileLookupTableSet::operator=(TileLookupTableSet &&) noexcept = default;
+
+[[nodiscard]] int TileLookupTableSet::analyze(cv::Mat const & input,
+                                              GrayLevelMappingFunction const & mapping /* = nullptr */,
+                                              double clipLimit /* = 40.0 */) noexcept
+{
+    if (!isValidClaheInput(input, defaultTilesHorizontal, defaultTilesVertical))
+    {
+        return -1;
+    }
+
+    std::unique_ptr<TileLookupTables> tables;
+    try
+    {
+        tables = std::make_unique<TileLookupTables>(
+            TileGrid(defaultTilesHorizontal, defaultTilesVertical, input.cols, input.rows));
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    for (auto tileY = 0u; tileY < defaultTilesVertical; ++tileY)
+    {
+        for (auto tileX = 0u; tileX < defaultTilesHorizontal; ++tileX)
+        {
+            generateTileLookupTable(input, tileX, tileY, mapping, clipLimit, *tables, nullptr);
+        }
+    }
+    selectRegionKernels(*tables);
+
+    lookupTables = std::move(tables);
+    return 0;
+}
+
+[[nodiscard]] int TileLookupTableSet::apply(cv::Mat const & input, cv::Mat & output) const noexcept
+{
+    if (empty() || !isValidClaheInput(input, tilesHorizontal(), tilesVertical()))
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), input.type());
+
+        auto const & grid = lookupTables->grid;
+        if (grid.columns == static_cast<unsigned int>(input.cols) && grid.rows == static_cast<unsigned int>(input.rows))
+        {
+            interpolateRows(input, output, *lookupTables, InterpolationPlan(grid), 0, input.rows, nullptr);
+        }
+        else
+        {
+            // Same tables and kernels laid over the tiles of the other size
+            TileLookupTables resized(*lookupTables);
+            resized.grid = TileGrid(grid.tilesHorizontal, grid.tilesVertical, input.cols, input.rows);
+            interpolateRows(input, output, resized, InterpolationPlan(resized.grid), 0, input.rows, nullptr);
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+bool TileLookupTableSet::empty() const noexcept
+{
+    return !lookupTables;
+}
+
+unsigned int TileLookupTableSet::tilesHorizontal() const noexcept
+{
+    return empty() ? 0 : lookupTables->grid.tilesHorizontal;
+}
+
+unsigned int TileLookupTableSet::tilesVertical() const noexcept
+{
+    return empty() ? 0 : lookupTables->grid.tilesVertical;
+}
+
+LookupTable const & TileLookupTableSet::at(unsigned int tileX, unsigned int tileY) const noexcept
+{
+    return lookupTables->at(tileX, tileY);
+}
+
+std::vector<uint8_t> TileLookupTableSet::serialize() const
+{
+    if (empty())
+    {
+        return {};
+    }
+
+    auto const & grid = lookupTables->grid;
+    std::vector<uint8_t> data(serializationHeaderSize + lookupTables->tables.size() * sizeof(LookupTable));
+
+    std::copy(std::begin(serializationMagic), std::end(serializationMagic), data.begin());
+    writeUnsigned32(&data[4], serializationVersion);
+    writeUnsigned32(&data[8], grid.tilesHorizontal);
+    writeUnsigned32(&data[12], grid.tilesVertical);
+    writeUnsigned32(&data[16], grid.columns);
+    writeUnsigned32(&data[20], grid.rows);
+
+    auto tableData = data.begin() + serializationHeaderSize;
+    for (auto const & table : lookupTables->tables)
+    {
+        tableData = std::copy(table.cbegin(), table.cend(), tableData);
+    }
+
+    return data;
+}
+
+[[nodiscard]] int TileLookupTableSet::deserialize(uint8_t const * data, size_t size) noexcept
+{
+    if (nullptr == data || size < serializationHeaderSize ||
+        !std::equal(std::begin(serializationMagic), std::end(serializationMagic), data) ||
+        readUnsigned32(data + 4) != serializationVersion)
+    {
+        return -1;
+    }
+
+    auto const tilesHorizontal = readUnsigned32(data + 8);
+    auto const tilesVertical = readUnsigned32(data + 12);
+    auto const columns = readUnsigned32(data + 16);
+    auto const rows = readUnsigned32(data + 20);
+    if (tilesHorizontal == 0 || tilesVertical == 0 || tilesHorizontal > maximumSerializedTiles ||
+        tilesVertical > maximumSerializedTiles || columns < tilesHorizontal || rows < tilesVertical)
+    {
+        return -1;
+    }
+
+    auto const tileCount = static_cast<size_t>(tilesHorizontal) * tilesVertical;
+    if (size != serializationHeaderSize + tileCount * sizeof(LookupTable))
+    {
+        return -1;
+    }
+
+    std::unique_ptr<TileLookupTables> tables;
+    try
+    {
+        tables = std::make_unique<TileLookupTables>(TileGrid(tilesHorizontal, tilesVertical, columns, rows));
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    // Only the tables are stored, what is known about them is cheap to rebuild
+    auto tableData = data + serializationHeaderSize;
+    for (auto tile = 0u; tile < tileCount; ++tile)
+    {
+        std::copy(tableData, tableData + sizeof(LookupTable), tables->tables[tile].begin());
+        tables->kinds[tile] = classifyLookupTable(tables->tables[tile]);
+        tableData += sizeof(LookupTable);
+    }
+    selectRegionKernels(*tables);
+
+    lookupTables = std::move(tables);
+    return 0;
+}
+
+static void writeUnsigned32(uint8_t * destination, uint32_t value)
+{
+    for (auto i = 0u; i < 4; ++i)
+    {
+        destination[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t readUnsigned32(uint8_t const * source)
+{
+    uint32_t value(0);
+    for (auto i = 0u; i < 4; ++i)
+    {
+        value |= static_cast<uint32_t>(source[i]) << (8 * i);
+    }
+    return value;
+}
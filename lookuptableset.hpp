@@ -0,0 +1,93 @@
+/*
+ * file: lookuptableset.hpp
+ * purpose: Declaration of a set of tile lookup tables which can be built from
+ *          one image, applied to others and stored in a compact binary form.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "clahe.hpp"
+
+struct TileLookupTables;
+
+/*
+ * The gray level mapping of every tile of a CLAHE run, separated from the
+ * image it was computed on.
+ *
+ * The tables can be analyzed once, i.e. on a reference frame or a downscaled
+ * preview, and then applied to any number of related frames. Frames of a
+ * different size than the analyzed one are split into the same grid of tiles
+ * and interpolated with the tables of the corresponding tiles. Analyzing and
+ * applying the same image gives the same output as clahe().
+ *
+ * The serialized form is a 24 byte header followed by the 256 entries of every
+ * table in row-major tile order:
+ *
+ *     bytes 0-3    "CLUT"
+ *     bytes 4-7    format version, currently 1
+ *     bytes 8-11   tiles horizontally
+ *     bytes 12-15  tiles vertically
+ *     bytes 16-19  analyzed image columns
+ *     bytes 20-23  analyzed image rows
+ *
+ * with every field an unsigned little-endian 32-bit integer, so a default 8x8
+ * set takes 16408 bytes on any platform.
+ */
+class TileLookupTableSet
+{
+public:
+    TileLookupTableSet();
+
+    ~TileLookupTableSet();
+
+    TileLookupTableSet(TileLookupTableSet &&) noexcept;
+    TileLookupTableSet & operator=(TileLookupTableSet &&) noexcept;
+
+    /*
+     * Builds the tables from a grayscale image, replacing any previous ones.
+     *
+     * mapping- The gray level mapping, nullptr selects the default mapping.
+     * clipLimit- The limit for a single bin of the histogram.
+     *
+     * Returns 0 on success and -1 on failure.
+     */
+    [[nodiscard]] int analyze(cv::Mat const & input,
+                              GrayLevelMappingFunction const & mapping = nullptr,
+                              double clipLimit = 40.0) noexcept;
+
+    /*
+     * Equalizes a grayscale image by interpolating between the tables,
+     * returns 0 on success and -1 on failure (i.e. when the set is empty).
+     */
+    [[nodiscard]] int apply(cv::Mat const & input, cv::Mat & output) const noexcept;
+
+    bool empty() const noexcept;
+
+    unsigned int tilesHorizontal() const noexcept;
+
+    unsigned int tilesVertical() const noexcept;
+
+    /*
+     * The table of a tile, the set must not be empty.
+     */
+    LookupTable const & at(unsigned int tileX, unsigned int tileY) const noexcept;
+
+    /*
+     * Writes the set in the binary form described above, an empty set writes
+     * nothing.
+     */
+    std::vector<uint8_t> serialize() const;
+
+    /*
+     * Reads a set written by serialize(), returns 0 on success and -1 if the
+     * data is not a complete set of a known version, in which case the set
+     * is left unchanged.
+     */
+    [[nodiscard]] int deserialize(uint8_t const * data, size_t size) noexcept;
+
+private:
+    std::unique_ptr<TileLookupTables> lookupTables;
+};
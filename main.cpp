@@ -2,14 +2,26 @@
  * file: main.cpp
  * purpose: Implements a small executable which takes in an image filename from
  *          and applies a custom CLAHE algorithm to it before showing the new
- *          image with OpenCV's HighGUI.
+ *          image with OpenCV's HighGUI. With --serve it instead runs as a
+ *          server taking jobs on stdin or the given Unix domain socket, with
+ *          --tune it picks the parallel configuration for a frame size, with
+ *          --mapped it equalizes a PGM or raw file into another file, with
+ *          --hdr it tone maps a floating point image into a file, and with
+ *          --trace it records a timeline of a parallel run.
  */
 
 #include <iostream>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/opencv.hpp>
 #include <chrono>
+#include "autotune.hpp"
 #include "clahe.hpp"
+#include "hdr.hpp"
+#include "mappedio.hpp"
+#include "parallel.hpp"
+#include "plotting.hpp"
+#include "server.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 
 static void unityMapping(ImageHistogram const & histogram, LookupTable * outputTable)
@@ -28,45 +40,161 @@ int main(int argc, char ** argv)
         return 1;
     }
 
+    // Server mode keeps the process, and its engines, alive for many images
+    if (std::string(argv[1]) == "--serve")
+    {
+        ClaheServer server;
+        auto const retVal = (argc >= 3) ? server.serveSocket(argv[2]) : server.serve(std::cin, std::cout);
+        return (retVal == 0) ? 0 : 1;
+    }
+
+    // Tuning measures afresh and updates the cache for later runs
+    if (std::string(argv[1]) == "--tune")
+    {
+        TunedConfiguration configuration;
+        if (argc < 4 || autoTune(atoi(argv[2]), atoi(argv[3]), getDefaultTuningCachePath(), configuration, true) != 0)
+        {
+            std::cerr << "Usage: clahe --tune <columns> <rows>" << std::endl;
+            return 1;
+        }
+        std::cout << "Threads: " << configuration.threadCount << std::endl;
+        std::cout << "Band height: " << configuration.bandHeight << std::endl;
+        std::cout << "Duration (us): " << configuration.frameMicroseconds << std::endl;
+        return 0;
+    }
+
+    // One warm run of the parallel engine, the second one is traced
+    if (std::string(argv[1]) == "--trace")
+    {
+        if (argc < 4)
+        {
+            std::cerr << "Usage: clahe --trace <trace.json> <image> [clip limit]" << std::endl;
+            return 1;
+        }
+
+        auto const image = cv::imread(argv[3], cv::IMREAD_GRAYSCALE);
+        // The traced run uses the configuration tuned for the size, a failed
+        // tuning leaves the default one
+        TunedConfiguration configuration{0, 32, 0.0};
+        (void)autoTune(image.cols, image.rows, getDefaultTuningCachePath(), configuration);
+        ParallelClahe engine(configuration.threadCount, false, nullptr, (argc > 4) ? atof(argv[4]) : 40.0,
+                             configuration.bandHeight);
+        cv::Mat processedImage;
+        if (engine.apply(image, processedImage) != 0)
+        {
+            std::cerr << "Cannot equalize " << argv[3] << std::endl;
+            return 1;
+        }
+
+        startTracing();
+        auto const retVal = engine.apply(image, processedImage);
+        stopTracing();
+        if (retVal != 0 || writeTrace(argv[2]) != 0)
+        {
+            std::cerr << "No trace written, tracing needs a build with CLAHE_TRACING" << std::endl;
+            return 1;
+        }
+        std::cout << "Dropped spans: " << getDroppedTraceSpans() << std::endl;
+        return 0;
+    }
+
+    // File to file through memory mappings, without decoding or displaying anything
+    if (std::string(argv[1]) == "--mapped" || std::string(argv[1]) == "--mapped-raw")
+    {
+        bool const raw(std::string(argv[1]) == "--mapped-raw");
+        int const firstPath(2), outputArgument(raw ? 6 : 3);
+        MappedImageLayout layout{PGM_FILE, 0, 0, 0, 0};
+        if (raw && argc > 5)
+        {
+            std::string const bits(argv[5]);
+            layout.format = (bits == "8") ? RAW_8BIT
+                          : (bits == "16le") ? RAW_16BIT_LITTLE_ENDIAN
+                          : (bits == "16be") ? RAW_16BIT_BIG_ENDIAN : static_cast<MappedPixelFormat>(UINT8_MAX);
+            layout.columns = static_cast<unsigned int>(atoi(argv[3]));
+            layout.rows = static_cast<unsigned int>(atoi(argv[4]));
+        }
+        if (argc <= outputArgument)
+        {
+            std::cerr << "Usage: clahe --mapped <input.pgm> <output> [clip limit]" << std::endl;
+            std::cerr << "       clahe --mapped-raw <input> <columns> <rows> <8|16le|16be> <output> [clip limit]"
+                      << std::endl;
+            return 1;
+        }
+
+        auto const clipLimit = (argc > outputArgument + 1) ? atof(argv[outputArgument + 1]) : 40.0;
+        auto const start = std::chrono::steady_clock::now();
+        auto const retVal = claheMappedFile(argv[firstPath], layout, argv[outputArgument], nullptr, clipLimit);
+        auto const stop = std::chrono::steady_clock::now();
+        std::cout << "Duration (us): " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()
+                  << std::endl;
+        std::cout << "claheMappedFile returned with " << retVal << std::endl;
+        return (retVal == 0) ? 0 : 1;
+    }
+
+    // Floating point radiance maps, i.e. OpenEXR or Radiance files, to an 8 or 16-bit image file
+    if (std::string(argv[1]) == "--hdr")
+    {
+        if (argc < 4)
+        {
+            std::cerr << "Usage: clahe --hdr <input> <output> [8|16] [bins] [clip limit]" << std::endl;
+            return 1;
+        }
+
+        auto const radiances = cv::imread(argv[2], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+        auto const outputDepth = (argc > 4 && std::string(argv[4]) == "16") ? CV_16U : CV_8U;
+        HdrBinning const binning((argc > 5) ? static_cast<unsigned int>(atoi(argv[5])) : 1024);
+        auto const clipLimit = (argc > 6) ? atof(argv[6]) : 40.0;
+
+        cv::Mat displayImage;
+        auto const start = std::chrono::steady_clock::now();
+        auto const retVal = claheHdr(radiances, displayImage, outputDepth, binning, clipLimit);
+        auto const stop = std::chrono::steady_clock::now();
+        std::cout << "Duration (us): " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()
+                  << std::endl;
+        std::cout << "claheHdr returned with " << retVal << std::endl;
+        return (retVal == 0 && cv::imwrite(argv[3], displayImage)) ? 0 : 1;
+    }
+
     auto image = cv::imread(argv[1], cv::IMREAD_GRAYSCALE);
 
     cv::Mat processedImage;
+    ClaheStatistics statistics;
     int retVal(-1);
 
     auto start = std::chrono::high_resolution_clock::now();
     if (argc == 3)
     {
-        retVal = clahe(image, processedImage, atoi(argv[2]));
+        retVal = clahe(image, processedImage, statistics, atoi(argv[2]));
     }
     else
     {
         // In order to specify your own mapping function:
-        // retVal = clahe(image, processedImage, unityMapping);
-        retVal = clahe(image, processedImage);
+        // retVal = clahe(image, processedImage, statistics, unityMapping);
+        retVal = clahe(image, processedImage, statistics);
     }
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
     std::cout << "Duration (us): " << duration.count() << std::endl;
 
+    std::cout << "Entropies:" << std::endl;
+    std::cout << "Original: " << statistics.inputEntropy << std::endl;
+    std::cout << "CLAHE: " << statistics.outputEntropy << std::endl;
+    std::cout << "Mean brightness error: " << statistics.meanBrightnessError << std::endl;
+
     std::string const windowNameNewImage("Histogram Equalized Image");
     cv::namedWindow(windowNameNewImage, cv::WINDOW_NORMAL);
     cv::imshow(windowNameNewImage, processedImage);
 
-    // Get the histogram of the original image
-    ImageHistogram originalHistogram;
-    generateGrayscaleHistogram(image, originalHistogram);
+    // The histograms of the original and new image were collected by clahe()
     cv::Mat originalHistogramImage;
-    createHistogramPlot(originalHistogram, 512, 512, originalHistogramImage);
+    createHistogramPlot(statistics.inputHistogram, 512, 512, originalHistogramImage);
     // Display it
     std::string const windowOriginalHistogram("Original Histogram");
     cv::namedWindow(windowOriginalHistogram, cv::WINDOW_NORMAL);
     cv::imshow(windowOriginalHistogram, originalHistogramImage);
 
-    // Get the histogram of the new image
-    ImageHistogram claheHistogram;
-    generateGrayscaleHistogram(processedImage, claheHistogram);
     cv::Mat claheHistImage;
-    createHistogramPlot(claheHistogram, 512, 512, claheHistImage);
+    createHistogramPlot(statistics.outputHistogram, 512, 512, claheHistImage);
     // Display it
     std::string const windowNewHistogram("New Histogram");
     cv::namedWindow(windowNewHistogram, cv::WINDOW_NORMAL);
@@ -0,0 +1,330 @@
+/*
+ * file: mappedio.cpp
+ * purpose: Implementation of the memory mapped PGM and raw image path.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "mappedio.hpp"
+#include "threadpool.hpp"
+#include "tiles.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Data on the tiles the image will be split into
+static unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+// The number of output rows a worker claims at a time
+static unsigned int const rowsPerBand(32);
+
+#ifdef __linux__
+/*
+ * A file and its mapping, both released on destruction.
+ */
+struct FileMapping
+{
+    int descriptor;
+    uint8_t * data;
+    size_t size;
+
+    FileMapping()
+      : descriptor(-1),
+        data(nullptr),
+        size(0)
+    {
+        // Empty
+    }
+
+    ~FileMapping()
+    {
+        if (nullptr != data)
+        {
+            munmap(data, size);
+        }
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+    }
+
+    FileMapping(FileMapping const &) = delete;
+    FileMapping & operator=(FileMapping const &) = delete;
+};
+
+/*
+ * Fills in the geometry, maximum value and header size of a binary PGM and
+ * sets the matching raw format. Returns false if the header is malformed.
+ */
+static bool readPgmHeader(uint8_t const * data, size_t size, MappedImageLayout & layout);
+
+/*
+ * Converts the 16-bit pixels to 8 bits, scaled by the maximum value, one row
+ * at a time while counting each row into the tile histograms.
+ */
+static void convertAndCountRows(uint8_t const * pixels,
+                                MappedImageLayout const & layout,
+                                TileGrid const & grid,
+                                cv::Mat & image,
+                                std::vector<ImageHistogram> & tileHistograms);
+#endif
+
+[[nodiscard]] int claheMappedFile(std::string const & inputPath,
+                                  MappedImageLayout const & inputLayout,
+                                  std::string const & outputPath,
+                                  GrayLevelMappingFunction const & mapping /* = nullptr */,
+                                  double clipLimit /* = 40.0 */,
+                                  unsigned int threadCount /* = 0 */) noexcept
+{
+#ifdef __linux__
+    bool outputCreated(false);
+    try
+    {
+        FileMapping input;
+        input.descriptor = open(inputPath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status;
+        if (input.descriptor < 0 || fstat(input.descriptor, &status) != 0 || status.st_size <= 0)
+        {
+            return -1;
+        }
+
+        input.size = static_cast<size_t>(status.st_size);
+        auto const inputData = mmap(nullptr, input.size, PROT_READ, MAP_PRIVATE, input.descriptor, 0);
+        if (MAP_FAILED == inputData)
+        {
+            return -1;
+        }
+        input.data = static_cast<uint8_t *>(inputData);
+
+        // The first pass reads the file front to back exactly once
+        madvise(input.data, input.size, MADV_SEQUENTIAL);
+
+        auto layout = inputLayout;
+        if (PGM_FILE == layout.format && !readPgmHeader(input.data, input.size, layout))
+        {
+            return -1;
+        }
+        if (RAW_8BIT != layout.format && RAW_16BIT_LITTLE_ENDIAN != layout.format &&
+            RAW_16BIT_BIG_ENDIAN != layout.format)
+        {
+            return -1;
+        }
+
+        auto const bytesPerPixel = (RAW_8BIT == layout.format) ? 1u : 2u;
+        auto const pixelCount = static_cast<size_t>(layout.columns) * layout.rows;
+        if (layout.headerBytes > input.size || pixelCount * bytesPerPixel > input.size - layout.headerBytes)
+        {
+            return -1;
+        }
+        auto const pixels = input.data + layout.headerBytes;
+
+        // 8-bit pixels are used in place, 16-bit ones are scaled into a working image
+        cv::Mat image;
+        if (RAW_8BIT == layout.format)
+        {
+            image = cv::Mat(layout.rows, layout.columns, CV_8UC1, const_cast<uint8_t *>(pixels));
+        }
+        else
+        {
+            image.create(layout.rows, layout.columns, CV_8UC1);
+        }
+        if (!isValidClaheInput(image, tilesHorizontal, tilesVertical))
+        {
+            return -1;
+        }
+
+        TileLookupTables tables(TileGrid(tilesHorizontal, tilesVertical, layout.columns, layout.rows));
+        auto const & grid = tables.grid;
+        std::vector<ImageHistogram> tileHistograms(tilesHorizontal * tilesVertical);
+        if (RAW_8BIT == layout.format)
+        {
+            countTileHistograms(image, grid, 0, grid.rows, tileHistograms);
+        }
+        else
+        {
+            convertAndCountRows(pixels, layout, grid, image, tileHistograms);
+        }
+
+        for (auto tileY = 0u; tileY < tilesVertical; ++tileY)
+        {
+            for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+            {
+                generateTileLookupTable(tileHistograms[tileY * tilesHorizontal + tileX], tileX, tileY, mapping,
+                                        clipLimit, tables);
+            }
+        }
+        selectRegionKernels(tables);
+        InterpolationPlan const plan(grid);
+
+        // Reserve the output's blocks up front, a full disk is then an error
+        // here rather than a SIGBUS on a write through the mapping
+        auto const outputIsPgm = outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".pgm") == 0;
+        auto const header =
+            outputIsPgm ? "P5\n" + std::to_string(grid.columns) + ' ' + std::to_string(grid.rows) + "\n255\n" : "";
+        FileMapping output;
+        output.descriptor = open(outputPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (output.descriptor < 0)
+        {
+            return -1;
+        }
+        // Truncating the input, or a hard link to it, would pull the pages
+        // from under the mapping being read, and the error paths below would
+        // then delete the user's original
+        struct stat outputStatus;
+        if (fstat(output.descriptor, &outputStatus) != 0 ||
+            (outputStatus.st_dev == status.st_dev && outputStatus.st_ino == status.st_ino))
+        {
+            return -1;
+        }
+        outputCreated = true;
+        output.size = header.size() + pixelCount;
+        if (ftruncate(output.descriptor, 0) != 0 ||
+            posix_fallocate(output.descriptor, 0, static_cast<off_t>(output.size)) != 0)
+        {
+            std::remove(outputPath.c_str());
+            return -1;
+        }
+
+        auto const outputData = mmap(nullptr, output.size, PROT_READ | PROT_WRITE, MAP_SHARED, output.descriptor, 0);
+        if (MAP_FAILED == outputData)
+        {
+            std::remove(outputPath.c_str());
+            return -1;
+        }
+        output.data = static_cast<uint8_t *>(outputData);
+        madvise(output.data, output.size, MADV_SEQUENTIAL);
+        std::memcpy(output.data, header.data(), header.size());
+
+        cv::Mat outputImage(grid.rows, grid.columns, CV_8UC1, output.data + header.size());
+        if (RAW_8BIT == layout.format)
+        {
+            // The interpolation reads 8-bit input a second time, from pages the
+            // sequential advice of the first pass lets the kernel drop early
+            madvise(input.data, input.size, MADV_WILLNEED);
+        }
+        ThreadPool pool(std::max((threadCount > 0) ? threadCount : std::thread::hardware_concurrency(), 1u));
+        auto const bandCount = (grid.rows + rowsPerBand - 1) / rowsPerBand;
+        std::atomic<unsigned int> nextBand(0);
+        pool.runOnAllWorkers([&](unsigned int) {
+            for (auto band = nextBand++; band < bandCount; band = nextBand++)
+            {
+                auto const bandBegin = band * rowsPerBand;
+                interpolateRows(image, outputImage, tables, plan, bandBegin, std::min(bandBegin + rowsPerBand, grid.rows),
+                                nullptr);
+            }
+        });
+    }
+    catch (std::exception const &)
+    {
+        // Allocation of the working image, the tables or the workers failed
+        if (outputCreated)
+        {
+            std::remove(outputPath.c_str());
+        }
+        return -1;
+    }
+
+    return 0;
+#else
+    (void)inputPath;
+    (void)inputLayout;
+    (void)outputPath;
+    (void)mapping;
+    (void)clipLimit;
+    (void)threadCount;
+    return -1;
+#endif
+}
+
+#ifdef __linux__
+static bool readPgmHeader(uint8_t const * data, size_t size, MappedImageLayout & layout)
+{
+    if (size < 2 || data[0] != 'P' || data[1] != '5')
+    {
+        return false;
+    }
+
+    // Width, height and maximum value, separated by whitespace and comments
+    size_t position(2);
+    unsigned long long values[3];
+    for (auto & value : values)
+    {
+        while (position < size && (std::isspace(data[position]) || data[position] == '#'))
+        {
+            if (data[position] == '#')
+            {
+                while (position < size && data[position] != '\n')
+                {
+                    ++position;
+                }
+            }
+            else
+            {
+                ++position;
+            }
+        }
+
+        if (position >= size || !std::isdigit(data[position]))
+        {
+            return false;
+        }
+        value = 0;
+        while (position < size && std::isdigit(data[position]) && value <= UINT32_MAX)
+        {
+            value = value * 10 + (data[position++] - '0');
+        }
+    }
+
+    // A single whitespace character separates the header from the pixels
+    if (position >= size || !std::isspace(data[position]) || values[0] > INT32_MAX || values[1] > INT32_MAX ||
+        values[2] == 0 || values[2] > UINT16_MAX)
+    {
+        return false;
+    }
+
+    layout.columns = static_cast<unsigned int>(values[0]);
+    layout.rows = static_cast<unsigned int>(values[1]);
+    layout.maxValue = static_cast<unsigned int>(values[2]);
+    layout.headerBytes = position + 1;
+    // Samples wider than a byte are big-endian in a PGM
+    layout.format = (layout.maxValue > UINT8_MAX) ? RAW_16BIT_BIG_ENDIAN : RAW_8BIT;
+    return true;
+}
+
+static void convertAndCountRows(uint8_t const * pixels,
+                                MappedImageLayout const & layout,
+                                TileGrid const & grid,
+                                cv::Mat & image,
+                                std::vector<ImageHistogram> & tileHistograms)
+{
+    // Values above the maximum are clipped to white
+    auto const maxValue = (layout.maxValue > 0) ? std::min(layout.maxValue, 65535u) : 65535u;
+    std::vector<uint8_t> scale(65536, UINT8_MAX);
+    for (auto value = 0u; value <= maxValue; ++value)
+    {
+        scale[value] = static_cast<uint8_t>((value * 255 + maxValue / 2) / maxValue);
+    }
+
+    auto const highByte = (RAW_16BIT_BIG_ENDIAN == layout.format) ? 0u : 1u;
+    for (auto rowIdx = 0u; rowIdx < grid.rows; ++rowIdx)
+    {
+        auto const inputRow = pixels + static_cast<size_t>(rowIdx) * grid.columns * 2;
+        auto const imageRow = image.ptr<uint8_t>(rowIdx);
+        for (auto colIdx = 0u; colIdx < grid.columns; ++colIdx)
+        {
+            auto const sample = inputRow + colIdx * 2;
+            imageRow[colIdx] = scale[(sample[highByte] << 8) | sample[1 - highByte]];
+        }
+        countTileHistograms(image, grid, rowIdx, rowIdx + 1, tileHistograms);
+    }
+}
+#endif
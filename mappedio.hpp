@@ -0,0 +1,63 @@
+/*
+ * file: mappedio.hpp
+ * purpose: Declaration of a file to file CLAHE path for PGM and raw images
+ *          which works on memory mappings of both files instead of decoding
+ *          into and encoding from intermediate buffers.
+ */
+
+#pragma once
+
+#include <string>
+#include "clahe.hpp"
+
+enum MappedPixelFormat : uint8_t
+{
+    // Binary PGM (P5), the geometry and maximum value are read from the header
+    PGM_FILE = 0,
+    RAW_8BIT = 1,
+    RAW_16BIT_LITTLE_ENDIAN = 2,
+    RAW_16BIT_BIG_ENDIAN = 3,
+};
+
+struct MappedImageLayout
+{
+    MappedPixelFormat format;
+    // The rest is only used for raw files
+    unsigned int columns;
+    unsigned int rows;
+    // Bytes to skip at the start of the file, i.e. a camera's own header
+    unsigned long long headerBytes;
+    // The largest pixel value, i.e. 4095 for 12-bit data, 0 for the format's own
+    unsigned int maxValue;
+};
+
+/*
+ * Equalizes an image file into another without copying the input:
+ *
+ *     MappedImageLayout layout{RAW_16BIT_LITTLE_ENDIAN, 4096, 3072, 0, 4095};
+ *     claheMappedFile("frame.raw", layout, "frame.pgm");
+ *
+ * The input is mapped read-only and read front to back once with sequential
+ * read-ahead, the tile histograms being counted as its pages are first
+ * touched. 8-bit pixels are then interpolated straight from the mapping, while
+ * 16-bit pixels are scaled to 8 bits by their maximum value in that same
+ * first pass, into a working image half their size. The output file is sized
+ * up front and mapped, and the worker threads write the pixels directly into
+ * the page cache.
+ *
+ * Files whose output path ends in .pgm are written as binary PGM, anything
+ * else as raw 8-bit pixels. The output is identical to clahe() on the 8-bit
+ * image.
+ *
+ * threadCount- The number of interpolating threads, 0 uses every processor.
+ *
+ * Returns 0 on success and -1 on failure, i.e. an unreadable or truncated
+ * input, a malformed PGM header, an output path naming the input file or
+ * a platform without memory mappings.
+ */
+[[nodiscard]] int claheMappedFile(std::string const & inputPath,
+                                  MappedImageLayout const & inputLayout,
+                                  std::string const & outputPath,
+                                  GrayLevelMappingFunction const & mapping = nullptr,
+                                  double clipLimit = 40.0,
+                                  unsigned int threadCount = 0) noexcept;
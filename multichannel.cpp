@@ -0,0 +1,595 @@
+/*
+ * file: multichannel.cpp
+ * purpose: Implementation of the interleaved multi-channel and Bayer mosaic
+ *          CLAHE front ends.
+ */
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include "opencv2/opencv.hpp"
+#include "multichannel.hpp"
+#include "tiles.hpp"
+
+static unsigned int const maximumChannels(4);
+
+// The colors of a Bayer mosaic, both green sites of a cell share one
+static unsigned int const bayerColors(3);
+static unsigned int const redColor(0), greenColor(1), blueColor(2);
+
+/*
+ * The four tables a region blends between, for every channel: each entry packs
+ * the top left, top right, bottom left and bottom right tiles' values, from the
+ * low byte up, and the entries are interleaved the same way as the pixels, so
+ * entry intensity * Channels + channel maps that channel.
+ */
+template <unsigned int Channels>
+using RegionLookupTable = std::array<uint32_t, 256 * Channels>;
+
+static int equalizeChannels(cv::Mat const & input,
+                            cv::Mat & output,
+                            GrayLevelMappingFunction const & mapping,
+                            double clipLimit) noexcept;
+
+static int equalizeBayer(cv::Mat const & input,
+                         cv::Mat & output,
+                         BayerPattern pattern,
+                         GrayLevelMappingFunction const & mapping,
+                         double clipLimit) noexcept;
+
+/*
+ * The color of the site at the given row and column parity of a mosaic.
+ */
+static unsigned int getBayerColor(BayerPattern pattern, unsigned int rowParity, unsigned int columnParity) noexcept;
+
+/*
+ * Builds every color's tile tables, over the cells of the mosaic, from a
+ * single read of the frame.
+ */
+static void generateBayerLookupTables(cv::Mat const & input,
+                                      BayerPattern pattern,
+                                      GrayLevelMappingFunction const & mapping,
+                                      double clipLimit,
+                                      std::vector<TileLookupTables> & colorTables);
+
+/*
+ * Interpolates every raw row as a row of two channel cells, the channels
+ * being the colors of the row's parity.
+ */
+static void interpolateBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             std::vector<TileLookupTables> const & colorTables,
+                             InterpolationPlan const & plan);
+
+/*
+ * Builds every channel's tile tables from a single read of the image.
+ */
+template <unsigned int Channels>
+static void generateChannelLookupTables(cv::Mat const & input,
+                                        GrayLevelMappingFunction const & mapping,
+                                        double clipLimit,
+                                        std::vector<TileLookupTables> & channelTables);
+
+/*
+ * Interpolates all channels of every row, reading and writing each
+ * interleaved pixel once.
+ */
+template <unsigned int Channels>
+static void interpolateChannels(cv::Mat const & input,
+                                cv::Mat & output,
+                                std::vector<TileLookupTables> const & channelTables,
+                                InterpolationPlan const & plan);
+
+/*
+ * Packs the tables of a region's four tiles for every channel, the tiles of
+ * channel c being looked up in channelTables[c].
+ */
+template <unsigned int Channels>
+static void packRegionLookupTable(std::array<TileLookupTables const *, Channels> const & channelTables,
+                                  unsigned int left,
+                                  unsigned int right,
+                                  unsigned int top,
+                                  unsigned int bottom,
+                                  RegionLookupTable<Channels> & regionTable);
+
+/*
+ * Maps one span of an interleaved row through the top left tables of a
+ * region which does not blend.
+ */
+template <size_t... Channel>
+static void lookUpChannels(uint8_t const * inputRow,
+                           uint8_t * outputRow,
+                           InterpolationSpan const & span,
+                           uint32_t const * regionTable,
+                           std::index_sequence<Channel...>);
+
+/*
+ * Blends the four tables of a region over one span of an interleaved row.
+ * channelWeights holds every column's weight once per channel, interleaved
+ * like the pixels.
+ */
+template <unsigned int Channels>
+static void blendChannels(uint8_t const * inputRow,
+                          uint8_t * outputRow,
+                          InterpolationSpan const & span,
+                          uint32_t const * regionTable,
+                          float const * channelWeights,
+                          float rowWeight);
+
+/*
+ * Every column's interpolation weight repeated for each channel, so the
+ * blend runs over the samples of an interleaved row as one contiguous loop.
+ */
+static std::vector<float> getChannelWeights(std::vector<float> const & columnWeights, unsigned int channels);
+
+[[nodiscard]] int claheMultiChannel(cv::Mat const & input, cv::Mat & output, double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeChannels(input, output, nullptr, clipLimit);
+}
+
+[[nodiscard]] int claheMultiChannel(cv::Mat const & input,
+                                    cv::Mat & output,
+                                    GrayLevelMappingFunction mapping,
+                                    double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeChannels(input, output, mapping, clipLimit);
+}
+
+[[nodiscard]] int claheBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeBayer(input, output, pattern, nullptr, clipLimit);
+}
+
+[[nodiscard]] int claheBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             GrayLevelMappingFunction mapping,
+                             double clipLimit /* = 40.0 */) noexcept
+{
+    return equalizeBayer(input, output, pattern, mapping, clipLimit);
+}
+
+static int equalizeChannels(cv::Mat const & input,
+                            cv::Mat & output,
+                            GrayLevelMappingFunction const & mapping,
+                            double clipLimit) noexcept
+{
+    // Data on the tiles the image will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    auto const channels = static_cast<unsigned int>(input.channels());
+    if (input.depth() != CV_8U || channels < 1 || channels > maximumChannels)
+    {
+        return -1;
+    }
+
+    // A single channel gains nothing from the interleaved kernels
+    if (channels == 1)
+    {
+        return clahe(input, output, mapping, clipLimit);
+    }
+
+    if (static_cast<unsigned int>(input.cols) < tilesHorizontal ||
+        static_cast<unsigned int>(input.rows) < tilesVertical)
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), input.type());
+
+        TileGrid const grid(tilesHorizontal, tilesVertical, input.cols, input.rows);
+        std::vector<TileLookupTables> channelTables(channels, TileLookupTables(grid));
+        InterpolationPlan const plan(grid);
+
+        switch (channels)
+        {
+            case 2:
+                generateChannelLookupTables<2>(input, mapping, clipLimit, channelTables);
+                interpolateChannels<2>(input, output, channelTables, plan);
+                break;
+            case 3:
+                generateChannelLookupTables<3>(input, mapping, clipLimit, channelTables);
+                interpolateChannels<3>(input, output, channelTables, plan);
+                break;
+            default:
+                generateChannelLookupTables<4>(input, mapping, clipLimit, channelTables);
+                interpolateChannels<4>(input, output, channelTables, plan);
+                break;
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int equalizeBayer(cv::Mat const & input,
+                         cv::Mat & output,
+                         BayerPattern pattern,
+                         GrayLevelMappingFunction const & mapping,
+                         double clipLimit) noexcept
+{
+    // Data on the tiles each color plane will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    if (input.type() != CV_8UC1 || input.cols % 2 != 0 || input.rows % 2 != 0 || pattern > GBRG_PATTERN ||
+        static_cast<unsigned int>(input.cols / 2) < tilesHorizontal ||
+        static_cast<unsigned int>(input.rows / 2) < tilesVertical)
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), input.type());
+
+        // The grid of a color plane, one pixel per 2 x 2 cell
+        TileGrid const grid(tilesHorizontal, tilesVertical, input.cols / 2, input.rows / 2);
+        std::vector<TileLookupTables> colorTables(bayerColors, TileLookupTables(grid));
+        InterpolationPlan const plan(grid);
+
+        generateBayerLookupTables(input, pattern, mapping, clipLimit, colorTables);
+        interpolateBayer(input, output, pattern, colorTables, plan);
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static unsigned int getBayerColor(BayerPattern pattern, unsigned int rowParity, unsigned int columnParity) noexcept
+{
+    // Indexed by pattern, row parity and column parity
+    static unsigned int const colors[4][2][2] = {{{redColor, greenColor}, {greenColor, blueColor}},
+                                                 {{blueColor, greenColor}, {greenColor, redColor}},
+                                                 {{greenColor, redColor}, {blueColor, greenColor}},
+                                                 {{greenColor, blueColor}, {redColor, greenColor}}};
+    return colors[pattern][rowParity][columnParity];
+}
+
+static void generateBayerLookupTables(cv::Mat const & input,
+                                      BayerPattern pattern,
+                                      GrayLevelMappingFunction const & mapping,
+                                      double clipLimit,
+                                      std::vector<TileLookupTables> & colorTables)
+{
+    auto const & grid = colorTables[0].grid;
+
+    // One row of tiles at a time, so the histograms being filled stay in cache
+    std::vector<std::array<ImageHistogram, bayerColors>> tileHistograms(grid.tilesHorizontal);
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        auto const cells = grid.getTileBounds(0, tileY);
+        for (auto rowIdx = 2 * cells.y; rowIdx < 2 * (cells.y + cells.height); ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+            auto const evenColor = getBayerColor(pattern, rowIdx % 2, 0);
+            auto const oddColor = getBayerColor(pattern, rowIdx % 2, 1);
+            for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+            {
+                auto const columns = grid.getTileBounds(tileX, tileY);
+                auto & evenHistogram = tileHistograms[tileX][evenColor].histogram;
+                auto & oddHistogram = tileHistograms[tileX][oddColor].histogram;
+                for (auto cellIdx = columns.x; cellIdx < columns.x + columns.width; ++cellIdx)
+                {
+                    ++evenHistogram[inputRow[2 * cellIdx]];
+                    ++oddHistogram[inputRow[2 * cellIdx + 1]];
+                }
+            }
+        }
+
+        for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+        {
+            for (auto color = 0u; color < bayerColors; ++color)
+            {
+                // Green is counted twice per cell
+                auto const colorClipLimit = (color == greenColor) ? 2.0 * clipLimit : clipLimit;
+                generateTileLookupTable(tileHistograms[tileX][color], tileX, tileY, mapping, colorClipLimit,
+                                        colorTables[color]);
+                tileHistograms[tileX][color] = ImageHistogram();
+            }
+        }
+    }
+
+    for (auto & tables : colorTables)
+    {
+        selectRegionKernels(tables);
+    }
+}
+
+static void interpolateBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             std::vector<TileLookupTables> const & colorTables,
+                             InterpolationPlan const & plan)
+{
+    auto const regionCount = plan.horizontalSpans.size() * plan.verticalSpans.size();
+
+    // Each row parity reads as a two channel image, with its own region tables
+    std::array<std::vector<RegionLookupTable<2>>, 2> tables;
+    for (auto rowParity = 0u; rowParity < 2; ++rowParity)
+    {
+        std::array<TileLookupTables const *, 2> const parityTables = {
+            &colorTables[getBayerColor(pattern, rowParity, 0)], &colorTables[getBayerColor(pattern, rowParity, 1)]};
+        tables[rowParity].resize(regionCount);
+        for (auto region = 0u; region < regionCount; ++region)
+        {
+            auto const & horizontalSpan = plan.horizontalSpans[region % plan.horizontalSpans.size()];
+            auto const & verticalSpan = plan.verticalSpans[region / plan.horizontalSpans.size()];
+            packRegionLookupTable<2>(parityTables, horizontalSpan.lowerTile, horizontalSpan.upperTile,
+                                     verticalSpan.lowerTile, verticalSpan.upperTile, tables[rowParity][region]);
+        }
+    }
+
+    // A region only needs one table when none of the colors has to blend there
+    std::vector<bool> singleTableRegions(colorTables[0].regionKernels.size(), true);
+    for (auto region = 0u; region < singleTableRegions.size(); ++region)
+    {
+        for (auto const & colorTable : colorTables)
+        {
+            if (colorTable.regionKernels[region] == BLEND_KERNEL)
+            {
+                singleTableRegions[region] = false;
+            }
+        }
+    }
+
+    auto const channelWeights = getChannelWeights(plan.columnWeights, 2);
+
+    for (auto regionY = 0u; regionY < plan.verticalSpans.size(); ++regionY)
+    {
+        auto const & verticalSpan = plan.verticalSpans[regionY];
+
+        for (auto rowIdx = 2 * verticalSpan.begin; rowIdx < 2 * verticalSpan.end; ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+            auto outputRow = output.ptr<uint8_t>(rowIdx);
+            auto const & rowTables = tables[rowIdx % 2];
+
+            for (auto regionX = 0u; regionX < plan.horizontalSpans.size(); ++regionX)
+            {
+                auto const & span = plan.horizontalSpans[regionX];
+                auto const region = regionY * plan.horizontalSpans.size() + regionX;
+                if (singleTableRegions[region])
+                {
+                    lookUpChannels(inputRow, outputRow, span, rowTables[region].data(), std::make_index_sequence<2>());
+                }
+                else
+                {
+                    blendChannels<2>(inputRow, outputRow, span, rowTables[region].data(), channelWeights.data(),
+                                     plan.rowWeights[rowIdx / 2]);
+                }
+            }
+        }
+    }
+}
+
+template <unsigned int Channels>
+static void generateChannelLookupTables(cv::Mat const & input,
+                                        GrayLevelMappingFunction const & mapping,
+                                        double clipLimit,
+                                        std::vector<TileLookupTables> & channelTables)
+{
+    auto const & grid = channelTables[0].grid;
+
+    // One row of tiles at a time, so the histograms being filled stay in cache
+    std::vector<std::array<ImageHistogram, Channels>> tileHistograms(grid.tilesHorizontal);
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        auto const rows = grid.getTileBounds(0, tileY);
+        for (auto rowIdx = rows.y; rowIdx < rows.y + rows.height; ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+            for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+            {
+                auto const columns = grid.getTileBounds(tileX, tileY);
+                auto & histograms = tileHistograms[tileX];
+                for (auto colIdx = columns.x; colIdx < columns.x + columns.width; ++colIdx)
+                {
+                    auto const pixel = inputRow + colIdx * Channels;
+                    for (auto channel = 0u; channel < Channels; ++channel)
+                    {
+                        ++histograms[channel].histogram[pixel[channel]];
+                    }
+                }
+            }
+        }
+
+        for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+        {
+            for (auto channel = 0u; channel < Channels; ++channel)
+            {
+                generateTileLookupTable(tileHistograms[tileX][channel], tileX, tileY, mapping, clipLimit,
+                                        channelTables[channel]);
+                tileHistograms[tileX][channel] = ImageHistogram();
+            }
+        }
+    }
+
+    for (auto & tables : channelTables)
+    {
+        selectRegionKernels(tables);
+    }
+}
+
+template <unsigned int Channels>
+static void interpolateChannels(cv::Mat const & input,
+                                cv::Mat & output,
+                                std::vector<TileLookupTables> const & channelTables,
+                                InterpolationPlan const & plan)
+{
+    // With the channels side by side and the four tiles packed together, a
+    // sample needs one table read instead of four
+    std::array<TileLookupTables const *, Channels> tablesOfChannels;
+    for (auto channel = 0u; channel < Channels; ++channel)
+    {
+        tablesOfChannels[channel] = &channelTables[channel];
+    }
+    std::vector<RegionLookupTable<Channels>> tables(plan.horizontalSpans.size() * plan.verticalSpans.size());
+    for (auto region = 0u; region < tables.size(); ++region)
+    {
+        auto const & horizontalSpan = plan.horizontalSpans[region % plan.horizontalSpans.size()];
+        auto const & verticalSpan = plan.verticalSpans[region / plan.horizontalSpans.size()];
+        packRegionLookupTable<Channels>(tablesOfChannels, horizontalSpan.lowerTile, horizontalSpan.upperTile,
+                                        verticalSpan.lowerTile, verticalSpan.upperTile, tables[region]);
+    }
+
+    // A region only needs one table when none of the channels has to blend there
+    std::vector<bool> singleTableRegions(channelTables[0].regionKernels.size(), true);
+    for (auto region = 0u; region < singleTableRegions.size(); ++region)
+    {
+        for (auto const & channelTable : channelTables)
+        {
+            if (channelTable.regionKernels[region] == BLEND_KERNEL)
+            {
+                singleTableRegions[region] = false;
+            }
+        }
+    }
+
+    auto const channelWeights = getChannelWeights(plan.columnWeights, Channels);
+
+    for (auto regionY = 0u; regionY < plan.verticalSpans.size(); ++regionY)
+    {
+        auto const & verticalSpan = plan.verticalSpans[regionY];
+
+        for (auto rowIdx = verticalSpan.begin; rowIdx < verticalSpan.end; ++rowIdx)
+        {
+            auto const inputRow = input.ptr<uint8_t>(rowIdx);
+            auto outputRow = output.ptr<uint8_t>(rowIdx);
+
+            for (auto regionX = 0u; regionX < plan.horizontalSpans.size(); ++regionX)
+            {
+                auto const & span = plan.horizontalSpans[regionX];
+                auto const region = regionY * plan.horizontalSpans.size() + regionX;
+                if (singleTableRegions[region])
+                {
+                    lookUpChannels(inputRow, outputRow, span, tables[region].data(),
+                                   std::make_index_sequence<Channels>());
+                }
+                else
+                {
+                    blendChannels<Channels>(inputRow, outputRow, span, tables[region].data(), channelWeights.data(),
+                                            plan.rowWeights[rowIdx]);
+                }
+            }
+        }
+    }
+}
+
+template <unsigned int Channels>
+static void packRegionLookupTable(std::array<TileLookupTables const *, Channels> const & channelTables,
+                                  unsigned int left,
+                                  unsigned int right,
+                                  unsigned int top,
+                                  unsigned int bottom,
+                                  RegionLookupTable<Channels> & regionTable)
+{
+    for (auto channel = 0u; channel < Channels; ++channel)
+    {
+        auto const & tables = *channelTables[channel];
+        auto const tableAt = [&tables](unsigned int tileX, unsigned int tileY) -> auto const & {
+            return tables.tables[tileY * tables.grid.tilesHorizontal + tileX];
+        };
+        auto const & topLeft = tableAt(left, top);
+        auto const & topRight = tableAt(right, top);
+        auto const & bottomLeft = tableAt(left, bottom);
+        auto const & bottomRight = tableAt(right, bottom);
+        for (auto intensity = 0u; intensity < 256; ++intensity)
+        {
+            regionTable[intensity * Channels + channel] =
+                static_cast<uint32_t>(topLeft[intensity]) | static_cast<uint32_t>(topRight[intensity]) << 8 |
+                static_cast<uint32_t>(bottomLeft[intensity]) << 16 | static_cast<uint32_t>(bottomRight[intensity]) << 24;
+        }
+    }
+}
+
+template <size_t... Channel>
+static void lookUpChannels(uint8_t const * inputRow,
+                           uint8_t * outputRow,
+                           InterpolationSpan const & span,
+                           uint32_t const * regionTable,
+                           std::index_sequence<Channel...>)
+{
+    constexpr auto channels = static_cast<unsigned int>(sizeof...(Channel));
+    auto const begin(span.begin), end(span.end);
+
+    for (auto colIdx = begin; colIdx < end; ++colIdx)
+    {
+        auto const pixel = inputRow + colIdx * channels;
+        // The top left table is in the low byte of each entry
+        uint8_t const results[channels] = {static_cast<uint8_t>(regionTable[pixel[Channel] * channels + Channel])...};
+
+        auto const outputPixel = outputRow + colIdx * channels;
+        ((outputPixel[Channel] = results[Channel]), ...);
+    }
+}
+
+template <unsigned int Channels>
+static void blendChannels(uint8_t const * inputRow,
+                          uint8_t * outputRow,
+                          InterpolationSpan const & span,
+                          uint32_t const * regionTable,
+                          float const * channelWeights,
+                          float rowWeight)
+{
+    // Stores to the output could alias the span, so its bounds are read once
+    auto const begin(span.begin * Channels), end(span.end * Channels);
+
+    // The packed entries of a block of samples are gathered first, one read
+    // per sample, and then unpacked and blended in a plain loop over the
+    // block, which the compiler vectorizes across channels and pixels alike.
+    // A whole block is read before any of it is written, so the output may be
+    // the input.
+    constexpr unsigned int blockPixels(64), blockSamples(blockPixels * Channels);
+    uint32_t entries[blockSamples];
+    for (auto blockBegin = begin; blockBegin < end; blockBegin += blockSamples)
+    {
+        auto const samples = std::min(blockSamples, end - blockBegin);
+        auto const pixels = inputRow + blockBegin;
+        for (auto sample = 0u; sample < samples; sample += Channels)
+        {
+            for (auto channel = 0u; channel < Channels; ++channel)
+            {
+                entries[sample + channel] = regionTable[pixels[sample + channel] * Channels + channel];
+            }
+        }
+
+        // Same a + (b - a) * t form as the single channel kernels, so the
+        // channels come out as clahe() would produce them one at a time
+        auto const weights = channelWeights + blockBegin;
+        auto const outputSamples = outputRow + blockBegin;
+        for (auto sample = 0u; sample < samples; ++sample)
+        {
+            auto const entry = entries[sample];
+            float const topLeft = static_cast<float>(entry & 0xff);
+            float const topRight = static_cast<float>((entry >> 8) & 0xff);
+            float const bottomLeft = static_cast<float>((entry >> 16) & 0xff);
+            float const bottomRight = static_cast<float>(entry >> 24);
+            float const columnWeight = weights[sample];
+            float const top = topLeft + (topRight - topLeft) * columnWeight;
+            float const bottom = bottomLeft + (bottomRight - bottomLeft) * columnWeight;
+            outputSamples[sample] = static_cast<uint8_t>(top + (bottom - top) * rowWeight);
+        }
+    }
+}
+
+static std::vector<float> getChannelWeights(std::vector<float> const & columnWeights, unsigned int channels)
+{
+    std::vector<float> channelWeights(columnWeights.size() * channels);
+    for (auto colIdx = 0u; colIdx < columnWeights.size(); ++colIdx)
+    {
+        std::fill_n(channelWeights.begin() + colIdx * channels, channels, columnWeights[colIdx]);
+    }
+    return channelWeights;
+}
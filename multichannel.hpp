@@ -0,0 +1,81 @@
+/*
+ * file: multichannel.hpp
+ * purpose: Declaration of CLAHE front ends which equalize every channel of
+ *          an interleaved image, or every color of a Bayer mosaic,
+ *          independently, in one sweep over the image.
+ */
+
+#pragma once
+
+#include "clahe.hpp"
+
+/*
+ * Takes an interleaved 8-bit image of 1 to 4 channels (CV_8UC1 to CV_8UC4)
+ * and runs a CLAHE algorithm on each channel independently, i.e. for
+ * multispectral cameras or color inspection where hue shifts are acceptable.
+ *
+ * The histograms of all channels are built while reading the interleaved
+ * pixels once, and all channels are interpolated in one pass which reads and
+ * writes each pixel once, so there is no splitting into and merging of
+ * separate planes. The four tables a region blends are packed per entry, so
+ * a sample takes one table read, and the blend runs vectorized across the
+ * interleaved channels. Each channel of the output is the same as clahe() on
+ * that channel alone.
+ *
+ * input- The matrix holding the input image.
+ * output- The matrix for the output image to be stored in.
+ * clipLimit- The limit for a single bin of the histogram.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int claheMultiChannel(cv::Mat const & input, cv::Mat & output, double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int claheMultiChannel(cv::Mat const & input,
+                                    cv::Mat & output,
+                                    GrayLevelMappingFunction mapping,
+                                    double clipLimit = 40.0) noexcept;
+
+/*
+ * The color filter order of a Bayer mosaic, as the first two pixels of its
+ * first row followed by the first two pixels of its second row.
+ */
+enum BayerPattern : uint8_t
+{
+    RGGB_PATTERN = 0,
+    BGGR_PATTERN = 1,
+    GRBG_PATTERN = 2,
+    GBRG_PATTERN = 3,
+};
+
+/*
+ * Takes an 8-bit Bayer raw frame (CV_8UC1 with an even number of rows and
+ * columns) and equalizes it without demosaicing, so it can run before
+ * demosaicing in an image signal processor. The output keeps the mosaic
+ * layout.
+ *
+ * The mosaic is read once, counting a histogram per color in every tile. The
+ * tiles are laid out over the 2 x 2 cells of the mosaic, so each color's grid
+ * is clahe()'s grid over that color's plane, and every raw row is
+ * interpolated in one pass as a two channel interleaved row. The red and blue
+ * sites come out the same as clahe() on the red and blue planes. The two
+ * green sites of a cell share one histogram, with twice the clip limit for
+ * twice the pixels, so both greens get the same tables and no green
+ * imbalance is introduced.
+ *
+ * input- The matrix holding the raw frame.
+ * output- The matrix for the equalized raw frame to be stored in.
+ * pattern- The color filter order of the frame.
+ * clipLimit- The limit for a single bin of the histogram of one color plane.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int claheBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int claheBayer(cv::Mat const & input,
+                             cv::Mat & output,
+                             BayerPattern pattern,
+                             GrayLevelMappingFunction mapping,
+                             double clipLimit = 40.0) noexcept;
@@ -0,0 +1,135 @@
+/*
+ * file: numa.cpp
+ * purpose: Reads the NUMA topology from sysfs on Linux.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "numa.hpp"
+
+/*
+ * Parses a Linux cpu list such as "0-3,8,10-11".
+ */
+static std::vector<unsigned int> parseProcessorList(std::string const & list);
+
+/*
+ * The processors this process is allowed to run on.
+ */
+static std::vector<unsigned int> getAvailableProcessors();
+
+std::vector<NumaNode> getNumaNodes()
+{
+    auto const availableProcessors(getAvailableProcessors());
+    std::vector<NumaNode> nodes;
+
+#ifdef __linux__
+    std::ifstream onlineFile("/sys/devices/system/node/online");
+    std::string onlineList;
+    if (onlineFile && std::getline(onlineFile, onlineList))
+    {
+        for (auto nodeId : parseProcessorList(onlineList))
+        {
+            std::ifstream cpuFile("/sys/devices/system/node/node" + std::to_string(nodeId) + "/cpulist");
+            std::string cpuList;
+            if (!cpuFile || !std::getline(cpuFile, cpuList))
+            {
+                continue;
+            }
+
+            // Only keep processors of the node that this process may use
+            NumaNode node{nodeId, {}};
+            for (auto processor : parseProcessorList(cpuList))
+            {
+                for (auto available : availableProcessors)
+                {
+                    if (processor == available)
+                    {
+                        node.processors.push_back(processor);
+                        break;
+                    }
+                }
+            }
+
+            if (!node.processors.empty())
+            {
+                nodes.push_back(std::move(node));
+            }
+        }
+    }
+#endif
+
+    if (nodes.empty())
+    {
+        nodes.push_back({0, availableProcessors});
+    }
+
+    return nodes;
+}
+
+static std::vector<unsigned int> parseProcessorList(std::string const & list)
+{
+    std::vector<unsigned int> processors;
+    std::stringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ','))
+    {
+        if (range.empty())
+        {
+            continue;
+        }
+
+        auto const dash = range.find('-');
+        try
+        {
+            unsigned int const first = std::stoul(range.substr(0, dash));
+            unsigned int const last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+            for (auto processor = first; processor <= last; ++processor)
+            {
+                processors.push_back(processor);
+            }
+        }
+        catch (std::exception const &)
+        {
+            // Skip malformed entries rather than failing the whole topology
+        }
+    }
+
+    return processors;
+}
+
+static std::vector<unsigned int> getAvailableProcessors()
+{
+    std::vector<unsigned int> processors;
+
+#ifdef __linux__
+    cpu_set_t processorSet;
+    CPU_ZERO(&processorSet);
+    if (sched_getaffinity(0, sizeof(processorSet), &processorSet) == 0)
+    {
+        for (auto processor = 0u; processor < CPU_SETSIZE; ++processor)
+        {
+            if (CPU_ISSET(processor, &processorSet))
+            {
+                processors.push_back(processor);
+            }
+        }
+    }
+#endif
+
+    if (processors.empty())
+    {
+        for (auto processor = 0u; processor < std::max(std::thread::hardware_concurrency(), 1u); ++processor)
+        {
+            processors.push_back(processor);
+        }
+    }
+
+    return processors;
+}
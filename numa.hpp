@@ -0,0 +1,23 @@
+/*
+ * file: numa.hpp
+ * purpose: Discovery of the NUMA nodes of the machine and the processors this
+ *          process may run on in each of them.
+ */
+
+#pragma once
+
+#include <vector>
+
+struct NumaNode
+{
+    unsigned int id;
+    std::vector<unsigned int> processors;
+};
+
+/*
+ * Lists the NUMA nodes which have at least one processor available to this
+ * process. On single-node machines, or where the topology cannot be read
+ * (i.e. outside of Linux), a single node holding every available processor
+ * is returned.
+ */
+std::vector<NumaNode> getNumaNodes();
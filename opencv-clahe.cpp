@@ -96,14 +96,5 @@ float calculateEntropy(cv::Mat const & image)
     ImageHistogram temp;
     generateGrayscaleHistogram(image, temp);
 
-    auto totalPixels(image.rows * image.cols);
-    float entropy = 0.0;
-
-    for (auto i = 0u; i < 256; ++i)
-    {
-        float proportion = static_cast<float>(temp[i]) / totalPixels;
-        entropy += -1 * proportion * log2(proportion);
-    }
-
-    return isnan(entropy) ? 0.f : entropy;
+    return static_cast<float>(calculateHistogramEntropy(temp));
 }
\ No newline at end of file
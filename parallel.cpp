@@ -0,0 +1,254 @@
+/*
+ * file: parallel.cpp
+ * purpose: Implementation of the multi-threaded, NUMA aware CLAHE engine.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include "opencv2/opencv.hpp"
+#include "numa.hpp"
+#include "parallel.hpp"
+#include "tiles.hpp"
+#include "trace.hpp"
+
+ParallelClahe::ParallelClahe(unsigned int _threadCount /* = 0 */,
+                             bool _numaAware /* = false */,
+                             GrayLevelMappingFunction _mapping /* = nullptr */,
+                             double _clipLimit /* = 40.0 */,
+                             unsigned int _bandHeight /* = 32 */)
+  : mapping(std::move(_mapping)),
+    clipLimit(_clipLimit),
+    rowsPerBand(std::max(_bandHeight, 1u))
+{
+    // Without NUMA awareness all workers belong to one node and are not pinned
+    auto const topology = _numaAware ? getNumaNodes() : std::vector<NumaNode>{{0, {}}};
+
+    unsigned int availableProcessors(0);
+    for (auto const & node : topology)
+    {
+        availableProcessors += static_cast<unsigned int>(node.processors.size());
+    }
+    if (!_numaAware)
+    {
+        availableProcessors = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    unsigned int const threads = std::max((_threadCount > 0) ? _threadCount : availableProcessors,
+                                          static_cast<unsigned int>(topology.size()));
+
+    // Share the workers among the nodes in proportion to their processors
+    std::vector<std::vector<unsigned int>> workerProcessors;
+    unsigned int processorsBefore(0);
+    for (auto const & node : topology)
+    {
+        auto const nodeProcessors = _numaAware ? static_cast<unsigned int>(node.processors.size()) : availableProcessors;
+        auto const firstShare = threads * processorsBefore / availableProcessors;
+        processorsBefore += nodeProcessors;
+        auto const workerCount = std::max(threads * processorsBefore / availableProcessors - firstShare, 1u);
+
+        nodes.push_back({static_cast<unsigned int>(workerProcessors.size()), workerCount});
+        for (auto i = 0u; i < workerCount; ++i)
+        {
+            workerProcessors.push_back(node.processors);
+        }
+    }
+
+    pool = std::make_unique<ThreadPool>(workerProcessors);
+    nodeLookupTables.resize(nodes.size());
+}
+
+ParallelClahe::~ParallelClahe() = default;
+
+[[nodiscard]] int ParallelClahe::apply(cv::Mat const & input, cv::Mat & output) noexcept
+{
+    return equalize(input, output, nullptr);
+}
+
+[[nodiscard]] int ParallelClahe::apply(cv::Mat const & input,
+                                       cv::Mat & output,
+                                       ClaheStatistics & statistics) noexcept
+{
+    return equalize(input, output, &statistics);
+}
+
+unsigned int ParallelClahe::threadCount() const noexcept
+{
+    return pool->size();
+}
+
+unsigned int ParallelClahe::nodeCount() const noexcept
+{
+    return static_cast<unsigned int>(nodes.size());
+}
+
+unsigned int ParallelClahe::bandHeight() const noexcept
+{
+    return rowsPerBand;
+}
+
+int ParallelClahe::equalize(cv::Mat const & input, cv::Mat & output, ClaheStatistics * statistics) noexcept
+{
+    // Data on the tiles the image will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    if (nullptr != statistics)
+    {
+        *statistics = ClaheStatistics();
+    }
+
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical))
+    {
+        return -1;
+    }
+
+    try
+    {
+        // A newly allocated output is not touched here, its pages are first
+        // written by the workers of the node which owns them
+        output.create(input.size(), input.type());
+
+        // Every table, kind and region kernel is rewritten below, so the
+        // scratch from the previous image only has to match its geometry
+        if (!lookupTables || lookupTables->grid.columns != static_cast<unsigned int>(input.cols) ||
+            lookupTables->grid.rows != static_cast<unsigned int>(input.rows))
+        {
+            // Both are replaced only once both exist, so a failed allocation
+            // cannot leave tables of one geometry with a plan of another
+            auto newLookupTables = std::make_unique<TileLookupTables>(
+                TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+            auto newPlan = std::make_unique<InterpolationPlan>(newLookupTables->grid);
+            lookupTables = std::move(newLookupTables);
+            plan = std::move(newPlan);
+        }
+        auto const & grid = lookupTables->grid;
+
+        // Each node owns a band of whole tile rows, there is no use for more
+        // nodes than there are tile rows
+        auto const activeNodes = std::min(static_cast<unsigned int>(nodes.size()), tilesVertical);
+        auto const getNode = [this](unsigned int worker) {
+            auto node = 0u;
+            while (node + 1 < nodes.size() && worker >= nodes[node + 1].firstWorker)
+            {
+                ++node;
+            }
+            return node;
+        };
+        auto const getFirstTileRow = [activeNodes, tilesVertical](unsigned int node) {
+            return node * tilesVertical / activeNodes;
+        };
+
+        // Work within a node is claimed dynamically to balance uneven tiles
+        std::unique_ptr<std::atomic<unsigned int>[]> nextWorkItem(new std::atomic<unsigned int>[activeNodes]);
+        for (auto node = 0u; node < activeNodes; ++node)
+        {
+            nextWorkItem[node] = 0;
+        }
+
+        bool const collectStatistics(nullptr != statistics);
+        std::vector<std::array<unsigned int, 256>> inputHistograms(collectStatistics ? pool->size() : 0);
+        std::vector<std::array<unsigned int, 256>> outputHistograms(collectStatistics ? pool->size() : 0);
+
+        // Generate the look up table of each tile in the node's band
+        {
+            CLAHE_TRACE_SPAN("tables", 0);
+            pool->runOnAllWorkers([&](unsigned int worker) {
+                auto const node = getNode(worker);
+                if (node >= activeNodes)
+                {
+                    return;
+                }
+
+                auto const firstTileRow = getFirstTileRow(node);
+                auto const tileCount = (getFirstTileRow(node + 1) - firstTileRow) * tilesHorizontal;
+                auto histogram = collectStatistics ? inputHistograms[worker].data() : nullptr;
+
+                for (auto tile = nextWorkItem[node]++; tile < tileCount; tile = nextWorkItem[node]++)
+                {
+                    CLAHE_TRACE_SPAN("tile", firstTileRow * tilesHorizontal + tile);
+                    generateTileLookupTable(input, tile % tilesHorizontal, firstTileRow + tile / tilesHorizontal,
+                                            mapping, clipLimit, *lookupTables, histogram);
+                }
+            });
+        }
+
+        {
+            CLAHE_TRACE_SPAN("kernels", 0);
+            selectRegionKernels(*lookupTables);
+        }
+
+        // Give every node its own copy of the tables, created by one of its workers
+        if (activeNodes > 1)
+        {
+            pool->runOnAllWorkers([&](unsigned int worker) {
+                auto const node = getNode(worker);
+                if (node >= activeNodes || worker != nodes[node].firstWorker)
+                {
+                    return;
+                }
+
+                CLAHE_TRACE_SPAN("copy tables", node);
+                if (!nodeLookupTables[node])
+                {
+                    nodeLookupTables[node] = std::make_unique<TileLookupTables>(*lookupTables);
+                }
+                else
+                {
+                    *nodeLookupTables[node] = *lookupTables;
+                }
+            });
+        }
+
+        for (auto node = 0u; node < activeNodes; ++node)
+        {
+            nextWorkItem[node] = 0;
+        }
+
+        // Interpolate the output rows of the node's band
+        {
+            CLAHE_TRACE_SPAN("interpolation", 0);
+            pool->runOnAllWorkers([&](unsigned int worker) {
+                auto const node = getNode(worker);
+                if (node >= activeNodes)
+                {
+                    return;
+                }
+
+                auto const & tables = (activeNodes > 1) ? *nodeLookupTables[node] : *lookupTables;
+                auto const rowBegin = getFirstTileRow(node) * grid.tileHeight;
+                auto const rowEnd = (node + 1 == activeNodes) ? grid.rows : getFirstTileRow(node + 1) * grid.tileHeight;
+                auto const bandCount = (rowEnd - rowBegin + rowsPerBand - 1) / rowsPerBand;
+                auto histogram = collectStatistics ? outputHistograms[worker].data() : nullptr;
+
+                for (auto band = nextWorkItem[node]++; band < bandCount; band = nextWorkItem[node]++)
+                {
+                    auto const bandBegin = rowBegin + band * rowsPerBand;
+                    CLAHE_TRACE_SPAN("band", bandBegin / rowsPerBand);
+                    interpolateRows(input, output, tables, *plan, bandBegin, std::min(bandBegin + rowsPerBand, rowEnd),
+                                    histogram);
+                }
+            });
+        }
+
+        if (collectStatistics)
+        {
+            for (auto worker = 0u; worker < pool->size(); ++worker)
+            {
+                for (auto i = 0u; i < 256; ++i)
+                {
+                    statistics->inputHistogram.histogram[i] += inputHistograms[worker][i];
+                    statistics->outputHistogram.histogram[i] += outputHistograms[worker][i];
+                }
+            }
+            summarizeClaheStatistics(*statistics);
+        }
+    }
+    catch (...)
+    {
+        // Allocation of the output or the tables failed, or the mapping threw
+        // on a worker and the pool rethrew it here
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * file: parallel.hpp
+ * purpose: Declaration of a multi-threaded CLAHE engine which can partition
+ *          the work of very large images across NUMA nodes.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "clahe.hpp"
+#include "threadpool.hpp"
+
+struct InterpolationPlan;
+struct TileLookupTables;
+
+/*
+ * Runs the CLAHE algorithm with a persistent pool of worker threads, the
+ * output is identical to clahe().
+ *
+ * In NUMA aware mode the image is split into one horizontal region per node
+ * and each node's workers are pinned to that node's processors. Workers only
+ * build the tiles and write the output rows of their own node's region, so
+ * the pages of a freshly allocated output are first touched on the node which
+ * uses them. Every node also gets its own copy of the lookup tables, created
+ * by one of its workers. On a single-node machine the mode behaves like the
+ * plain multi-threaded one.
+ */
+class ParallelClahe
+{
+public:
+    /*
+     * _threadCount- The number of worker threads, 0 uses every processor
+     *               available to the process.
+     * _numaAware- Whether to partition the work by NUMA node.
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     * _bandHeight- The number of output rows a worker claims at a time when
+     *              interpolating, see autotune.hpp for picking one.
+     */
+    explicit ParallelClahe(unsigned int _threadCount = 0,
+                           bool _numaAware = false,
+                           GrayLevelMappingFunction _mapping = nullptr,
+                           double _clipLimit = 40.0,
+                           unsigned int _bandHeight = 32);
+
+    ~ParallelClahe();
+
+    ParallelClahe(ParallelClahe const &) = delete;
+    ParallelClahe & operator=(ParallelClahe const &) = delete;
+
+    /*
+     * Equalizes a grayscale image, returns 0 on success and -1 on failure.
+     * Only one thread may call apply() on an engine at a time.
+     */
+    [[nodiscard]] int apply(cv::Mat const & input, cv::Mat & output) noexcept;
+
+    [[nodiscard]] int apply(cv::Mat const & input,
+                            cv::Mat & output,
+                            ClaheStatistics & statistics) noexcept;
+
+    unsigned int threadCount() const noexcept;
+
+    unsigned int nodeCount() const noexcept;
+
+    unsigned int bandHeight() const noexcept;
+
+private:
+    struct NodePartition
+    {
+        unsigned int firstWorker;
+        unsigned int workerCount;
+    };
+
+    int equalize(cv::Mat const & input, cv::Mat & output, ClaheStatistics * statistics) noexcept;
+
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    unsigned int const rowsPerBand;
+    // Contiguous ranges of workers, one per node (a single one when not NUMA aware)
+    std::vector<NodePartition> nodes;
+    std::unique_ptr<ThreadPool> pool;
+    // Scratch kept between images of the same size so streaming does not allocate
+    std::unique_ptr<TileLookupTables> lookupTables;
+    std::unique_ptr<InterpolationPlan> plan;
+    // Each node's copy of the lookup tables, reused between images
+    std::vector<std::unique_ptr<TileLookupTables>> nodeLookupTables;
+};
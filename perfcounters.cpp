@@ -0,0 +1,191 @@
+/*
+ * file: perfcounters.cpp
+ * purpose: Implementation of the hardware performance counter wrapper.
+ */
+
+#include <cstring>
+#include "perfcounters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Opens a counter of one event for the calling thread, disabled, -1 if the
+ * kernel or the container does not allow it.
+ */
+static int openCounter(PerformanceEvent event);
+#endif
+
+PerformanceSample::PerformanceSample()
+  : seconds(0.0),
+    counts{},
+    available{}
+{
+    // Empty
+}
+
+PerformanceSample & PerformanceSample::operator+=(PerformanceSample const & other)
+{
+    seconds += other.seconds;
+    for (auto i = 0u; i < counts.size(); ++i)
+    {
+        counts[i] += other.counts[i];
+        available[i] = available[i] && other.available[i];
+    }
+    return *this;
+}
+
+PerformanceCounters::PerformanceCounters()
+{
+    descriptors.fill(-1);
+#ifdef __linux__
+    for (auto event = 0u; event < PERFORMANCE_EVENT_COUNT; ++event)
+    {
+        descriptors[event] = openCounter(static_cast<PerformanceEvent>(event));
+    }
+#endif
+}
+
+PerformanceCounters::~PerformanceCounters()
+{
+#ifdef __linux__
+    for (auto descriptor : descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+    }
+#endif
+}
+
+bool PerformanceCounters::isAvailable(PerformanceEvent event) const noexcept
+{
+    return event < PERFORMANCE_EVENT_COUNT && descriptors[event] >= 0;
+}
+
+bool PerformanceCounters::anyAvailable() const noexcept
+{
+    for (auto descriptor : descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerformanceCounters::start() noexcept
+{
+#ifdef __linux__
+    for (auto descriptor : descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    startTime = std::chrono::steady_clock::now();
+}
+
+PerformanceSample PerformanceCounters::stop() noexcept
+{
+    auto const stopTime = std::chrono::steady_clock::now();
+
+    PerformanceSample sample;
+    sample.seconds = std::chrono::duration<double>(stopTime - startTime).count();
+#ifdef __linux__
+    for (auto event = 0u; event < PERFORMANCE_EVENT_COUNT; ++event)
+    {
+        auto const descriptor = descriptors[event];
+        if (descriptor < 0)
+        {
+            continue;
+        }
+        ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+
+        // Value, time enabled, time running
+        uint64_t values[3];
+        if (read(descriptor, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[2] == 0)
+        {
+            continue;
+        }
+        // A multiplexed counter only ran for part of the time it was enabled
+        sample.counts[event] = (values[2] < values[1])
+                                   ? static_cast<unsigned long long>(static_cast<double>(values[0]) * values[1] / values[2])
+                                   : values[0];
+        sample.available[event] = true;
+    }
+#endif
+    return sample;
+}
+
+std::string getPerformanceEventName(PerformanceEvent event)
+{
+    switch (event)
+    {
+        case CYCLES_EVENT:
+            return "cycles";
+        case INSTRUCTIONS_EVENT:
+            return "instructions";
+        case L1_DATA_MISSES_EVENT:
+            return "L1D misses";
+        case LAST_LEVEL_CACHE_MISSES_EVENT:
+            return "LLC misses";
+        case BRANCH_MISSES_EVENT:
+            return "branch misses";
+        default:
+            return "unknown";
+    }
+}
+
+#ifdef __linux__
+static int openCounter(PerformanceEvent event)
+{
+    perf_event_attr attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.disabled = 1;
+    // User space only, which is allowed at the default perf_event_paranoid level
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (event)
+    {
+        case CYCLES_EVENT:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS_EVENT:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case L1_DATA_MISSES_EVENT:
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case LAST_LEVEL_CACHE_MISSES_EVENT:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case BRANCH_MISSES_EVENT:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default:
+            return -1;
+    }
+
+    // The calling thread on any processor, no group
+    auto const descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    return (descriptor < 0) ? -1 : static_cast<int>(descriptor);
+}
+#endif
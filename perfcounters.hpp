@@ -0,0 +1,80 @@
+/*
+ * file: perfcounters.hpp
+ * purpose: Declaration of a small wrapper around the Linux hardware
+ *          performance counters for attributing the time of a benchmark phase.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <string>
+
+enum PerformanceEvent : uint8_t
+{
+    CYCLES_EVENT = 0,
+    INSTRUCTIONS_EVENT = 1,
+    L1_DATA_MISSES_EVENT = 2,
+    LAST_LEVEL_CACHE_MISSES_EVENT = 3,
+    BRANCH_MISSES_EVENT = 4,
+    PERFORMANCE_EVENT_COUNT = 5,
+};
+
+struct PerformanceSample
+{
+    double seconds;
+    // Indexed by PerformanceEvent, only meaningful where available is set
+    std::array<unsigned long long, PERFORMANCE_EVENT_COUNT> counts;
+    std::array<bool, PERFORMANCE_EVENT_COUNT> available;
+
+    PerformanceSample();
+
+    /*
+     * Adds another sample's time and counts, an event stays available only if
+     * it is in both.
+     */
+    PerformanceSample & operator+=(PerformanceSample const & other);
+};
+
+/*
+ * Counts hardware events in user space on the calling thread between start()
+ * and stop():
+ *
+ *     PerformanceCounters counters;
+ *     counters.start();
+ *     clahe(input, output);
+ *     auto const sample = counters.stop();
+ *
+ * Every event is opened on its own, so a machine or container which lacks
+ * some of them, or refuses perf_event_open altogether, still measures the
+ * rest and always the wall-clock time. Counts are scaled up if the kernel had
+ * to multiplex the counters.
+ */
+class PerformanceCounters
+{
+public:
+    PerformanceCounters();
+
+    ~PerformanceCounters();
+
+    PerformanceCounters(PerformanceCounters const &) = delete;
+    PerformanceCounters & operator=(PerformanceCounters const &) = delete;
+
+    bool isAvailable(PerformanceEvent event) const noexcept;
+
+    /*
+     * Whether any of the hardware events could be opened.
+     */
+    bool anyAvailable() const noexcept;
+
+    void start() noexcept;
+
+    PerformanceSample stop() noexcept;
+
+private:
+    // -1 for events which could not be opened
+    std::array<int, PERFORMANCE_EVENT_COUNT> descriptors;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+std::string getPerformanceEventName(PerformanceEvent event);
@@ -0,0 +1,351 @@
+/*
+ * file: perfgate.cpp
+ * purpose: Implementation of the performance baseline file and comparisons.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include "perfgate.hpp"
+#include "utility.hpp"
+
+/*
+ * Just enough of JSON to read a baseline back after it has been reformatted
+ * or edited by hand: objects, arrays, strings, numbers and literals.
+ */
+struct JsonValue
+{
+    enum Type : uint8_t
+    {
+        NULL_VALUE = 0,
+        BOOLEAN_VALUE = 1,
+        NUMBER_VALUE = 2,
+        STRING_VALUE = 3,
+        ARRAY_VALUE = 4,
+        OBJECT_VALUE = 5,
+    };
+
+    Type type = NULL_VALUE;
+    double number = 0.0;
+    std::string text;
+    std::vector<JsonValue> elements;
+    std::map<std::string, JsonValue> members;
+};
+
+/*
+ * Parses the value at position and moves past it, false on malformed input.
+ */
+static bool parseJsonValue(std::string const & json, size_t & position, JsonValue & value, unsigned int depth);
+
+static bool parseJsonString(std::string const & json, size_t & position, std::string & text);
+
+static void skipJsonWhitespace(std::string const & json, size_t & position);
+
+// Deeper nesting than any baseline has is taken as malformed
+static unsigned int const maximumJsonDepth(16);
+
+[[nodiscard]] int writePerformanceBaseline(std::string const & path,
+                                           std::string const & processor,
+                                           std::vector<KernelSamples> const & kernels) noexcept
+{
+    try
+    {
+        std::ofstream file(path, std::ios::trunc);
+        file << std::fixed << std::setprecision(1);
+        file << "{\n  \"processor\": \"" << escapeJson(processor) << "\",\n  \"kernels\": [";
+        for (auto i = 0u; i < kernels.size(); ++i)
+        {
+            auto const & kernel = kernels[i];
+            file << ((i == 0) ? "\n" : ",\n") << "    {\"workload\": \"" << escapeJson(kernel.workload)
+                 << "\", \"kernel\": \"" << escapeJson(kernel.kernel) << "\", \"microseconds\": [";
+            for (auto j = 0u; j < kernel.microseconds.size(); ++j)
+            {
+                file << ((j == 0) ? "" : ", ") << kernel.microseconds[j];
+            }
+            file << "]}";
+        }
+        file << "\n  ]\n}\n";
+        file.close();
+        return file ? 0 : -1;
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+}
+
+[[nodiscard]] int readPerformanceBaseline(std::string const & path,
+                                          std::string & processor,
+                                          std::vector<KernelSamples> & kernels) noexcept
+{
+    try
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            return -1;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        auto const json = contents.str();
+
+        JsonValue root;
+        size_t position(0);
+        if (!parseJsonValue(json, position, root, 0) || root.type != JsonValue::OBJECT_VALUE)
+        {
+            return -1;
+        }
+
+        auto const processorMember = root.members.find("processor");
+        processor = (processorMember != root.members.end()) ? processorMember->second.text : std::string();
+
+        auto const kernelsMember = root.members.find("kernels");
+        if (kernelsMember == root.members.end() || kernelsMember->second.type != JsonValue::ARRAY_VALUE)
+        {
+            return -1;
+        }
+
+        kernels.clear();
+        for (auto const & entry : kernelsMember->second.elements)
+        {
+            auto const workload = entry.members.find("workload");
+            auto const kernel = entry.members.find("kernel");
+            auto const microseconds = entry.members.find("microseconds");
+            if (entry.type != JsonValue::OBJECT_VALUE || workload == entry.members.end() ||
+                kernel == entry.members.end() || microseconds == entry.members.end() ||
+                microseconds->second.type != JsonValue::ARRAY_VALUE)
+            {
+                return -1;
+            }
+
+            KernelSamples samples{workload->second.text, kernel->second.text, {}};
+            for (auto const & sample : microseconds->second.elements)
+            {
+                if (sample.type != JsonValue::NUMBER_VALUE)
+                {
+                    return -1;
+                }
+                samples.microseconds.push_back(sample.number);
+            }
+            kernels.push_back(std::move(samples));
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+KernelComparison compareKernelSamples(std::vector<double> const & baseline,
+                                      std::vector<double> const & current,
+                                      double threshold,
+                                      double significance)
+{
+    KernelComparison comparison{getMedian(baseline), getMedian(current), 0.0, 1.0, false};
+    if (baseline.empty() || current.empty() || comparison.baselineMedian <= 0.0)
+    {
+        return comparison;
+    }
+    comparison.change = comparison.currentMedian / comparison.baselineMedian - 1.0;
+
+    // Rank all of the samples together, ties sharing the mean of their ranks
+    std::vector<std::pair<double, bool>> pooled;
+    for (auto sample : baseline)
+    {
+        pooled.emplace_back(sample, false);
+    }
+    for (auto sample : current)
+    {
+        pooled.emplace_back(sample, true);
+    }
+    std::sort(pooled.begin(), pooled.end());
+
+    double currentRankSum(0.0), tieCorrection(0.0);
+    for (size_t first = 0; first < pooled.size();)
+    {
+        auto last = first;
+        while (last + 1 < pooled.size() && pooled[last + 1].first == pooled[first].first)
+        {
+            ++last;
+        }
+        auto const rank = (first + last) / 2.0 + 1.0;
+        for (auto i = first; i <= last; ++i)
+        {
+            currentRankSum += pooled[i].second ? rank : 0.0;
+        }
+        auto const tied = static_cast<double>(last - first + 1);
+        tieCorrection += tied * tied * tied - tied;
+        first = last + 1;
+    }
+
+    // Normal approximation of U with a continuity correction, fine from
+    // about ten samples on each side
+    auto const n1 = static_cast<double>(current.size()), n2 = static_cast<double>(baseline.size());
+    auto const u = currentRankSum - n1 * (n1 + 1.0) / 2.0;
+    auto const mean = n1 * n2 / 2.0;
+    auto const n = n1 + n2;
+    auto const variance = n1 * n2 / 12.0 * ((n + 1.0) - tieCorrection / (n * (n - 1.0)));
+    if (variance > 0.0)
+    {
+        auto const z = (u - mean - 0.5) / std::sqrt(variance);
+        comparison.pValue = 0.5 * std::erfc(z / std::sqrt(2.0));
+    }
+
+    comparison.regressed = comparison.change > threshold && comparison.pValue < significance;
+    return comparison;
+}
+
+double getMedian(std::vector<double> samples)
+{
+    if (samples.empty())
+    {
+        return 0.0;
+    }
+
+    auto const middle = samples.begin() + samples.size() / 2;
+    std::nth_element(samples.begin(), middle, samples.end());
+    if (samples.size() % 2 != 0)
+    {
+        return *middle;
+    }
+    return (*middle + *std::max_element(samples.begin(), middle)) / 2.0;
+}
+
+static bool parseJsonValue(std::string const & json, size_t & position, JsonValue & value, unsigned int depth)
+{
+    skipJsonWhitespace(json, position);
+    if (position >= json.size() || depth > maximumJsonDepth)
+    {
+        return false;
+    }
+
+    auto const character = json[position];
+    if (character == '{')
+    {
+        value.type = JsonValue::OBJECT_VALUE;
+        ++position;
+        skipJsonWhitespace(json, position);
+        if (position < json.size() && json[position] == '}')
+        {
+            ++position;
+            return true;
+        }
+        while (true)
+        {
+            std::string key;
+            skipJsonWhitespace(json, position);
+            if (!parseJsonString(json, position, key))
+            {
+                return false;
+            }
+            skipJsonWhitespace(json, position);
+            if (position >= json.size() || json[position++] != ':' ||
+                !parseJsonValue(json, position, value.members[key], depth + 1))
+            {
+                return false;
+            }
+            skipJsonWhitespace(json, position);
+            if (position < json.size() && json[position] == ',')
+            {
+                ++position;
+                continue;
+            }
+            return position < json.size() && json[position++] == '}';
+        }
+    }
+    if (character == '[')
+    {
+        value.type = JsonValue::ARRAY_VALUE;
+        ++position;
+        skipJsonWhitespace(json, position);
+        if (position < json.size() && json[position] == ']')
+        {
+            ++position;
+            return true;
+        }
+        while (true)
+        {
+            value.elements.emplace_back();
+            if (!parseJsonValue(json, position, value.elements.back(), depth + 1))
+            {
+                return false;
+            }
+            skipJsonWhitespace(json, position);
+            if (position < json.size() && json[position] == ',')
+            {
+                ++position;
+                continue;
+            }
+            return position < json.size() && json[position++] == ']';
+        }
+    }
+    if (character == '"')
+    {
+        value.type = JsonValue::STRING_VALUE;
+        return parseJsonString(json, position, value.text);
+    }
+    for (auto const * literal : {"true", "false", "null"})
+    {
+        if (json.compare(position, std::strlen(literal), literal) == 0)
+        {
+            value.type = (literal[0] == 'n') ? JsonValue::NULL_VALUE : JsonValue::BOOLEAN_VALUE;
+            value.number = (literal[0] == 't') ? 1.0 : 0.0;
+            position += std::strlen(literal);
+            return true;
+        }
+    }
+
+    char * end(nullptr);
+    value.type = JsonValue::NUMBER_VALUE;
+    value.number = std::strtod(json.c_str() + position, &end);
+    if (end == json.c_str() + position)
+    {
+        return false;
+    }
+    position = static_cast<size_t>(end - json.c_str());
+    return true;
+}
+
+static bool parseJsonString(std::string const & json, size_t & position, std::string & text)
+{
+    if (position >= json.size() || json[position] != '"')
+    {
+        return false;
+    }
+
+    text.clear();
+    for (++position; position < json.size(); ++position)
+    {
+        auto character = json[position];
+        if (character == '"')
+        {
+            ++position;
+            return true;
+        }
+        if (character == '\\' && position + 1 < json.size())
+        {
+            // Only the escapes a baseline can contain are decoded, others keep their letter
+            character = json[++position];
+            character = (character == 'n') ? '\n' : (character == 't') ? '\t' : character;
+        }
+        text += character;
+    }
+    return false;
+}
+
+static void skipJsonWhitespace(std::string const & json, size_t & position)
+{
+    while (position < json.size() && std::isspace(static_cast<unsigned char>(json[position])))
+    {
+        ++position;
+    }
+}
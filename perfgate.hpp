@@ -0,0 +1,74 @@
+/*
+ * file: perfgate.hpp
+ * purpose: Declaration of the baseline file and the statistics behind the
+ *          benchmark's performance regression gate.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ * Repeated timings of one kernel (a phase of the algorithm) on one workload.
+ */
+struct KernelSamples
+{
+    // i.e. "1920x1080 clip 40"
+    std::string workload;
+    // i.e. "interpolation"
+    std::string kernel;
+    std::vector<double> microseconds;
+};
+
+struct KernelComparison
+{
+    double baselineMedian;
+    double currentMedian;
+    // currentMedian / baselineMedian - 1, positive when slower
+    double change;
+    // Probability of samples at least this much slower if nothing had changed
+    double pValue;
+    bool regressed;
+};
+
+/*
+ * Writes the samples as a JSON baseline:
+ *
+ *     {
+ *       "processor": "...",
+ *       "kernels": [
+ *         {"workload": "1920x1080 clip 40", "kernel": "interpolation", "microseconds": [...]},
+ *         ...
+ *       ]
+ *     }
+ *
+ * Returns 0 on success and -1 if the file cannot be written.
+ */
+[[nodiscard]] int writePerformanceBaseline(std::string const & path,
+                                           std::string const & processor,
+                                           std::vector<KernelSamples> const & kernels) noexcept;
+
+/*
+ * Reads a baseline written by writePerformanceBaseline(), which may since have
+ * been reformatted. Returns 0 on success and -1 if the file is missing or not
+ * a baseline.
+ */
+[[nodiscard]] int readPerformanceBaseline(std::string const & path,
+                                          std::string & processor,
+                                          std::vector<KernelSamples> & kernels) noexcept;
+
+/*
+ * Compares the current samples of a kernel with its baseline samples. The
+ * kernel has regressed when its median is more than threshold (a fraction)
+ * slower and a one-sided Mann-Whitney U test finds the current samples slower
+ * with a p-value below significance. The rank test needs no assumption about
+ * the distribution of the timings and is not swayed by a few outliers, i.e. a
+ * sample interrupted by another process.
+ */
+KernelComparison compareKernelSamples(std::vector<double> const & baseline,
+                                      std::vector<double> const & current,
+                                      double threshold,
+                                      double significance);
+
+double getMedian(std::vector<double> samples);
@@ -0,0 +1,172 @@
+/*
+ * file: pipelined.cpp
+ * purpose: Implementation of the frame pipelined video CLAHE engine.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include "opencv2/opencv.hpp"
+#include "pipelined.hpp"
+#include "tiles.hpp"
+#include "trace.hpp"
+
+// Data on the tiles the image will be split into
+static unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+PipelinedClahe::PipelinedClahe(unsigned int _threadCount /* = 0 */,
+                               GrayLevelMappingFunction _mapping /* = nullptr */,
+                               double _clipLimit /* = 40.0 */,
+                               unsigned int _bandHeight /* = 32 */)
+  : mapping(std::move(_mapping)),
+    clipLimit(_clipLimit),
+    rowsPerBand(std::max(_bandHeight, 1u)),
+    pool(std::max((_threadCount > 0) ? _threadCount : std::thread::hardware_concurrency(), 1u)),
+    workerHistograms(pool.size())
+{
+    // Empty
+}
+
+PipelinedClahe::~PipelinedClahe() = default;
+
+[[nodiscard]] int PipelinedClahe::push(cv::Mat const & input, cv::Mat & output) noexcept
+{
+    if (!isValidClaheInput(input, tilesHorizontal, tilesVertical))
+    {
+        return -1;
+    }
+
+    try
+    {
+        if (!nextTables || nextTables->grid.columns != static_cast<unsigned int>(input.cols) ||
+            nextTables->grid.rows != static_cast<unsigned int>(input.rows))
+        {
+            nextTables = std::make_unique<TileLookupTables>(
+                TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+        }
+
+        if (heldInput.empty())
+        {
+            sweep(nullptr, &input);
+            output.release();
+        }
+        else if (heldInput.size() == input.size())
+        {
+            output.create(heldInput.size(), CV_8UC1);
+            sweep(&output, &input);
+        }
+        else
+        {
+            // Rows of different frames no longer line up, so the two are not fused
+            output.create(heldInput.size(), CV_8UC1);
+            sweep(&output, nullptr);
+            sweep(nullptr, &input);
+        }
+        holdFrame(input);
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+[[nodiscard]] int PipelinedClahe::finish(cv::Mat & output) noexcept
+{
+    if (heldInput.empty())
+    {
+        output.release();
+        return 0;
+    }
+
+    try
+    {
+        output.create(heldInput.size(), CV_8UC1);
+        sweep(&output, nullptr);
+        heldInput.release();
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+unsigned int PipelinedClahe::threadCount() const noexcept
+{
+    return pool.size();
+}
+
+void PipelinedClahe::sweep(cv::Mat * output, cv::Mat const * input)
+{
+    auto const outputRows = (nullptr != output) ? static_cast<unsigned int>(heldInput.rows) : 0u;
+    auto const inputRows = (nullptr != input) ? static_cast<unsigned int>(input->rows) : 0u;
+    auto const bandCount = (std::max(outputRows, inputRows) + rowsPerBand - 1) / rowsPerBand;
+
+    if (nullptr != input)
+    {
+        for (auto & histograms : workerHistograms)
+        {
+            histograms.assign(tilesHorizontal * tilesVertical, ImageHistogram());
+        }
+    }
+
+    // Each band of the held frame's output is followed by the same band of the
+    // new frame's histograms, on the same worker
+    std::atomic<unsigned int> nextBand(0);
+    pool.runOnAllWorkers([&](unsigned int worker) {
+        for (auto band = nextBand++; band < bandCount; band = nextBand++)
+        {
+            auto const bandBegin = band * rowsPerBand;
+            CLAHE_TRACE_SPAN("band", band);
+            if (bandBegin < outputRows)
+            {
+                interpolateRows(heldInput, *output, *heldTables, *plan, bandBegin,
+                                std::min(bandBegin + rowsPerBand, outputRows), nullptr);
+            }
+            if (bandBegin < inputRows)
+            {
+                countTileHistograms(*input, nextTables->grid, bandBegin, std::min(bandBegin + rowsPerBand, inputRows),
+                                    workerHistograms[worker]);
+            }
+        }
+    });
+
+    if (nullptr == input)
+    {
+        return;
+    }
+
+    // Merge the workers' counts and build the new frame's tables, one tile at a time
+    std::atomic<unsigned int> nextTile(0);
+    pool.runOnAllWorkers([&](unsigned int) {
+        for (auto tile = nextTile++; tile < tilesHorizontal * tilesVertical; tile = nextTile++)
+        {
+            CLAHE_TRACE_SPAN("tile", tile);
+            ImageHistogram histogram;
+            for (auto const & histograms : workerHistograms)
+            {
+                for (auto i = 0u; i < histogram.histogram.size(); ++i)
+                {
+                    histogram.histogram[i] += histograms[tile].histogram[i];
+                }
+            }
+            generateTileLookupTable(histogram, tile % tilesHorizontal, tile / tilesHorizontal, mapping, clipLimit,
+                                    *nextTables);
+        }
+    });
+    selectRegionKernels(*nextTables);
+}
+
+void PipelinedClahe::holdFrame(cv::Mat const & input)
+{
+    if (!plan || !heldTables || heldTables->grid.columns != nextTables->grid.columns ||
+        heldTables->grid.rows != nextTables->grid.rows)
+    {
+        plan = std::make_unique<InterpolationPlan>(nextTables->grid);
+    }
+
+    std::swap(heldTables, nextTables);
+    heldInput = input;
+}
@@ -0,0 +1,101 @@
+/*
+ * file: pipelined.hpp
+ * purpose: Declaration of a video CLAHE engine which overlaps the histograms
+ *          of each frame with the output of the frame before it, at the cost
+ *          of one frame of latency.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+#include "threadpool.hpp"
+
+struct InterpolationPlan;
+struct TileLookupTables;
+
+/*
+ * Equalizes a stream of frames with a single sweep over the rows per frame
+ * instead of the two phases of clahe().
+ *
+ * A pushed frame is only histogrammed; its output is produced by the next
+ * push, whose sweep interpolates the held frame band by band while counting
+ * the histograms of the new frame's same rows on the same workers. There is no
+ * barrier between building the tables and interpolating within a frame, so
+ * the compute-bound histogramming and the bandwidth-bound interpolation run
+ * side by side instead of one after the other. Every frame's output is the
+ * same as clahe() on it, one push later:
+ *
+ *     push(frame 0) -> no output
+ *     push(frame 1) -> output of frame 0
+ *     ...
+ *     finish()      -> output of the last frame
+ *
+ * The input buffers are referenced rather than copied, so a frame must not be
+ * written to until the push which returns its output, and an output must not
+ * share its buffer with either input. Frames may change size, at the cost of
+ * one unfused sweep. Only one thread may use an engine at a time.
+ */
+class PipelinedClahe
+{
+public:
+    /*
+     * _threadCount- The number of worker threads, 0 uses every processor.
+     * _mapping- The gray level mapping, nullptr selects the default mapping.
+     * _clipLimit- The limit for a single bin of the histogram.
+     * _bandHeight- The number of rows a worker claims at a time.
+     */
+    explicit PipelinedClahe(unsigned int _threadCount = 0,
+                            GrayLevelMappingFunction _mapping = nullptr,
+                            double _clipLimit = 40.0,
+                            unsigned int _bandHeight = 32);
+
+    ~PipelinedClahe();
+
+    PipelinedClahe(PipelinedClahe const &) = delete;
+    PipelinedClahe & operator=(PipelinedClahe const &) = delete;
+
+    /*
+     * Takes the next grayscale frame, output receives the equalized previous
+     * frame, or is released if there was none. Returns 0 on success and -1 on
+     * failure, in which case the held frame is kept.
+     */
+    [[nodiscard]] int push(cv::Mat const & input, cv::Mat & output) noexcept;
+
+    /*
+     * Ends the stream, output receives the equalized last frame, or is
+     * released if there was none.
+     */
+    [[nodiscard]] int finish(cv::Mat & output) noexcept;
+
+    unsigned int threadCount() const noexcept;
+
+private:
+    /*
+     * One pass over the rows in bands: interpolates the held frame into output
+     * unless output is nullptr, and counts the tile histograms of input into
+     * the next tables unless input is nullptr.
+     */
+    void sweep(cv::Mat * output, cv::Mat const * input);
+
+    /*
+     * Makes the frame whose tables were just built the held one.
+     */
+    void holdFrame(cv::Mat const & input);
+
+    GrayLevelMappingFunction mapping;
+    double const clipLimit;
+    unsigned int const rowsPerBand;
+    ThreadPool pool;
+
+    // The frame whose output the next call produces, and its tables
+    cv::Mat heldInput;
+    std::unique_ptr<TileLookupTables> heldTables;
+    std::unique_ptr<InterpolationPlan> plan;
+    // Being built for the frame just pushed, swapped with the held ones after
+    std::unique_ptr<TileLookupTables> nextTables;
+    // Row-major per worker, the part of every tile histogram a worker counted
+    std::vector<std::vector<ImageHistogram>> workerHistograms;
+};
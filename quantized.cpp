@@ -0,0 +1,270 @@
+/*
+ * file: quantized.cpp
+ * purpose: Implementation of the quantized weight approximate CLAHE mode.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "quantized.hpp"
+#include "tiles.hpp"
+
+// The tabulated blends hold gray levels with 8 fractional bits
+static unsigned int const fractionBits(8);
+// The vertical weight has 15 fractional bits, so the blend fits in 32 bits
+static unsigned int const rowWeightBits(15);
+// Bound on the error of the fixed point arithmetic itself, in gray levels
+static double const arithmeticError(1.0 / 32);
+static unsigned int const maximumWeightLevels(256);
+
+static int equalize(cv::Mat const & input,
+                    cv::Mat & output,
+                    GrayLevelMappingFunction const & mapping,
+                    unsigned int maxError,
+                    double clipLimit,
+                    unsigned int * weightLevels) noexcept;
+
+/*
+ * The fewest weight levels for which rounding a column's weight moves no
+ * blend between horizontally neighboring tables by more than maxError.
+ */
+static unsigned int getWeightLevels(TileLookupTables const & tables, unsigned int maxError);
+
+/*
+ * Row-major by tile row and horizontal region, then by level, the fixed point
+ * blend of the region's left and right tables at every weight level.
+ */
+static std::vector<uint16_t> tabulateBlends(TileLookupTables const & tables, unsigned int weightLevels);
+
+static void produceQuantizedRow(uint8_t const * inputRow,
+                                uint8_t * outputRow,
+                                TileLookupTables const & tables,
+                                InterpolationPlan const & plan,
+                                unsigned int regionY,
+                                std::vector<uint16_t> const & blends,
+                                unsigned int weightLevels,
+                                uint16_t const * columnOffsets,
+                                int rowWeight);
+
+[[nodiscard]] int claheQuantized(cv::Mat const & input,
+                                 cv::Mat & output,
+                                 unsigned int maxError /* = 2 */,
+                                 double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, nullptr, maxError, clipLimit, nullptr);
+}
+
+[[nodiscard]] int claheQuantized(cv::Mat const & input,
+                                 cv::Mat & output,
+                                 GrayLevelMappingFunction mapping,
+                                 unsigned int maxError /* = 2 */,
+                                 double clipLimit /* = 40.0 */) noexcept
+{
+    return equalize(input, output, mapping, maxError, clipLimit, nullptr);
+}
+
+[[nodiscard]] int measureQuantizationError(cv::Mat const & input,
+                                           unsigned int maxError,
+                                           double clipLimit,
+                                           QuantizationReport & report) noexcept
+{
+    report = QuantizationReport();
+
+    cv::Mat approximate, exact;
+    if (equalize(input, approximate, nullptr, maxError, clipLimit, &report.weightLevels) != 0 ||
+        clahe(input, exact, clipLimit) != 0)
+    {
+        return -1;
+    }
+
+    unsigned long long totalError(0);
+    for (auto rowIdx = 0; rowIdx < input.rows; ++rowIdx)
+    {
+        auto const approximateRow = approximate.ptr<uint8_t>(rowIdx);
+        auto const exactRow = exact.ptr<uint8_t>(rowIdx);
+        for (auto colIdx = 0; colIdx < input.cols; ++colIdx)
+        {
+            auto const error = static_cast<unsigned int>(std::abs(approximateRow[colIdx] - exactRow[colIdx]));
+            report.maxError = std::max(report.maxError, error);
+            totalError += error;
+        }
+    }
+    report.meanError = static_cast<double>(totalError) / (static_cast<double>(input.rows) * input.cols);
+
+    return 0;
+}
+
+static int equalize(cv::Mat const & input,
+                    cv::Mat & output,
+                    GrayLevelMappingFunction const & mapping,
+                    unsigned int maxError,
+                    double clipLimit,
+                    unsigned int * weightLevels) noexcept
+{
+    // Data on the tiles the image will be split into
+    unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+    if (maxError == 0 || !isValidClaheInput(input, tilesHorizontal, tilesVertical))
+    {
+        return -1;
+    }
+
+    try
+    {
+        output.create(input.size(), input.type());
+
+        TileLookupTables tables(TileGrid(tilesHorizontal, tilesVertical, input.cols, input.rows));
+        for (auto tileY = 0u; tileY < tilesVertical; ++tileY)
+        {
+            for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+            {
+                generateTileLookupTable(input, tileX, tileY, mapping, clipLimit, tables, nullptr);
+            }
+        }
+        selectRegionKernels(tables);
+
+        InterpolationPlan const plan(tables.grid);
+        auto const levels = getWeightLevels(tables, maxError);
+        auto const blends = tabulateBlends(tables, levels);
+
+        // Where each column's rounded weight starts within its region's blends
+        std::vector<uint16_t> columnOffsets(tables.grid.columns);
+        for (auto colIdx = 0u; colIdx < tables.grid.columns; ++colIdx)
+        {
+            columnOffsets[colIdx] =
+                static_cast<uint16_t>(std::lround(plan.columnWeights[colIdx] * (levels - 1)) * 256);
+        }
+
+        for (auto regionY = 0u; regionY < plan.verticalSpans.size(); ++regionY)
+        {
+            auto const & verticalSpan = plan.verticalSpans[regionY];
+            for (auto rowIdx = verticalSpan.begin; rowIdx < verticalSpan.end; ++rowIdx)
+            {
+                auto const rowWeight = static_cast<int>(std::lround(plan.rowWeights[rowIdx] * (1 << rowWeightBits)));
+                produceQuantizedRow(input.ptr<uint8_t>(rowIdx), output.ptr<uint8_t>(rowIdx), tables, plan, regionY,
+                                    blends, levels, columnOffsets.data(), rowWeight);
+            }
+        }
+
+        if (nullptr != weightLevels)
+        {
+            *weightLevels = levels;
+        }
+    }
+    catch (std::exception const &)
+    {
+        // Allocation of the output or the tables failed
+        return -1;
+    }
+
+    return 0;
+}
+
+static unsigned int getWeightLevels(TileLookupTables const & tables, unsigned int maxError)
+{
+    auto const & grid = tables.grid;
+
+    int largestDifference(0);
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        for (auto tileX = 0u; tileX + 1 < grid.tilesHorizontal; ++tileX)
+        {
+            auto const & left = tables.at(tileX, tileY);
+            auto const & right = tables.at(tileX + 1, tileY);
+            for (auto i = 0u; i < left.size(); ++i)
+            {
+                largestDifference = std::max(largestDifference, std::abs(right[i] - left[i]));
+            }
+        }
+    }
+
+    // Rounding moves a weight by at most half a step, and a blend by that much
+    // of the difference between its tables. The output truncates like clahe(),
+    // so a blend off by less than maxError is off by at most maxError after it.
+    auto const steps = std::ceil(largestDifference / (2.0 * (maxError - arithmeticError)));
+    return std::min(std::max(static_cast<unsigned int>(steps), 1u) + 1, maximumWeightLevels);
+}
+
+static std::vector<uint16_t> tabulateBlends(TileLookupTables const & tables, unsigned int weightLevels)
+{
+    auto const & grid = tables.grid;
+    auto const regionsHorizontal = grid.tilesHorizontal + 1;
+
+    std::vector<uint16_t> blends(static_cast<size_t>(grid.tilesVertical) * regionsHorizontal * weightLevels * 256);
+    auto blend = blends.begin();
+    for (auto tileY = 0u; tileY < grid.tilesVertical; ++tileY)
+    {
+        for (auto regionX = 0u; regionX < regionsHorizontal; ++regionX)
+        {
+            // Regions before the first and after the last center use the closest tile
+            auto const & left = tables.at((regionX == 0) ? 0 : regionX - 1, tileY);
+            auto const & right = tables.at(std::min(regionX, grid.tilesHorizontal - 1), tileY);
+            for (auto level = 0u; level < weightLevels; ++level)
+            {
+                auto const weight = static_cast<float>(level) / (weightLevels - 1);
+                for (auto i = 0u; i < 256; ++i)
+                {
+                    // Blended as in clahe(), so agreeing tables give exact values
+                    float const value = left[i] + (static_cast<float>(right[i]) - left[i]) * weight;
+                    *blend++ = static_cast<uint16_t>(std::lround(value * (1 << fractionBits)));
+                }
+            }
+        }
+    }
+    return blends;
+}
+
+static void produceQuantizedRow(uint8_t const * inputRow,
+                                uint8_t * outputRow,
+                                TileLookupTables const & tables,
+                                InterpolationPlan const & plan,
+                                unsigned int regionY,
+                                std::vector<uint16_t> const & blends,
+                                unsigned int weightLevels,
+                                uint16_t const * columnOffsets,
+                                int rowWeight)
+{
+    auto const & grid = tables.grid;
+    auto const regionsHorizontal = grid.tilesHorizontal + 1;
+    auto const & verticalSpan = plan.verticalSpans[regionY];
+    auto const top(verticalSpan.lowerTile), bottom(verticalSpan.upperTile);
+
+    for (auto regionX = 0u; regionX < plan.horizontalSpans.size(); ++regionX)
+    {
+        auto const & span = plan.horizontalSpans[regionX];
+        auto const & table = tables.at(span.lowerTile, top);
+        switch (tables.regionKernels[regionY * regionsHorizontal + regionX])
+        {
+            case FILL_KERNEL:
+                memset(outputRow + span.begin, table[0], span.end - span.begin);
+                break;
+            case COPY_KERNEL:
+                memcpy(outputRow + span.begin, inputRow + span.begin, span.end - span.begin);
+                break;
+            case SINGLE_TABLE_KERNEL:
+                for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                {
+                    outputRow[colIdx] = table[inputRow[colIdx]];
+                }
+                break;
+            case BLEND_KERNEL:
+            {
+                auto const regionSize = static_cast<size_t>(weightLevels) * 256;
+                auto const topBlends = blends.data() + (top * regionsHorizontal + regionX) * regionSize;
+                auto const bottomBlends = blends.data() + (bottom * regionsHorizontal + regionX) * regionSize;
+                for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                {
+                    auto const index = columnOffsets[colIdx] + inputRow[colIdx];
+                    int const upper = topBlends[index];
+                    int const lower = bottomBlends[index];
+                    outputRow[colIdx] = static_cast<uint8_t>(
+                        (upper + (((lower - upper) * rowWeight) >> rowWeightBits)) >> fractionBits);
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * file: quantized.hpp
+ * purpose: Declaration of an approximate CLAHE mode which quantizes the
+ *          horizontal interpolation weight so that the horizontal blends can
+ *          be tabulated once per tile row, trading a bounded error for speed.
+ */
+
+#pragma once
+
+#include "clahe.hpp"
+
+struct QuantizationReport
+{
+    // The number of horizontal weight levels the image was produced with
+    unsigned int weightLevels;
+    // The largest and the mean absolute deviation from clahe()
+    unsigned int maxError;
+    double meanError;
+};
+
+/*
+ * Takes a grayscale image and runs the CLAHE algorithm on it with every
+ * output pixel within maxError gray levels of clahe().
+ *
+ * The horizontal weight of each column is rounded to one of a number of
+ * levels. For every tile row and every pair of horizontally neighboring
+ * tiles, the blend of their tables at each level is tabulated in fixed point,
+ * so a pixel costs two lookups and one integer vertical blend rather than
+ * four lookups and three blends. The fewest levels whose rounding keeps the
+ * deviation within maxError are picked from the largest difference between
+ * neighboring tables, which typically gives 8 to 32 levels. Regions whose
+ * four tables agree use the same exact kernels as clahe().
+ *
+ * input- The matrix holding the input image.
+ * output- The output matrix.
+ * maxError- The largest deviation from clahe() allowed, at least 1.
+ * clipLimit- The limit for a single bin of the histogram.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int claheQuantized(cv::Mat const & input,
+                                 cv::Mat & output,
+                                 unsigned int maxError = 2,
+                                 double clipLimit = 40.0) noexcept;
+
+[[nodiscard]] int claheQuantized(cv::Mat const & input,
+                                 cv::Mat & output,
+                                 GrayLevelMappingFunction mapping,
+                                 unsigned int maxError = 2,
+                                 double clipLimit = 40.0) noexcept;
+
+/*
+ * Runs both claheQuantized() and clahe() on an image and reports how far
+ * apart they are, for checking the mode on representative images.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+[[nodiscard]] int measureQuantizationError(cv::Mat const & input,
+                                           unsigned int maxError,
+                                           double clipLimit,
+                                           QuantizationReport & report) noexcept;
@@ -0,0 +1,679 @@
+/*
+ * file: server.cpp
+ * purpose: Implementation of the long running CLAHE server.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "opencv2/opencv.hpp"
+#include "autotune.hpp"
+#include "server.hpp"
+
+// Each engine owns a thread pool, so only a few clip limits are kept warm
+static unsigned int const maximumEngines(4);
+
+static unsigned int const maximumFrameDimension(1u << 16);
+
+// Socket connections served at once, later ones wait in the listen backlog
+static unsigned int const maximumSessions(64);
+// A connection without a request for this long is closed
+static std::chrono::seconds const sessionIdleTimeout(300);
+// A client which does not read its responses for this long is dropped
+static time_t const sendTimeoutSeconds(5);
+
+// ParallelClahe's band height, for engines without a tuned configuration
+static unsigned int const defaultBandHeight(32);
+
+/*
+ * Reads the optional clip limit at the end of a request, false if a word is
+ * there but is not a usable clip limit.
+ */
+static bool readClipLimit(std::istringstream & arguments, double defaultClipLimit, double & clipLimit);
+
+static long elapsedMicroseconds(std::chrono::steady_clock::time_point start);
+
+#ifdef __linux__
+static bool sendLine(int descriptor, std::string const & line);
+
+/*
+ * Reads what a readable connection sent and answers every complete request
+ * line in it. Returns false once the connection is to be closed, and sets
+ * stopping on SHUTDOWN.
+ */
+static bool serveSessionInput(ClaheServer & server, int descriptor, std::string & pending, bool & stopping);
+
+/*
+ * Installs the process wide bus error handler of the shared frame guards,
+ * once for all servers. Returns whether it is installed.
+ */
+static bool installBusErrorHandler();
+
+/*
+ * Catches the bus errors of accesses to a shared frame while a job runs on
+ * it, which is the client shrinking the object under the job, and ends the
+ * job on zero pages instead of taking the server down. Returns false if the
+ * handler is not installed.
+ */
+static bool guardSharedFrame(uint8_t * data, size_t size);
+
+/*
+ * Removes the guard, returns whether the frame was lost to a bus error.
+ */
+static bool unguardSharedFrame();
+
+static void handleSharedFrameBusError(int signalNumber, siginfo_t * information, void * context);
+
+// Serializes the guarded jobs of all servers, the handler covers one frame
+static std::mutex sharedFrameGuardMutex;
+// The mapping of the guarded frame, read by the handler
+static std::atomic<uint8_t *> guardedFrameBegin(nullptr);
+static std::atomic<uint8_t *> guardedFrameEnd(nullptr);
+static std::atomic<bool> guardedFrameLost(false);
+// The action the handler replaced, bus errors outside the frame go to it
+static struct sigaction previousBusErrorAction;
+#endif
+
+ClaheServer::ClaheServer(unsigned int _threadCount /* = 0 */, double _clipLimit /* = 40.0 */)
+  : threadCount(_threadCount), defaultClipLimit(_clipLimit)
+{
+    // With a thread count given every job uses this engine, so start it now
+    // rather than on the first job, otherwise the frame sizes pick the engines
+    if (threadCount > 0)
+    {
+        engineFor(defaultClipLimit, 0, 0);
+    }
+
+#ifdef __linux__
+    // Swapping the handler in and out around every job would race with other
+    // threads of the process installing their own, so it stays for good
+    (void)installBusErrorHandler();
+#endif
+}
+
+ClaheServer::~ClaheServer()
+{
+    unmapSharedFrames();
+}
+
+RequestOutcome ClaheServer::handleRequest(std::string const & request, std::string & response)
+{
+    std::istringstream arguments(request);
+    std::string command;
+    arguments >> command;
+
+    try
+    {
+        if (command == "FILE")
+        {
+            response = processFile(arguments);
+        }
+        else if (command == "SHM")
+        {
+            response = processSharedFrame(arguments);
+        }
+        else if (command == "PING")
+        {
+            response = "OK";
+        }
+        else if (command == "QUIT")
+        {
+            response = "OK";
+            return END_SESSION;
+        }
+        else if (command == "SHUTDOWN")
+        {
+            response = "OK";
+            return STOP_SERVER;
+        }
+        else
+        {
+            response = "ERROR unknown command";
+        }
+    }
+    catch (std::exception const & exception)
+    {
+        response = std::string("ERROR ") + exception.what();
+    }
+
+    // A reason spanning lines would desynchronize the client
+    std::replace(response.begin(), response.end(), '\n', ' ');
+    return CONTINUE_SESSION;
+}
+
+[[nodiscard]] int ClaheServer::serve(std::istream & input, std::ostream & output) noexcept
+{
+    try
+    {
+        std::string request, response;
+        while (std::getline(input, request))
+        {
+            if (!request.empty() && request.back() == '\r')
+            {
+                request.pop_back();
+            }
+            if (request.empty())
+            {
+                continue;
+            }
+
+            auto const outcome = handleRequest(request, response);
+            output << response << std::endl;
+            if (outcome != CONTINUE_SESSION)
+            {
+                break;
+            }
+        }
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+
+    return output.good() ? 0 : -1;
+}
+
+[[nodiscard]] int ClaheServer::serveSocket(std::string const & socketPath) noexcept
+{
+#ifdef __linux__
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int const listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    // A socket file left behind by a previous server would make bind() fail
+    unlink(socketPath.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    struct Session
+    {
+        int descriptor;
+        // A request line not completely received yet
+        std::string pending;
+        // When the client last sent anything
+        std::chrono::steady_clock::time_point lastActivity;
+    };
+
+    // The connections are polled together, so a client idling between
+    // requests does not hold up the others, and all share the warm engines.
+    // Requests run one at a time, each engine already uses every processor.
+    std::vector<Session> sessions;
+    std::vector<pollfd> descriptors;
+    int retVal(0);
+    bool stopping(false);
+    try
+    {
+        while (!stopping)
+        {
+            // Wake up in time to close the first session running out of idle time
+            auto now = std::chrono::steady_clock::now();
+            int timeout(-1);
+            for (auto const & session : sessions)
+            {
+                auto const remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                           session.lastActivity + sessionIdleTimeout - now)
+                                           .count();
+                auto const sessionTimeout = static_cast<int>(std::max<decltype(remaining)>(remaining, 0));
+                timeout = (timeout < 0) ? sessionTimeout : std::min(timeout, sessionTimeout);
+            }
+
+            descriptors.clear();
+            short const listenerEvents = (sessions.size() < maximumSessions) ? POLLIN : 0;
+            descriptors.push_back({listener, listenerEvents, 0});
+            for (auto const & session : sessions)
+            {
+                descriptors.push_back({session.descriptor, POLLIN, 0});
+            }
+
+            if (poll(descriptors.data(), descriptors.size(), timeout) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                retVal = -1;
+                break;
+            }
+
+            now = std::chrono::steady_clock::now();
+            for (auto sessionIdx = 0u; sessionIdx < sessions.size() && !stopping; ++sessionIdx)
+            {
+                auto & session = sessions[sessionIdx];
+                bool sessionOpen(true);
+                if (descriptors[sessionIdx + 1].revents != 0)
+                {
+                    sessionOpen = serveSessionInput(*this, session.descriptor, session.pending, stopping);
+                    session.lastActivity = now;
+                }
+                else if (now - session.lastActivity >= sessionIdleTimeout)
+                {
+                    sessionOpen = false;
+                }
+
+                if (!sessionOpen)
+                {
+                    close(session.descriptor);
+                    session.descriptor = -1;
+                }
+            }
+            sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                          [](Session const & session) { return session.descriptor < 0; }),
+                           sessions.end());
+
+            if (stopping || (descriptors[0].revents & POLLIN) == 0)
+            {
+                continue;
+            }
+
+            int const connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+                {
+                    continue;
+                }
+                retVal = -1;
+                break;
+            }
+
+            // Responses are sent blocking, a client which stops reading them
+            // must not stall the other sessions for long
+            timeval const sendTimeout{sendTimeoutSeconds, 0};
+            setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+            sessions.push_back({connection, std::string(), now});
+        }
+    }
+    catch (std::exception const &)
+    {
+        // Out of memory for the session list
+        retVal = -1;
+    }
+
+    for (auto const & session : sessions)
+    {
+        close(session.descriptor);
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    return retVal;
+#else
+    (void)socketPath;
+    return -1;
+#endif
+}
+
+ParallelClahe & ClaheServer::engineFor(double clipLimit, unsigned int columns, unsigned int rows)
+{
+    // A given thread count overrides tuning, as does a failed tuning, which
+    // is not retried for every frame of the size
+    TunedConfiguration configuration{threadCount, defaultBandHeight, 0.0};
+    if (threadCount == 0 && columns > 0 && rows > 0)
+    {
+        auto const size = std::make_pair(columns, rows);
+        auto tuned = configurations.find(size);
+        if (tuned == configurations.end())
+        {
+            // The cache answers for sizes tuned before, only new ones are measured
+            TunedConfiguration measured;
+            tuned = configurations
+                        .emplace(size, (autoTune(columns, rows, getDefaultTuningCachePath(), measured) == 0)
+                                           ? measured
+                                           : configuration)
+                        .first;
+        }
+        configuration = tuned->second;
+    }
+
+    auto const key = std::make_tuple(clipLimit, configuration.threadCount, configuration.bandHeight);
+    auto engine = engines.find(key);
+    if (engine != engines.end())
+    {
+        return *engine->second;
+    }
+
+    if (engines.size() >= maximumEngines)
+    {
+        // Keep the engines of the default clip limit where possible
+        auto evicted = std::find_if(engines.begin(), engines.end(), [this](auto const & entry) {
+            return std::get<0>(entry.first) != defaultClipLimit;
+        });
+        engines.erase((evicted != engines.end()) ? evicted : engines.begin());
+    }
+
+    auto inserted = engines.emplace(key, std::make_unique<ParallelClahe>(configuration.threadCount, false, nullptr,
+                                                                         clipLimit, configuration.bandHeight));
+    return *inserted.first->second;
+}
+
+std::string ClaheServer::processFile(std::istringstream & arguments)
+{
+    std::string inputPath, outputPath;
+    double clipLimit;
+    if (!(arguments >> inputPath >> outputPath) || !readClipLimit(arguments, defaultClipLimit, clipLimit))
+    {
+        return "ERROR usage: FILE <input path> <output path> [clip limit]";
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    auto const input = cv::imread(inputPath, cv::IMREAD_GRAYSCALE);
+    if (input.empty())
+    {
+        return "ERROR cannot read " + inputPath;
+    }
+
+    cv::Mat output;
+    if (engineFor(clipLimit, input.cols, input.rows).apply(input, output) != 0)
+    {
+        return "ERROR cannot equalize " + inputPath;
+    }
+
+    if (!cv::imwrite(outputPath, output))
+    {
+        return "ERROR cannot write " + outputPath;
+    }
+
+    return "OK " + outputPath + " " + std::to_string(elapsedMicroseconds(start));
+}
+
+std::string ClaheServer::processSharedFrame(std::istringstream & arguments)
+{
+    std::string name;
+    unsigned int columns, rows;
+    double clipLimit;
+    if (!(arguments >> name >> columns >> rows) || !readClipLimit(arguments, defaultClipLimit, clipLimit) ||
+        columns == 0 || rows == 0 || columns > maximumFrameDimension || rows > maximumFrameDimension)
+    {
+        return "ERROR usage: SHM <shared memory name> <columns> <rows> [clip limit]";
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    auto const frameSize = static_cast<size_t>(columns) * rows;
+    auto const frame = mapSharedFrame(name, 2 * frameSize);
+    if (nullptr == frame)
+    {
+        return "ERROR cannot map " + name + " with at least " + std::to_string(2 * frameSize) + " bytes";
+    }
+
+    // Both frames live in the client's memory, the engine writes the output in place
+    cv::Mat const input(rows, columns, CV_8UC1, frame->data);
+    cv::Mat output(rows, columns, CV_8UC1, frame->data + frameSize);
+    auto & engine = engineFor(clipLimit, columns, rows);
+    int retVal(-1);
+#ifdef __linux__
+    {
+        std::lock_guard<std::mutex> lock(sharedFrameGuardMutex);
+        if (!guardSharedFrame(frame->data, frame->size))
+        {
+            return "ERROR cannot guard " + name;
+        }
+        retVal = engine.apply(input, output);
+        if (unguardSharedFrame())
+        {
+            // The mapping now holds zero pages, the next job maps the object again
+            munmap(frame->data, frame->size);
+            close(frame->descriptor);
+            sharedFrames.erase(name);
+            return "ERROR " + name + " was resized during the job";
+        }
+    }
+#else
+    (void)engine;
+#endif
+    if (retVal != 0)
+    {
+        return "ERROR cannot equalize " + name;
+    }
+
+    return "OK " + std::to_string(elapsedMicroseconds(start));
+}
+
+ClaheServer::SharedFrame const * ClaheServer::mapSharedFrame(std::string const & name, size_t minimumSize)
+{
+#ifdef __linux__
+    auto cached = sharedFrames.find(name);
+    if (cached != sharedFrames.end())
+    {
+        // The client may have resized, or replaced, the object since the last job
+        struct stat status;
+        if (fstat(cached->second.descriptor, &status) == 0 && static_cast<size_t>(status.st_size) == cached->second.size &&
+            cached->second.size >= minimumSize && status.st_nlink > 0)
+        {
+            return &cached->second;
+        }
+        munmap(cached->second.data, cached->second.size);
+        close(cached->second.descriptor);
+        sharedFrames.erase(cached);
+    }
+
+    int const descriptor = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (descriptor < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || static_cast<size_t>(status.st_size) < minimumSize)
+    {
+        close(descriptor);
+        return nullptr;
+    }
+
+    auto const size = static_cast<size_t>(status.st_size);
+    auto const data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (MAP_FAILED == data)
+    {
+        close(descriptor);
+        return nullptr;
+    }
+
+    return &sharedFrames.emplace(name, SharedFrame{descriptor, static_cast<uint8_t *>(data), size}).first->second;
+#else
+    (void)name;
+    (void)minimumSize;
+    return nullptr;
+#endif
+}
+
+void ClaheServer::unmapSharedFrames() noexcept
+{
+#ifdef __linux__
+    for (auto const & frame : sharedFrames)
+    {
+        munmap(frame.second.data, frame.second.size);
+        close(frame.second.descriptor);
+    }
+#endif
+    sharedFrames.clear();
+}
+
+static bool readClipLimit(std::istringstream & arguments, double defaultClipLimit, double & clipLimit)
+{
+    std::string word;
+    if (!(arguments >> word))
+    {
+        clipLimit = defaultClipLimit;
+        return true;
+    }
+
+    char * end(nullptr);
+    clipLimit = std::strtod(word.c_str(), &end);
+    return end != word.c_str() && *end == '\0' && clipLimit > 0.0;
+}
+
+static long elapsedMicroseconds(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+#ifdef __linux__
+static bool sendLine(int descriptor, std::string const & line)
+{
+    auto const message = line + '\n';
+    size_t sent(0);
+    while (sent < message.size())
+    {
+        // A client which hung up must not kill the server with SIGPIPE
+        auto const written = send(descriptor, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static bool installBusErrorHandler()
+{
+    static bool const installed = [] {
+        struct sigaction action{};
+        action.sa_sigaction = handleSharedFrameBusError;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGBUS, &action, &previousBusErrorAction) == 0;
+    }();
+    return installed;
+}
+
+static bool serveSessionInput(ClaheServer & server, int descriptor, std::string & pending, bool & stopping)
+{
+    char buffer[4096];
+    ssize_t received;
+    do
+    {
+        received = read(descriptor, buffer, sizeof(buffer));
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0)
+    {
+        return false;
+    }
+
+    try
+    {
+        pending.append(buffer, static_cast<size_t>(received));
+
+        // Answer every complete line, a partial one waits for more data
+        std::string response;
+        size_t lineEnd;
+        while ((lineEnd = pending.find('\n')) != std::string::npos)
+        {
+            auto request = pending.substr(0, lineEnd);
+            pending.erase(0, lineEnd + 1);
+            if (!request.empty() && request.back() == '\r')
+            {
+                request.pop_back();
+            }
+            if (request.empty())
+            {
+                continue;
+            }
+
+            auto const outcome = server.handleRequest(request, response);
+            stopping = outcome == STOP_SERVER;
+            if (!sendLine(descriptor, response) || outcome != CONTINUE_SESSION)
+            {
+                return false;
+            }
+        }
+    }
+    catch (std::exception const &)
+    {
+        // Out of memory while buffering, drop this client and keep serving
+        return false;
+    }
+    return true;
+}
+
+static bool guardSharedFrame(uint8_t * data, size_t size)
+{
+    if (!installBusErrorHandler())
+    {
+        return false;
+    }
+
+    guardedFrameLost = false;
+    guardedFrameEnd = data + size;
+    guardedFrameBegin = data;
+    return true;
+}
+
+static bool unguardSharedFrame()
+{
+    guardedFrameBegin = nullptr;
+    guardedFrameEnd = nullptr;
+    return guardedFrameLost;
+}
+
+static void handleSharedFrameBusError(int signalNumber, siginfo_t * information, void * context)
+{
+    // The fault may be on any of the engine's workers, so rather than jumping
+    // out of the job the whole frame is backed by private zero pages and the
+    // faulting access retries on them
+    auto const address = static_cast<uint8_t *>(information->si_addr);
+    auto const begin = guardedFrameBegin.load(), end = guardedFrameEnd.load();
+    if (nullptr != begin && address >= begin && address < end &&
+        mmap(begin, static_cast<size_t>(end - begin), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1, 0) != MAP_FAILED)
+    {
+        guardedFrameLost = true;
+        return;
+    }
+
+    // Any other bus error is not the job's, it goes to the action the handler
+    // replaced
+    if ((previousBusErrorAction.sa_flags & SA_SIGINFO) != 0)
+    {
+        previousBusErrorAction.sa_sigaction(signalNumber, information, context);
+        return;
+    }
+    if (SIG_DFL != previousBusErrorAction.sa_handler && SIG_IGN != previousBusErrorAction.sa_handler)
+    {
+        previousBusErrorAction.sa_handler(signalNumber);
+        return;
+    }
+
+    // A bus error cannot be ignored, the access retries under the default
+    // action, which terminates the process
+    struct sigaction defaultAction{};
+    defaultAction.sa_handler = SIG_DFL;
+    sigemptyset(&defaultAction.sa_mask);
+    sigaction(SIGBUS, &defaultAction, nullptr);
+}
+#endif
@@ -0,0 +1,125 @@
+/*
+ * file: server.hpp
+ * purpose: Declaration of a long running CLAHE server which takes jobs over
+ *          stdin or a Unix domain socket, so a stream of images pays for
+ *          process startup and engine setup only once.
+ */
+
+#pragma once
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include "autotune.hpp"
+#include "parallel.hpp"
+
+/*
+ * What the connection should do after a request has been answered.
+ */
+enum RequestOutcome : uint8_t
+{
+    CONTINUE_SESSION = 0,
+    // QUIT, the client is done with this connection
+    END_SESSION = 1,
+    // SHUTDOWN, the server stops after answering
+    STOP_SERVER = 2,
+};
+
+/*
+ * Serves equalization jobs with warm engines. Requests and responses are
+ * single lines of whitespace separated words:
+ *
+ *     FILE <input path> <output path> [clip limit]
+ *         -> OK <output path> <microseconds>
+ *     SHM <shared memory name> <columns> <rows> [clip limit]
+ *         -> OK <microseconds>
+ *     PING -> OK
+ *     QUIT -> OK, and the connection is closed
+ *     SHUTDOWN -> OK, and the server stops
+ *
+ * A failed request is answered with ERROR <reason>. FILE jobs read the image
+ * as grayscale and write the output in the format of its extension, so paths
+ * may not contain whitespace. SHM jobs name a POSIX shared memory object of
+ * at least 2 x columns x rows bytes holding the 8-bit input frame followed by
+ * room for the output frame, which is equalized in place without copies. A
+ * client must not shrink the object while its job runs; if it does, the
+ * server's bus error is caught, the job is answered with ERROR and the object
+ * is mapped again on the next job. The microseconds are the time spent on the
+ * job inside the server.
+ *
+ * One engine, with its thread pool and scratch memory, is kept per clip limit
+ * and configuration in use, and shared memory objects stay mapped between
+ * jobs. The configuration of a frame size comes from the tuning cache of
+ * autoTune(), so a size tuned by an earlier run, i.e. with clahe --tune, gets
+ * its tuned engine on its first job and a size the cache does not know is
+ * tuned once, on its first job.
+ */
+class ClaheServer
+{
+public:
+    /*
+     * _threadCount- The number of worker threads per engine, 0 takes the
+     *               tuned configuration of each frame size.
+     * _clipLimit- The clip limit of jobs which do not give one.
+     */
+    explicit ClaheServer(unsigned int _threadCount = 0, double _clipLimit = 40.0);
+
+    ~ClaheServer();
+
+    ClaheServer(ClaheServer const &) = delete;
+    ClaheServer & operator=(ClaheServer const &) = delete;
+
+    /*
+     * Answers one request line, the response has no trailing newline.
+     */
+    RequestOutcome handleRequest(std::string const & request, std::string & response);
+
+    /*
+     * Serves requests read line by line from input, i.e. stdin, until QUIT,
+     * SHUTDOWN or the end of the input. Returns 0 on success and -1 on failure.
+     */
+    [[nodiscard]] int serve(std::istream & input, std::ostream & output) noexcept;
+
+    /*
+     * Listens on a Unix domain socket at socketPath, replacing any stale
+     * socket file, and serves until SHUTDOWN. Up to 64 connections are polled
+     * together and their requests run one at a time on the shared engines, a
+     * connection idle for five minutes is closed. Returns 0 on success and -1
+     * on failure, or if sockets are unsupported.
+     */
+    [[nodiscard]] int serveSocket(std::string const & socketPath) noexcept;
+
+private:
+    struct SharedFrame
+    {
+        int descriptor;
+        uint8_t * data;
+        size_t size;
+    };
+
+    /*
+     * The engine for the clip limit with the configuration tuned for the
+     * frame size, a size of 0 x 0 takes the untuned configuration.
+     */
+    ParallelClahe & engineFor(double clipLimit, unsigned int columns, unsigned int rows);
+
+    std::string processFile(std::istringstream & arguments);
+
+    std::string processSharedFrame(std::istringstream & arguments);
+
+    SharedFrame const * mapSharedFrame(std::string const & name, size_t minimumSize);
+
+    void unmapSharedFrames() noexcept;
+
+    unsigned int const threadCount;
+    double const defaultClipLimit;
+    // By clip limit, thread count and band height
+    std::map<std::tuple<double, unsigned int, unsigned int>, std::unique_ptr<ParallelClahe>> engines;
+    // The configuration of every frame size seen, from the tuning cache
+    std::map<std::pair<unsigned int, unsigned int>, TunedConfiguration> configurations;
+    std::unordered_map<std::string, SharedFrame> sharedFrames;
+};
@@ -0,0 +1,124 @@
+/*
+ * file: threadpool.cpp
+ * purpose: Implementation of the fork-join worker pool.
+ */
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <algorithm>
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+ThreadPool::ThreadPool(unsigned int _workerCount)
+  : ThreadPool(std::vector<std::vector<unsigned int>>(std::max(_workerCount, 1u)))
+{
+    // Empty
+}
+
+ThreadPool::ThreadPool(std::vector<std::vector<unsigned int>> const & _workerProcessors)
+  : currentTask(nullptr), taskException(nullptr), generation(0), workersRemaining(0), stopping(false)
+{
+    for (auto i = 0u; i < _workerProcessors.size(); ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i, _workerProcessors[i]);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto & worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::runOnAllWorkers(std::function<void(unsigned int workerIndex)> const & task)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    currentTask = &task;
+    workersRemaining = static_cast<unsigned int>(workers.size());
+    ++generation;
+    taskAvailable.notify_all();
+
+    taskFinished.wait(lock, [this]() { return workersRemaining == 0; });
+    currentTask = nullptr;
+
+    if (taskException)
+    {
+        auto exception = taskException;
+        taskException = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+unsigned int ThreadPool::size() const noexcept
+{
+    return static_cast<unsigned int>(workers.size());
+}
+
+void ThreadPool::workerLoop(unsigned int workerIndex, std::vector<unsigned int> processors)
+{
+#ifdef __linux__
+    if (!processors.empty())
+    {
+        cpu_set_t processorSet;
+        CPU_ZERO(&processorSet);
+        for (auto processor : processors)
+        {
+            CPU_SET(processor, &processorSet);
+        }
+        // Failing to pin (i.e. the processors are outside of this process's
+        // cpuset) only costs locality, so the result is deliberately ignored
+        pthread_setaffinity_np(pthread_self(), sizeof(processorSet), &processorSet);
+    }
+#else
+    (void)processors;
+#endif
+    CLAHE_TRACE_THREAD_NAME("worker", workerIndex);
+
+    unsigned long lastGeneration(0);
+    while (true)
+    {
+        std::function<void(unsigned int)> const * task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this, lastGeneration]() { return stopping || generation != lastGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            lastGeneration = generation;
+            task = currentTask;
+        }
+
+        // Leaving the thread with an exception would terminate the process,
+        // it is handed to the caller of runOnAllWorkers() instead
+        std::exception_ptr exception;
+        try
+        {
+            (*task)(workerIndex);
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (exception && !taskException)
+            {
+                taskException = exception;
+            }
+            --workersRemaining;
+        }
+        taskFinished.notify_one();
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * file: threadpool.hpp
+ * purpose: Declaration of a fixed pool of worker threads which run fork-join
+ *          tasks, optionally pinned to sets of processors.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    /*
+     * Creates one unpinned worker per count.
+     */
+    explicit ThreadPool(unsigned int _workerCount);
+
+    /*
+     * Creates one worker per entry, pinned to the processors listed in it. An
+     * empty entry leaves that worker unpinned. Pinning is best effort and a
+     * worker which could not be pinned still runs.
+     */
+    explicit ThreadPool(std::vector<std::vector<unsigned int>> const & _workerProcessors);
+
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+
+    /*
+     * Runs the task once on every worker, passing the worker's index, and
+     * returns after all of them have finished. An exception a task throws on
+     * a worker is rethrown here once every worker has finished, the first one
+     * if several throw. Only one thread may run tasks on a pool at a time.
+     */
+    void runOnAllWorkers(std::function<void(unsigned int workerIndex)> const & task);
+
+    unsigned int size() const noexcept;
+
+private:
+    void workerLoop(unsigned int workerIndex, std::vector<unsigned int> processors);
+
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable taskFinished;
+    std::function<void(unsigned int)> const * currentTask;
+    // The first exception the current task threw on a worker
+    std::exception_ptr taskException;
+    unsigned long generation;
+    unsigned int workersRemaining;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,585 @@
+/*
+ * file: tiles.cpp
+ * purpose: Implementation of the tile lookup tables and row interpolation
+ *          kernels shared by the CLAHE front ends.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include "opencv2/opencv.hpp"
+#include "tiles.hpp"
+
+static std::vector<InterpolationSpan> getInterpolationSpans(unsigned int tiles,
+                                                            unsigned int pixelsPerTile,
+                                                            unsigned int pixels);
+
+/*
+ * The distance of each pixel from the lower tile center of its span, as a
+ * fraction of the tile size.
+ */
+static std::vector<float> getInterpolationWeights(std::vector<InterpolationSpan> const & spans,
+                                                  unsigned int pixelsPerTile,
+                                                  unsigned int pixels);
+
+/*
+ * Moves spans into the coordinates of an image reduced by scale, each reduced
+ * pixel taking the weight of the middle pixel of its block.
+ */
+static void sampleInterpolationSpans(std::vector<InterpolationSpan> & spans,
+                                     std::vector<float> const & fullWeights,
+                                     unsigned int scale,
+                                     std::vector<float> & sampledWeights);
+
+/*
+ * Moves spans into the coordinates of the pixels [begin, begin + length).
+ */
+static void cropInterpolationSpans(std::vector<InterpolationSpan> & spans,
+                                   std::vector<float> const & fullWeights,
+                                   unsigned int begin,
+                                   unsigned int length,
+                                   std::vector<float> & croppedWeights);
+
+static RegionKernel selectRegionKernel(std::array<LookupTable const *, 4> const & tables,
+                                       std::array<LookupTableKind, 4> const & kinds);
+
+template <typename CounterType>
+static void generateTileLookupTable(cv::Mat const & input,
+                                    unsigned int tileX,
+                                    unsigned int tileY,
+                                    BasicGrayLevelMappingFunction<CounterType> const & mapping,
+                                    double clipLimit,
+                                    TileLookupTables & tables,
+                                    unsigned int * inputHistogram,
+                                    ClahePointOperations const * operations);
+
+template <typename CounterType>
+static void mapTileHistogram(Histogram<CounterType> & tileHistogram,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             BasicGrayLevelMappingFunction<CounterType> const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables,
+                             ClahePointOperations const * operations);
+
+/*
+ * Produces the columns [columnBegin, columnEnd) of an output row.
+ */
+static void interpolateRowSection(uint8_t const * inputRow,
+                                  uint8_t * outputRow,
+                                  TileLookupTables const & tables,
+                                  InterpolationPlan const & plan,
+                                  unsigned int regionY,
+                                  float rowWeight,
+                                  unsigned int columnBegin,
+                                  unsigned int columnEnd,
+                                  unsigned int * outputHistogram);
+
+template <bool CollectHistogram>
+static void produceRegionRow(RegionKernel kernel,
+                             uint8_t const * inputRow,
+                             uint8_t * outputRow,
+                             InterpolationSpan const & span,
+                             std::array<LookupTable const *, 4> const & tables,
+                             float const * columnWeights,
+                             float rowWeight,
+                             unsigned int * outputHistogram);
+
+Rectangle TileGrid::getTileBounds(unsigned int tileX, unsigned int tileY) const
+{
+    // Grab the last few pixels if on the right or bottom edge of the image
+    unsigned int const regionWidth =
+        tileWidth + ((tileX == tilesHorizontal - 1) ? columns % tilesHorizontal : 0);
+    unsigned int const regionHeight =
+        tileHeight + ((tileY == tilesVertical - 1) ? rows % tilesVertical : 0);
+
+    return Rectangle(tileWidth * tileX, tileHeight * tileY, regionWidth, regionHeight);
+}
+
+InterpolationPlan::InterpolationPlan(TileGrid const & grid)
+  : horizontalSpans(getInterpolationSpans(grid.tilesHorizontal, grid.tileWidth, grid.columns)),
+    verticalSpans(getInterpolationSpans(grid.tilesVertical, grid.tileHeight, grid.rows)),
+    columnWeights(getInterpolationWeights(horizontalSpans, grid.tileWidth, grid.columns)),
+    rowWeights(getInterpolationWeights(verticalSpans, grid.tileHeight, grid.rows))
+{
+    // Empty
+}
+
+InterpolationPlan::InterpolationPlan(InterpolationPlan const & fullPlan, unsigned int scale)
+  : horizontalSpans(fullPlan.horizontalSpans),
+    verticalSpans(fullPlan.verticalSpans)
+{
+    sampleInterpolationSpans(horizontalSpans, fullPlan.columnWeights, scale, columnWeights);
+    sampleInterpolationSpans(verticalSpans, fullPlan.rowWeights, scale, rowWeights);
+}
+
+InterpolationPlan::InterpolationPlan(InterpolationPlan const & fullPlan, Rectangle const & region)
+  : horizontalSpans(fullPlan.horizontalSpans),
+    verticalSpans(fullPlan.verticalSpans)
+{
+    cropInterpolationSpans(horizontalSpans, fullPlan.columnWeights, region.x, region.width, columnWeights);
+    cropInterpolationSpans(verticalSpans, fullPlan.rowWeights, region.y, region.height, rowWeights);
+}
+
+bool isValidClaheInput(cv::Mat const & input,
+                       unsigned int tilesHorizontal,
+                       unsigned int tilesVertical) noexcept
+{
+    return input.type() == CV_8UC1 && tilesHorizontal > 0 && tilesVertical > 0 &&
+           static_cast<unsigned int>(input.cols) >= tilesHorizontal &&
+           static_cast<unsigned int>(input.rows) >= tilesVertical;
+}
+
+void generateTileLookupTable(cv::Mat const & input,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             GrayLevelMappingFunction const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables,
+                             unsigned int * inputHistogram,
+                             ClahePointOperations const * operations /* = nullptr */)
+{
+    if (mapping)
+    {
+        generateTileLookupTable<unsigned int>(input, tileX, tileY, mapping, clipLimit, tables, inputHistogram,
+                                              operations);
+        return;
+    }
+
+    // The default mapping can count with the narrowest counters the tile fits in
+    auto const bounds = tables.grid.getTileBounds(tileX, tileY);
+    if (bounds.width * bounds.height <= UINT16_MAX)
+    {
+        generateTileLookupTable<uint16_t>(input, tileX, tileY, areaBasedGrayLevelMapping<uint16_t>, clipLimit,
+                                          tables, inputHistogram, operations);
+    }
+    else
+    {
+        generateTileLookupTable<unsigned int>(input, tileX, tileY, areaBasedGrayLevelMapping<unsigned int>,
+                                              clipLimit, tables, inputHistogram, operations);
+    }
+}
+
+void generateTileLookupTable(ImageHistogram & tileHistogram,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             GrayLevelMappingFunction const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables)
+{
+    if (mapping)
+    {
+        mapTileHistogram<unsigned int>(tileHistogram, tileX, tileY, mapping, clipLimit, tables, nullptr);
+    }
+    else
+    {
+        mapTileHistogram<unsigned int>(tileHistogram, tileX, tileY, areaBasedGrayLevelMapping<unsigned int>,
+                                       clipLimit, tables, nullptr);
+    }
+}
+
+void countTileHistograms(cv::Mat const & input,
+                         TileGrid const & grid,
+                         unsigned int rowBegin,
+                         unsigned int rowEnd,
+                         std::vector<ImageHistogram> & tileHistograms)
+{
+    for (auto rowIdx = rowBegin; rowIdx < rowEnd; ++rowIdx)
+    {
+        // The bottom tiles also cover the rows left over by the integer division
+        auto const tileY = std::min(rowIdx / grid.tileHeight, grid.tilesVertical - 1);
+        auto const inputRow = input.ptr<uint8_t>(rowIdx);
+        for (auto tileX = 0u; tileX < grid.tilesHorizontal; ++tileX)
+        {
+            auto const columns = grid.getTileBounds(tileX, tileY);
+            auto & histogram = tileHistograms[tileY * grid.tilesHorizontal + tileX].histogram;
+            for (auto colIdx = columns.x; colIdx < columns.x + columns.width; ++colIdx)
+            {
+                ++histogram[inputRow[colIdx]];
+            }
+        }
+    }
+}
+
+void selectRegionKernels(TileLookupTables & tables)
+{
+    for (auto regionY = 0u; regionY <= tables.grid.tilesVertical; ++regionY)
+    {
+        selectRegionKernels(tables, regionY);
+    }
+}
+
+void selectRegionKernels(TileLookupTables & tables, unsigned int regionY)
+{
+    auto const & grid = tables.grid;
+
+    // Regions before the first and after the last center use the closest tile
+    auto const top = (regionY == 0) ? 0 : regionY - 1;
+    auto const bottom = std::min(regionY, grid.tilesVertical - 1);
+    for (auto regionX = 0u; regionX <= grid.tilesHorizontal; ++regionX)
+    {
+        auto const left = (regionX == 0) ? 0 : regionX - 1;
+        auto const right = std::min(regionX, grid.tilesHorizontal - 1);
+        auto const kind = [&tables, &grid](unsigned int x, unsigned int y) {
+            return tables.kinds[y * grid.tilesHorizontal + x];
+        };
+
+        tables.regionKernels[regionY * (grid.tilesHorizontal + 1) + regionX] = selectRegionKernel(
+            {&tables.at(left, top), &tables.at(right, top), &tables.at(left, bottom), &tables.at(right, bottom)},
+            {kind(left, top), kind(right, top), kind(left, bottom), kind(right, bottom)});
+    }
+}
+
+void interpolateRows(cv::Mat const & input,
+                     cv::Mat & output,
+                     TileLookupTables const & tables,
+                     InterpolationPlan const & plan,
+                     unsigned int rowBegin,
+                     unsigned int rowEnd,
+                     unsigned int * outputHistogram)
+{
+    for (auto regionY = 0u; regionY < plan.verticalSpans.size(); ++regionY)
+    {
+        auto const & verticalSpan = plan.verticalSpans[regionY];
+        for (auto rowIdx = std::max(verticalSpan.begin, rowBegin); rowIdx < std::min(verticalSpan.end, rowEnd);
+             ++rowIdx)
+        {
+            interpolateRow(input.ptr<uint8_t>(rowIdx), output.ptr<uint8_t>(rowIdx), tables, plan, regionY,
+                           plan.rowWeights[rowIdx], outputHistogram);
+        }
+    }
+}
+
+void interpolateRow(uint8_t const * inputRow,
+                    uint8_t * outputRow,
+                    TileLookupTables const & tables,
+                    InterpolationPlan const & plan,
+                    unsigned int regionY,
+                    float rowWeight,
+                    unsigned int * outputHistogram)
+{
+    interpolateRowSection(inputRow, outputRow, tables, plan, regionY, rowWeight, 0, tables.grid.columns,
+                          outputHistogram);
+}
+
+void interpolateRectangle(cv::Mat const & input,
+                          cv::Mat & output,
+                          TileLookupTables const & tables,
+                          InterpolationPlan const & plan,
+                          Rectangle const & region)
+{
+    for (auto regionY = 0u; regionY < plan.verticalSpans.size(); ++regionY)
+    {
+        auto const & verticalSpan = plan.verticalSpans[regionY];
+        for (auto rowIdx = std::max(verticalSpan.begin, region.y);
+             rowIdx < std::min(verticalSpan.end, region.y + region.height); ++rowIdx)
+        {
+            interpolateRowSection(input.ptr<uint8_t>(rowIdx), output.ptr<uint8_t>(rowIdx), tables, plan, regionY,
+                                  plan.rowWeights[rowIdx], region.x, region.x + region.width, nullptr);
+        }
+    }
+}
+
+void summarizeClaheStatistics(ClaheStatistics & statistics)
+{
+    statistics.inputMean = calculateHistogramMean(statistics.inputHistogram);
+    statistics.inputVariance = calculateHistogramVariance(statistics.inputHistogram);
+    statistics.inputEntropy = calculateHistogramEntropy(statistics.inputHistogram);
+    statistics.outputMean = calculateHistogramMean(statistics.outputHistogram);
+    statistics.outputVariance = calculateHistogramVariance(statistics.outputHistogram);
+    statistics.outputEntropy = calculateHistogramEntropy(statistics.outputHistogram);
+    statistics.meanBrightnessError = std::abs(statistics.outputMean - statistics.inputMean);
+}
+
+unsigned int getPixelCoordinateFromTileCoordinate(unsigned int tileCoordinate,
+                                                  unsigned int pixelsPerTile)
+{
+    return (pixelsPerTile / 2) + (tileCoordinate * pixelsPerTile);
+}
+
+static std::vector<InterpolationSpan> getInterpolationSpans(unsigned int tiles,
+                                                            unsigned int pixelsPerTile,
+                                                            unsigned int pixels)
+{
+    std::vector<InterpolationSpan> spans;
+
+    // Pixels before the first tile center only use the first tile
+    spans.push_back({0, getPixelCoordinateFromTileCoordinate(0, pixelsPerTile), 0, 0});
+    for (auto tile = 0u; tile + 1 < tiles; ++tile)
+    {
+        spans.push_back({getPixelCoordinateFromTileCoordinate(tile, pixelsPerTile),
+                         getPixelCoordinateFromTileCoordinate(tile + 1, pixelsPerTile),
+                         tile,
+                         tile + 1});
+    }
+    // Pixels after the last tile center only use the last tile
+    spans.push_back({getPixelCoordinateFromTileCoordinate(tiles - 1, pixelsPerTile), pixels,
+                     tiles - 1, tiles - 1});
+
+    return spans;
+}
+
+static void interpolateRowSection(uint8_t const * inputRow,
+                                  uint8_t * outputRow,
+                                  TileLookupTables const & tables,
+                                  InterpolationPlan const & plan,
+                                  unsigned int regionY,
+                                  float rowWeight,
+                                  unsigned int columnBegin,
+                                  unsigned int columnEnd,
+                                  unsigned int * outputHistogram)
+{
+    auto const & grid = tables.grid;
+    auto const & verticalSpan = plan.verticalSpans[regionY];
+    auto const top(verticalSpan.lowerTile), bottom(verticalSpan.upperTile);
+
+    for (auto regionX = 0u; regionX < plan.horizontalSpans.size(); ++regionX)
+    {
+        auto span = plan.horizontalSpans[regionX];
+        span.begin = std::max(span.begin, columnBegin);
+        span.end = std::min(span.end, columnEnd);
+        if (span.begin >= span.end)
+        {
+            continue;
+        }
+
+        auto const left(span.lowerTile), right(span.upperTile);
+        auto const kernel = tables.regionKernels[regionY * (grid.tilesHorizontal + 1) + regionX];
+        // Top left, top right, bottom left, bottom right
+        std::array<LookupTable const *, 4> const regionTables{
+            &tables.at(left, top), &tables.at(right, top), &tables.at(left, bottom), &tables.at(right, bottom)};
+
+        if (nullptr != outputHistogram)
+        {
+            produceRegionRow<true>(kernel, inputRow, outputRow, span, regionTables,
+                                   plan.columnWeights.data(), rowWeight, outputHistogram);
+        }
+        else
+        {
+            produceRegionRow<false>(kernel, inputRow, outputRow, span, regionTables,
+                                    plan.columnWeights.data(), rowWeight, nullptr);
+        }
+    }
+}
+
+static std::vector<float> getInterpolationWeights(std::vector<InterpolationSpan> const & spans,
+                                                  unsigned int pixelsPerTile,
+                                                  unsigned int pixels)
+{
+    std::vector<float> weights(pixels, 0.f);
+    for (auto const & span : spans)
+    {
+        for (auto pixel = span.begin; pixel < span.end && span.lowerTile != span.upperTile; ++pixel)
+        {
+            weights[pixel] =
+                static_cast<float>(pixel - getPixelCoordinateFromTileCoordinate(span.lowerTile, pixelsPerTile)) /
+                pixelsPerTile;
+        }
+    }
+    return weights;
+}
+
+static void sampleInterpolationSpans(std::vector<InterpolationSpan> & spans,
+                                     std::vector<float> const & fullWeights,
+                                     unsigned int scale,
+                                     std::vector<float> & sampledWeights)
+{
+    auto const pixels = static_cast<unsigned int>(fullWeights.size());
+    auto const sampledPixels = (pixels + scale - 1) / scale;
+    auto const getSample = [pixels, scale](unsigned int sampledPixel) {
+        auto const blockBegin = sampledPixel * scale;
+        return blockBegin + std::min(scale, pixels - blockBegin) / 2;
+    };
+
+    // Every span is kept, even when empty, so region indices stay the same
+    sampledWeights.assign(sampledPixels, 0.f);
+    auto sampledPixel = 0u;
+    for (auto & span : spans)
+    {
+        auto const fullEnd = span.end;
+        span.begin = sampledPixel;
+        for (; sampledPixel < sampledPixels && getSample(sampledPixel) < fullEnd; ++sampledPixel)
+        {
+            sampledWeights[sampledPixel] = fullWeights[getSample(sampledPixel)];
+        }
+        span.end = sampledPixel;
+    }
+}
+
+static void cropInterpolationSpans(std::vector<InterpolationSpan> & spans,
+                                   std::vector<float> const & fullWeights,
+                                   unsigned int begin,
+                                   unsigned int length,
+                                   std::vector<float> & croppedWeights)
+{
+    croppedWeights.assign(fullWeights.cbegin() + begin, fullWeights.cbegin() + begin + length);
+
+    // Every span is kept, even when empty, so region indices stay the same
+    for (auto & span : spans)
+    {
+        span.begin = std::min(std::max(span.begin, begin), begin + length) - begin;
+        span.end = std::min(std::max(span.end, begin), begin + length) - begin;
+    }
+}
+
+static RegionKernel selectRegionKernel(std::array<LookupTable const *, 4> const & tables,
+                                       std::array<LookupTableKind, 4> const & kinds)
+{
+    for (auto i = 1u; i < tables.size(); ++i)
+    {
+        if (tables[i] != tables[0] && *tables[i] != *tables[0])
+        {
+            return BLEND_KERNEL;
+        }
+    }
+
+    // Every table is the same so they all share the first table's kind
+    switch (kinds[0])
+    {
+        case CONSTANT_TABLE:
+            return FILL_KERNEL;
+        case IDENTITY_TABLE:
+            return COPY_KERNEL;
+        default:
+            return SINGLE_TABLE_KERNEL;
+    }
+}
+
+template <bool CollectHistogram>
+static void produceRegionRow(RegionKernel kernel,
+                             uint8_t const * inputRow,
+                             uint8_t * outputRow,
+                             InterpolationSpan const & span,
+                             std::array<LookupTable const *, 4> const & tables,
+                             float const * columnWeights,
+                             float rowWeight,
+                             unsigned int * outputHistogram)
+{
+    switch (kernel)
+    {
+        case FILL_KERNEL:
+            memset(outputRow + span.begin, (*tables[0])[0], span.end - span.begin);
+            if (CollectHistogram)
+            {
+                outputHistogram[(*tables[0])[0]] += span.end - span.begin;
+            }
+            break;
+        case COPY_KERNEL:
+            if (CollectHistogram)
+            {
+                for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+                {
+                    outputRow[colIdx] = inputRow[colIdx];
+                    ++outputHistogram[inputRow[colIdx]];
+                }
+            }
+            else
+            {
+                memcpy(outputRow + span.begin, inputRow + span.begin, span.end - span.begin);
+            }
+            break;
+        case SINGLE_TABLE_KERNEL:
+            for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+            {
+                outputRow[colIdx] = (*tables[0])[inputRow[colIdx]];
+                if (CollectHistogram)
+                {
+                    ++outputHistogram[outputRow[colIdx]];
+                }
+            }
+            break;
+        case BLEND_KERNEL:
+        {
+            auto const & topLeft = *tables[0];
+            auto const & topRight = *tables[1];
+            auto const & bottomLeft = *tables[2];
+            auto const & bottomRight = *tables[3];
+
+            for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+            {
+                auto const intensity = inputRow[colIdx];
+                float const columnWeight = columnWeights[colIdx];
+                // Interpolating as a + (b - a) * t keeps the result exact when the
+                // tables agree, so this matches the cheaper kernels on their regions
+                float const top = topLeft[intensity] +
+                    (static_cast<float>(topRight[intensity]) - topLeft[intensity]) * columnWeight;
+                float const bottom = bottomLeft[intensity] +
+                    (static_cast<float>(bottomRight[intensity]) - bottomLeft[intensity]) * columnWeight;
+                outputRow[colIdx] = static_cast<uint8_t>(top + (bottom - top) * rowWeight);
+                if (CollectHistogram)
+                {
+                    ++outputHistogram[outputRow[colIdx]];
+                }
+            }
+            break;
+        }
+    }
+}
+
+template <typename CounterType>
+static void generateTileLookupTable(cv::Mat const & input,
+                                    unsigned int tileX,
+                                    unsigned int tileY,
+                                    BasicGrayLevelMappingFunction<CounterType> const & mapping,
+                                    double clipLimit,
+                                    TileLookupTables & tables,
+                                    unsigned int * inputHistogram,
+                                    ClahePointOperations const * operations)
+{
+    // Get the histogram for the tile
+    auto tileHistogram(generateGrayscaleHistogramForSubregion<CounterType>(input,
+        tables.grid.getTileBounds(tileX, tileY)));
+
+    // The tiles cover the image, so together they hold its histogram
+    if (nullptr != inputHistogram)
+    {
+        for (auto i = 0u; i < 256; ++i)
+        {
+            inputHistogram[i] += tileHistogram[i];
+        }
+    }
+
+    mapTileHistogram(tileHistogram, tileX, tileY, mapping, clipLimit, tables, operations);
+}
+
+template <typename CounterType>
+static void mapTileHistogram(Histogram<CounterType> & tileHistogram,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             BasicGrayLevelMappingFunction<CounterType> const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables,
+                             ClahePointOperations const * operations)
+{
+    // The histogram of the pre-processed tile only moves whole bins around
+    if (nullptr != operations)
+    {
+        Histogram<CounterType> preprocessedHistogram;
+        for (auto i = 0u; i < 256; ++i)
+        {
+            preprocessedHistogram.histogram[operations->preOperation[i]] += tileHistogram[i];
+        }
+        tileHistogram = preprocessedHistogram;
+    }
+
+    // Clip the histogram and redistribute
+    clipHistogram(tileHistogram, clipLimit);
+
+    // Perform gray level mapping
+    auto & table = tables.at(tileX, tileY);
+    mapping(tileHistogram, &table);
+
+    // Read the input through the pre-operation and write through the post-operation
+    if (nullptr != operations)
+    {
+        LookupTable const equalization(table);
+        for (auto i = 0u; i < table.size(); ++i)
+        {
+            table[i] = operations->postOperation[equalization[operations->preOperation[i]]];
+        }
+    }
+
+    // Remember which tiles are degenerate for the interpolation pass
+    tables.kinds[tileY * tables.grid.tilesHorizontal + tileX] = classifyLookupTable(table);
+}
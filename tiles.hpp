@@ -0,0 +1,239 @@
+/*
+ * file: tiles.hpp
+ * purpose: Building blocks shared by the CLAHE front ends: the geometry of the
+ *          tile grid, the per-tile lookup tables and the interpolation of
+ *          output rows between the tile centers.
+ */
+
+#pragma once
+
+#include <vector>
+#include "clahe.hpp"
+
+/*
+ * The kernels used to produce a region between four tile centers, from the
+ * cheapest to the most general.
+ */
+enum RegionKernel : uint8_t
+{
+    // All four tables map every intensity to the same value
+    FILL_KERNEL = 0,
+    // All four tables are the identity
+    COPY_KERNEL = 1,
+    // All four tables are the same
+    SINGLE_TABLE_KERNEL = 2,
+    // Bilinear blend of the four tables
+    BLEND_KERNEL = 3,
+};
+
+struct TileGrid
+{
+    unsigned int tilesHorizontal;
+    unsigned int tilesVertical;
+    unsigned int tileWidth;
+    unsigned int tileHeight;
+    unsigned int columns;
+    unsigned int rows;
+
+    TileGrid(unsigned int _tilesHorizontal,
+             unsigned int _tilesVertical,
+             unsigned int _columns,
+             unsigned int _rows)
+      : tilesHorizontal(_tilesHorizontal),
+        tilesVertical(_tilesVertical),
+        tileWidth(_columns / _tilesHorizontal),
+        tileHeight(_rows / _tilesVertical),
+        columns(_columns),
+        rows(_rows)
+    {
+        // Empty
+    }
+
+    /*
+     * The pixel bounds of a tile, the tiles on the right and bottom edges
+     * also cover the pixels left over by the integer division.
+     */
+    Rectangle getTileBounds(unsigned int tileX, unsigned int tileY) const;
+};
+
+/*
+ * A run of pixels along one axis which lies between the centers of two
+ * neighboring tiles. Before the first and after the last tile center both
+ * tiles are the same, the closest one.
+ */
+struct InterpolationSpan
+{
+    unsigned int begin;
+    unsigned int end;
+    unsigned int lowerTile;
+    unsigned int upperTile;
+};
+
+/*
+ * The lookup table of every tile in the grid along with what is known about
+ * them for choosing interpolation kernels.
+ */
+struct TileLookupTables
+{
+    TileGrid grid;
+    // Row-major, one table per tile
+    std::vector<LookupTable> tables;
+    std::vector<LookupTableKind> kinds;
+    // Row-major, one kernel per region, (tilesVertical + 1) x (tilesHorizontal + 1)
+    std::vector<RegionKernel> regionKernels;
+
+    explicit TileLookupTables(TileGrid const & _grid)
+      : grid(_grid),
+        tables(_grid.tilesHorizontal * _grid.tilesVertical),
+        kinds(_grid.tilesHorizontal * _grid.tilesVertical, GENERAL_TABLE),
+        regionKernels((_grid.tilesHorizontal + 1) * (_grid.tilesVertical + 1), BLEND_KERNEL)
+    {
+        // Empty
+    }
+
+    inline LookupTable & at(unsigned int tileX, unsigned int tileY) noexcept
+    {
+        return tables[tileY * grid.tilesHorizontal + tileX];
+    }
+
+    inline LookupTable const & at(unsigned int tileX, unsigned int tileY) const noexcept
+    {
+        return tables[tileY * grid.tilesHorizontal + tileX];
+    }
+};
+
+/*
+ * The spans and weights needed to interpolate any row of an image with the
+ * given grid, computed once per image size.
+ */
+struct InterpolationPlan
+{
+    std::vector<InterpolationSpan> horizontalSpans;
+    std::vector<InterpolationSpan> verticalSpans;
+    // The horizontal distance of each column from the left tile center of its region
+    std::vector<float> columnWeights;
+    // The vertical distance of each row from the top tile center of its region
+    std::vector<float> rowWeights;
+
+    explicit InterpolationPlan(TileGrid const & grid);
+
+    /*
+     * A plan for producing the image reduced by scale in each direction, every
+     * reduced pixel is interpolated at the middle pixel of its scale x scale
+     * block. The spans keep their indices, some may be empty.
+     */
+    InterpolationPlan(InterpolationPlan const & fullPlan, unsigned int scale);
+
+    /*
+     * A plan for producing only the pixels within region, with the region's
+     * top left pixel as the first row and column. The spans keep their
+     * indices, some may be empty.
+     */
+    InterpolationPlan(InterpolationPlan const & fullPlan, Rectangle const & region);
+};
+
+/*
+ * Checks whether an image can be processed with a grid of the given size.
+ */
+bool isValidClaheInput(cv::Mat const & input,
+                       unsigned int tilesHorizontal,
+                       unsigned int tilesVertical) noexcept;
+
+/*
+ * Builds the histogram of a single tile, clips it and maps it into the tile's
+ * lookup table.
+ *
+ * mapping- The gray level mapping, an empty function selects the default one,
+ *          which counts tiles of up to 65535 pixels with 16-bit counters.
+ * inputHistogram- Optional 256 counters to which the unclipped tile histogram
+ *                 is added, before any pre-operation.
+ * operations- Optional point operations to fuse into the tile's table.
+ */
+void generateTileLookupTable(cv::Mat const & input,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             GrayLevelMappingFunction const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables,
+                             unsigned int * inputHistogram,
+                             ClahePointOperations const * operations = nullptr);
+
+/*
+ * Clips and maps an already counted tile histogram into the tile's lookup
+ * table, for front ends which see the tile's pixels a few rows at a time.
+ * The histogram is clipped in place.
+ */
+void generateTileLookupTable(ImageHistogram & tileHistogram,
+                             unsigned int tileX,
+                             unsigned int tileY,
+                             GrayLevelMappingFunction const & mapping,
+                             double clipLimit,
+                             TileLookupTables & tables);
+
+/*
+ * Adds the pixels of the rows [rowBegin, rowEnd) to the histograms of the
+ * tiles they belong to, for front ends which see an image a band of rows at a
+ * time. tileHistograms is row-major with one histogram per tile.
+ */
+void countTileHistograms(cv::Mat const & input,
+                         TileGrid const & grid,
+                         unsigned int rowBegin,
+                         unsigned int rowEnd,
+                         std::vector<ImageHistogram> & tileHistograms);
+
+/*
+ * Picks the cheapest kernel for every region once all of the tables are built.
+ */
+void selectRegionKernels(TileLookupTables & tables);
+
+/*
+ * Picks the kernels of a single row of regions, for front ends which build
+ * the tables one tile row at a time. The tile rows above and below it must be
+ * built.
+ */
+void selectRegionKernels(TileLookupTables & tables, unsigned int regionY);
+
+/*
+ * Produces the output rows in [rowBegin, rowEnd) by interpolating between the
+ * lookup tables of the closest tiles.
+ *
+ * outputHistogram- Optional 256 counters to which the output pixels are added.
+ */
+void interpolateRows(cv::Mat const & input,
+                     cv::Mat & output,
+                     TileLookupTables const & tables,
+                     InterpolationPlan const & plan,
+                     unsigned int rowBegin,
+                     unsigned int rowEnd,
+                     unsigned int * outputHistogram);
+
+/*
+ * Produces a single output row which lies in the given vertical region of the
+ * plan, rowWeight being its vertical distance from the region's top tile
+ * center as a fraction of the tile height.
+ */
+void interpolateRow(uint8_t const * inputRow,
+                    uint8_t * outputRow,
+                    TileLookupTables const & tables,
+                    InterpolationPlan const & plan,
+                    unsigned int regionY,
+                    float rowWeight,
+                    unsigned int * outputHistogram);
+
+/*
+ * Produces the output pixels within a rectangle of the image, for updating
+ * part of an output whose tables have changed.
+ */
+void interpolateRectangle(cv::Mat const & input,
+                          cv::Mat & output,
+                          TileLookupTables const & tables,
+                          InterpolationPlan const & plan,
+                          Rectangle const & region);
+
+/*
+ * Fills in the metrics of a ClaheStatistics structure from its histograms.
+ */
+void summarizeClaheStatistics(ClaheStatistics & statistics);
+
+unsigned int getPixelCoordinateFromTileCoordinate(unsigned int tileCoordinate,
+                                                  unsigned int pixelsPerTile);
@@ -0,0 +1,217 @@
+/*
+ * file: trace.cpp
+ * purpose: Implementation of the per-thread trace timeline and its export.
+ */
+
+#include "trace.hpp"
+
+#ifdef CLAHE_TRACING
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "utility.hpp"
+
+// About 1.5 MB per thread that records anything
+static unsigned int const spansPerThread(1u << 16);
+
+struct RecordedSpan
+{
+    char const * name;
+    unsigned int index;
+    unsigned long long begin;
+    unsigned long long end;
+};
+
+/*
+ * The spans of one thread. Only the owning thread records into it, the
+ * count is published with release semantics for the writer.
+ */
+struct ThreadTrace
+{
+    unsigned int id;
+    std::string name;
+    std::unique_ptr<RecordedSpan[]> spans;
+    std::atomic<unsigned int> count;
+    std::atomic<unsigned long long> dropped;
+};
+
+static std::atomic<bool> tracingEnabled(false);
+static std::atomic<long long> traceStart(0);
+
+// Every thread which ever recorded, kept after the thread exits
+static std::mutex registryMutex;
+static std::vector<std::shared_ptr<ThreadTrace>> registry;
+
+static unsigned long long getTraceTime() noexcept
+{
+    auto const now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch())
+                         .count();
+    return static_cast<unsigned long long>(now - traceStart.load(std::memory_order_relaxed));
+}
+
+static ThreadTrace & getThreadTrace()
+{
+    thread_local std::shared_ptr<ThreadTrace> const trace = []() {
+        auto newTrace = std::make_shared<ThreadTrace>();
+        newTrace->count = 0;
+        newTrace->dropped = 0;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        newTrace->id = static_cast<unsigned int>(registry.size());
+        newTrace->name = "thread " + std::to_string(newTrace->id);
+        registry.push_back(newTrace);
+        return newTrace;
+    }();
+    return *trace;
+}
+#endif
+
+void startTracing() noexcept
+{
+#ifdef CLAHE_TRACING
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto const & trace : registry)
+        {
+            trace->count = 0;
+            trace->dropped = 0;
+        }
+    }
+    traceStart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now().time_since_epoch())
+                     .count();
+    tracingEnabled = true;
+#endif
+}
+
+void stopTracing() noexcept
+{
+#ifdef CLAHE_TRACING
+    tracingEnabled = false;
+#endif
+}
+
+[[nodiscard]] int writeTrace(std::string const & path) noexcept
+{
+#ifdef CLAHE_TRACING
+    try
+    {
+        std::ofstream file(path, std::ios::trunc);
+        file << std::fixed << std::setprecision(3);
+        file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+        bool first(true);
+        auto const separate = [&file, &first]() {
+            file << (first ? "\n" : ",\n");
+            first = false;
+        };
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto const & trace : registry)
+        {
+            separate();
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace->id
+                 << ",\"args\":{\"name\":\"" << escapeJson(trace->name) << "\"}}";
+
+            // Complete events, times in microseconds
+            auto const count = trace->count.load(std::memory_order_acquire);
+            for (auto i = 0u; i < count; ++i)
+            {
+                auto const & span = trace->spans[i];
+                separate();
+                file << "{\"name\":\"" << escapeJson(span.name) << "\",\"cat\":\"clahe\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                     << trace->id << ",\"ts\":" << span.begin / 1000.0 << ",\"dur\":" << (span.end - span.begin) / 1000.0
+                     << ",\"args\":{\"index\":" << span.index << "}}";
+            }
+        }
+
+        file << "\n]}\n";
+        file.close();
+        return file ? 0 : -1;
+    }
+    catch (std::exception const &)
+    {
+        return -1;
+    }
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+unsigned long long getDroppedTraceSpans() noexcept
+{
+    unsigned long long dropped(0);
+#ifdef CLAHE_TRACING
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto const & trace : registry)
+    {
+        dropped += trace->dropped;
+    }
+#endif
+    return dropped;
+}
+
+#ifdef CLAHE_TRACING
+void nameTraceThread(char const * name, unsigned int index) noexcept
+{
+    try
+    {
+        auto & trace = getThreadTrace();
+        auto threadName = std::string(name) + ' ' + std::to_string(index);
+        std::lock_guard<std::mutex> lock(registryMutex);
+        trace.name = std::move(threadName);
+    }
+    catch (std::exception const &)
+    {
+        // The thread keeps its numbered name
+    }
+}
+
+TraceSpan::TraceSpan(char const * _name, unsigned int _index) noexcept
+  : name(_name),
+    index(_index),
+    recording(tracingEnabled.load(std::memory_order_relaxed)),
+    begin(recording ? getTraceTime() : 0)
+{
+    // Empty
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    auto const end = getTraceTime();
+    try
+    {
+        auto & trace = getThreadTrace();
+        if (!trace.spans)
+        {
+            trace.spans.reset(new RecordedSpan[spansPerThread]);
+        }
+
+        auto const count = trace.count.load(std::memory_order_relaxed);
+        if (count < spansPerThread)
+        {
+            trace.spans[count] = RecordedSpan{name, index, begin, end};
+            trace.count.store(count + 1, std::memory_order_release);
+        }
+        else
+        {
+            trace.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    catch (std::exception const &)
+    {
+        // Without memory for a buffer the span is lost rather than the work
+    }
+}
+#endif
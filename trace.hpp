@@ -0,0 +1,85 @@
+/*
+ * file: trace.hpp
+ * purpose: Declaration of an optional per-thread timeline of the work done by
+ *          the CLAHE engines, exported as Chrome trace-event JSON.
+ */
+
+#pragma once
+
+#include <string>
+
+/*
+ * Tracing is compiled in with -DCLAHE_TRACING (the CLAHE_TRACING CMake
+ * option). Without it the macros below expand to nothing and the functions
+ * do nothing, so the engines pay nothing for their trace points.
+ *
+ * With it, each trace point records a span: a name, a tile or band index and
+ * its begin and end times, into a buffer owned by the recording thread, so
+ * recording takes no lock and costs two clock reads. A span is only recorded
+ * between startTracing() and stopTracing(), and a thread's spans past the
+ * buffer's capacity are dropped and counted.
+ *
+ *     startTracing();
+ *     engine.apply(input, output);
+ *     stopTracing();
+ *     writeTrace("clahe-trace.json");
+ *
+ * The file opens in chrome://tracing or ui.perfetto.dev with one track per
+ * thread, which shows load imbalance between workers, idle workers and the
+ * serialization between the table and interpolation phases.
+ *
+ * Tracing must be started, stopped and written while no traced work runs.
+ */
+
+#ifdef CLAHE_TRACING
+#define CLAHE_TRACE_CONCATENATE_(a, b) a##b
+#define CLAHE_TRACE_CONCATENATE(a, b) CLAHE_TRACE_CONCATENATE_(a, b)
+// Records a span from here to the end of the enclosing scope, name must be a string literal
+#define CLAHE_TRACE_SPAN(name, index) TraceSpan const CLAHE_TRACE_CONCATENATE(traceSpan, __LINE__)(name, index)
+// Names the calling thread's track, i.e. "worker" and its index
+#define CLAHE_TRACE_THREAD_NAME(name, index) nameTraceThread(name, index)
+#else
+#define CLAHE_TRACE_SPAN(name, index) static_cast<void>(0)
+#define CLAHE_TRACE_THREAD_NAME(name, index) static_cast<void>(0)
+#endif
+
+/*
+ * Discards everything recorded so far and starts recording.
+ */
+void startTracing() noexcept;
+
+void stopTracing() noexcept;
+
+/*
+ * Writes the recorded spans of every thread as Chrome trace-event JSON.
+ * Returns 0 on success and -1 if the file cannot be written or tracing is
+ * compiled out.
+ */
+[[nodiscard]] int writeTrace(std::string const & path) noexcept;
+
+/*
+ * The number of spans dropped because a thread's buffer was full.
+ */
+unsigned long long getDroppedTraceSpans() noexcept;
+
+#ifdef CLAHE_TRACING
+void nameTraceThread(char const * name, unsigned int index) noexcept;
+
+class TraceSpan
+{
+public:
+    TraceSpan(char const * _name, unsigned int _index) noexcept;
+
+    ~TraceSpan();
+
+    TraceSpan(TraceSpan const &) = delete;
+    TraceSpan & operator=(TraceSpan const &) = delete;
+
+private:
+    char const * const name;
+    unsigned int const index;
+    bool const recording;
+    // Nanoseconds since the trace started
+    unsigned long long const begin;
+};
+#endif
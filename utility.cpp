@@ -3,16 +3,12 @@
  */
 
 #include <cassert>
+#include <cmath>
 #include "utility.hpp"
 #include <opencv2/opencv.hpp>
 
 int generateGrayscaleHistogram(cv::Mat const & image, ImageHistogram & outputHistogram)
 {
-    if (outputHistogram.histogram.size() != 256)
-    {
-        return -1;
-    }
-
     for (auto rowIdx = 0u; rowIdx < image.rows; ++rowIdx)
     {
         for (auto colIdx = 0u; colIdx < image.cols; ++colIdx)
@@ -24,11 +20,12 @@ int generateGrayscaleHistogram(cv::Mat const & image, ImageHistogram & outputHis
     return 0;
 }
 
-ImageHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region)
+template <typename CounterType>
+Histogram<CounterType> generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region)
 {
     assert(region.height + region.y <= image.rows);
     assert(region.width + region.x <= image.cols);
-    ImageHistogram output{};
+    Histogram<CounterType> output{};
 
     for (auto rowIdx = region.y; rowIdx < (region.height + region.y); ++rowIdx)
     {
@@ -41,7 +38,8 @@ ImageHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rec
     return output;
 }
 
-GrayLevel classifyGrayLevel(ImageHistogram const & histogram)
+template <typename CounterType>
+GrayLevel classifyGrayLevel(Histogram<CounterType> const & histogram)
 {
     unsigned long const numberOfPixels = [&histogram]() {
         unsigned long total = 0;
@@ -80,6 +78,53 @@ GrayLevel classifyGrayLevel(ImageHistogram const & histogram)
     return static_cast<GrayLevel>(maxLevel);
 }
 
+double calculateHistogramMean(ImageHistogram const & histogram)
+{
+    double numberOfPixels(0.0), intensitySum(0.0);
+    for (auto i = 0u; i < 256; ++i)
+    {
+        numberOfPixels += histogram[i];
+        intensitySum += static_cast<double>(histogram[i]) * i;
+    }
+
+    return (numberOfPixels > 0.0) ? intensitySum / numberOfPixels : 0.0;
+}
+
+double calculateHistogramVariance(ImageHistogram const & histogram)
+{
+    double const mean(calculateHistogramMean(histogram));
+    double numberOfPixels(0.0), squaredDeviationSum(0.0);
+    for (auto i = 0u; i < 256; ++i)
+    {
+        numberOfPixels += histogram[i];
+        squaredDeviationSum += histogram[i] * (i - mean) * (i - mean);
+    }
+
+    return (numberOfPixels > 0.0) ? squaredDeviationSum / numberOfPixels : 0.0;
+}
+
+double calculateHistogramEntropy(ImageHistogram const & histogram)
+{
+    double numberOfPixels(0.0);
+    for (auto i = 0u; i < 256; ++i)
+    {
+        numberOfPixels += histogram[i];
+    }
+
+    double entropy(0.0);
+    for (auto i = 0u; i < 256; ++i)
+    {
+        // Empty bins contribute nothing, their 0 * log(0) term is taken as 0
+        if (histogram[i] > 0)
+        {
+            double proportion = histogram[i] / numberOfPixels;
+            entropy += -1 * proportion * std::log2(proportion);
+        }
+    }
+
+    return entropy;
+}
+
 Pixel bilinearInterpolate(std::vector<Pixel> & pixels, float outX, float outY)
 {
     if (pixels.size() != 4)
@@ -133,7 +178,8 @@ Pixel linearInterpolate(Pixel pixel0, Pixel pixel1, float outX, float outY)
     return {0, 0, 0};
 }
 
-void clipHistogram(ImageHistogram & histogram, double clipLimit)
+template <typename CounterType>
+void clipHistogram(Histogram<CounterType> & histogram, double clipLimit)
 {
     unsigned int numberOfPixelsOverLimit(0);
 
@@ -143,7 +189,7 @@ void clipHistogram(ImageHistogram & histogram, double clipLimit)
         if (histogram[binIndex] > clipLimit)
         {
             numberOfPixelsOverLimit += histogram[binIndex] - clipLimit;
-            histogram.histogram[binIndex] = static_cast<unsigned int>(clipLimit);
+            histogram.histogram[binIndex] = static_cast<CounterType>(clipLimit);
         }
     }
 
@@ -154,3 +200,27 @@ void clipHistogram(ImageHistogram & histogram, double clipLimit)
         histogram.histogram[binIndex] += excessPixelsPerBin;
     }
 }
+
+std::string escapeJson(std::string const & text)
+{
+    std::string escaped;
+    for (auto character : text)
+    {
+        if (character == '"' || character == '\\')
+        {
+            escaped += '\\';
+        }
+        if (static_cast<unsigned char>(character) >= 0x20)
+        {
+            escaped += character;
+        }
+    }
+    return escaped;
+}
+
+template CompactHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region);
+template ImageHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region);
+template GrayLevel classifyGrayLevel(CompactHistogram const & histogram);
+template GrayLevel classifyGrayLevel(ImageHistogram const & histogram);
+template void clipHistogram(CompactHistogram & histogram, double clipLimit);
+template void clipHistogram(ImageHistogram & histogram, double clipLimit);
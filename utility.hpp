@@ -5,8 +5,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <opencv2/core/types.hpp>
+#include <string>
 #include <vector>
 
 namespace cv
@@ -33,30 +36,38 @@ struct Rectangle
     {}
 };
 
-struct ImageHistogram
+/*
+ * A 256-bin intensity histogram with inline storage. The counter type only
+ * has to be wide enough for the number of pixels counted, so small tiles can
+ * use 16-bit counters and halve the histogram's cache footprint.
+ */
+template <typename CounterType>
+struct Histogram
 {
-    std::vector<unsigned int> histogram;
+    alignas(64) std::array<CounterType, 256> histogram;
 
-    explicit ImageHistogram()
-        : histogram(256, 0)
+    Histogram()
+      : histogram{}
     {
         // Empty
     }
 
-    friend GrayLevel classifyGrayLevel(ImageHistogram const & histogram);
-    friend void clipHistogram(ImageHistogram & histogram, double clipLimit);
-
-    inline unsigned int operator[](unsigned int index) const noexcept
+    inline CounterType operator[](unsigned int index) const noexcept
     {
         return histogram[index];
     }
 
-    unsigned int max() const
+    CounterType max() const
     {
         return *std::max_element(histogram.cbegin(), histogram.cend());
     }
 };
 
+using ImageHistogram = Histogram<unsigned int>;
+
+// Enough for any tile of up to 65535 pixels
+using CompactHistogram = Histogram<uint16_t>;
+
 struct Pixel
 {
     unsigned int x;
@@ -91,11 +102,14 @@ int generateGrayscaleHistogram(cv::Mat const & image, ImageHistogram & outputHis
 
 /*
  * Generates the pixel intensity histogram for a subregion of a grayscale image.
+ * The counter type must be able to hold the number of pixels in the region,
+ * it is instantiated for uint16_t and unsigned int.
  * 
  * image: An OpenCV matrix containing a grayscale image.
  * region: The subimage over which to create the histogram from.
  */
-ImageHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region);
+template <typename CounterType = unsigned int>
+Histogram<CounterType> generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rectangle const & region);
 
 /*
  * Classifies the image into one of three categories based on where the highest
@@ -104,7 +118,25 @@ ImageHistogram generateGrayscaleHistogramForSubregion(cv::Mat const & image, Rec
  * Based on gray level definition of Youlian Zhu and Cheng Huang in "An Adaptive
  * Histogram Equalization Algorithm on the Image Gray Level Mapping".
  */
-GrayLevel classifyGrayLevel(ImageHistogram const & histogram);
+template <typename CounterType>
+GrayLevel classifyGrayLevel(Histogram<CounterType> const & histogram);
+
+/*
+ * Calculates the mean intensity of the pixels counted in a histogram.
+ */
+double calculateHistogramMean(ImageHistogram const & histogram);
+
+/*
+ * Calculates the variance of the intensity of the pixels counted in a
+ * histogram.
+ */
+double calculateHistogramVariance(ImageHistogram const & histogram);
+
+/*
+ * Calculates the entropy measurement, in bits, of the intensity distribution
+ * described by a histogram.
+ */
+double calculateHistogramEntropy(ImageHistogram const & histogram);
 
 /*
  * Interpolates the value of a pixel based on it's linear distance in two
@@ -123,4 +155,11 @@ Pixel linearInterpolate(Pixel pixel0, Pixel pixel1, float outX, float outY);
  * removes the excess. The number of excess is added as equally as possible to
  * all bins in the histogram.
  */
-void clipHistogram(ImageHistogram & histogram, double clipLimit);
+template <typename CounterType>
+void clipHistogram(Histogram<CounterType> & histogram, double clipLimit);
+
+/*
+ * Escapes the characters JSON does not allow inside a string, control
+ * characters are dropped.
+ */
+std::string escapeJson(std::string const & text);
@@ -0,0 +1,194 @@
+/*
+ * file: wcetclahe.cpp
+ * purpose: Implementation of the data independent CLAHE engine.
+ */
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "wcetclahe.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// The same grid as clahe()
+static unsigned int const tilesHorizontal(8), tilesVertical(8);
+
+WcetClahe::WcetClahe(unsigned int _columns, unsigned int _rows, double _clipLimit /* = 40.0 */)
+  : columns(_columns),
+    rows(_rows),
+    clipLimit(_clipLimit),
+    valid(_columns >= tilesHorizontal && _rows >= tilesVertical)
+{
+    if (!valid)
+    {
+        return;
+    }
+
+    TileGrid const grid(tilesHorizontal, tilesVertical, columns, rows);
+    for (auto tileX = 0u; tileX <= tilesHorizontal; ++tileX)
+    {
+        tileColumns.push_back(std::min(tileX * grid.tileWidth, columns));
+    }
+    tileColumns.back() = columns;
+    for (auto tileY = 0u; tileY <= tilesVertical; ++tileY)
+    {
+        tileRows.push_back(std::min(tileY * grid.tileHeight, rows));
+    }
+    tileRows.back() = rows;
+
+    histograms.resize(tilesHorizontal * interleave);
+    tables.resize(tilesHorizontal * tilesVertical);
+
+    // Flatten the vertical spans of the plan into per row table indices
+    InterpolationPlan const plan(grid);
+    horizontalSpans = plan.horizontalSpans;
+    for (auto const & span : plan.verticalSpans)
+    {
+        rowLowerTiles.insert(rowLowerTiles.end(), span.end - span.begin, span.lowerTile * tilesHorizontal);
+        rowUpperTiles.insert(rowUpperTiles.end(), span.end - span.begin, span.upperTile * tilesHorizontal);
+    }
+    columnWeights = plan.columnWeights;
+    rowWeights = plan.rowWeights;
+}
+
+[[nodiscard]] int WcetClahe::apply(cv::Mat const & input, cv::Mat & output) noexcept
+{
+    if (!valid || input.type() != CV_8UC1 || output.type() != CV_8UC1 ||
+        input.cols != static_cast<int>(columns) || input.rows != static_cast<int>(rows) ||
+        output.cols != static_cast<int>(columns) || output.rows != static_cast<int>(rows))
+    {
+        return -1;
+    }
+
+    for (auto tileY = 0u; tileY < tilesVertical; ++tileY)
+    {
+        countTileRow(input, tileY);
+        mapTileRow(tileY);
+    }
+    interpolate(input, output);
+
+    return 0;
+}
+
+[[nodiscard]] int WcetClahe::lockMemory() noexcept
+{
+#ifdef __linux__
+    auto const lock = [](void const * data, size_t bytes) {
+        return (bytes == 0) || (mlock(data, bytes) == 0);
+    };
+    bool locked(true);
+    locked = lock(tileColumns.data(), tileColumns.size() * sizeof(unsigned int)) && locked;
+    locked = lock(tileRows.data(), tileRows.size() * sizeof(unsigned int)) && locked;
+    locked = lock(histograms.data(), histograms.size() * sizeof(ImageHistogram)) && locked;
+    locked = lock(tables.data(), tables.size() * sizeof(LookupTable)) && locked;
+    locked = lock(horizontalSpans.data(), horizontalSpans.size() * sizeof(InterpolationSpan)) && locked;
+    locked = lock(columnWeights.data(), columnWeights.size() * sizeof(float)) && locked;
+    locked = lock(rowLowerTiles.data(), rowLowerTiles.size() * sizeof(unsigned int)) && locked;
+    locked = lock(rowUpperTiles.data(), rowUpperTiles.size() * sizeof(unsigned int)) && locked;
+    locked = lock(rowWeights.data(), rowWeights.size() * sizeof(float)) && locked;
+    return locked ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+void WcetClahe::countTileRow(cv::Mat const & input, unsigned int tileY) noexcept
+{
+    for (auto & histogram : histograms)
+    {
+        histogram.histogram.fill(0);
+    }
+
+    for (auto rowIdx = tileRows[tileY]; rowIdx < tileRows[tileY + 1]; ++rowIdx)
+    {
+        auto const inputRow = input.ptr<uint8_t>(rowIdx);
+        for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+        {
+            auto & first = histograms[tileX * interleave].histogram;
+            auto & second = histograms[tileX * interleave + 1].histogram;
+            auto & third = histograms[tileX * interleave + 2].histogram;
+            auto & fourth = histograms[tileX * interleave + 3].histogram;
+
+            auto colIdx = tileColumns[tileX];
+            for (; colIdx + interleave <= tileColumns[tileX + 1]; colIdx += interleave)
+            {
+                ++first[inputRow[colIdx]];
+                ++second[inputRow[colIdx + 1]];
+                ++third[inputRow[colIdx + 2]];
+                ++fourth[inputRow[colIdx + 3]];
+            }
+            for (; colIdx < tileColumns[tileX + 1]; ++colIdx)
+            {
+                ++first[inputRow[colIdx]];
+            }
+        }
+    }
+}
+
+void WcetClahe::mapTileRow(unsigned int tileY) noexcept
+{
+    for (auto tileX = 0u; tileX < tilesHorizontal; ++tileX)
+    {
+        auto & histogram = histograms[tileX * interleave];
+        for (auto part = 1u; part < interleave; ++part)
+        {
+            auto const & partial = histograms[tileX * interleave + part];
+            for (auto bin = 0u; bin < 256; ++bin)
+            {
+                histogram.histogram[bin] += partial[bin];
+            }
+        }
+
+        // clipHistogram() without its branch, min and max leave a bin under the
+        // limit and the excess count exactly as they are
+        unsigned int numberOfPixelsOverLimit(0);
+        for (auto bin = 0u; bin < 256; ++bin)
+        {
+            auto const count = static_cast<double>(histogram[bin]);
+            numberOfPixelsOverLimit = static_cast<unsigned int>(numberOfPixelsOverLimit +
+                                                                std::max(count - clipLimit, 0.0));
+            histogram.histogram[bin] = static_cast<unsigned int>(std::min(count, clipLimit));
+        }
+        auto const excessPixelsPerBin = numberOfPixelsOverLimit / 256;
+        for (auto bin = 0u; bin < 256; ++bin)
+        {
+            histogram.histogram[bin] += excessPixelsPerBin;
+        }
+
+        // A fixed two passes over the bins
+        areaBasedGrayLevelMapping(histogram, &tables[tileY * tilesHorizontal + tileX]);
+    }
+}
+
+void WcetClahe::interpolate(cv::Mat const & input, cv::Mat & output) const noexcept
+{
+    for (auto rowIdx = 0u; rowIdx < rows; ++rowIdx)
+    {
+        auto const inputRow = input.ptr<uint8_t>(rowIdx);
+        auto const outputRow = output.ptr<uint8_t>(rowIdx);
+        auto const topTables = tables.data() + rowLowerTiles[rowIdx];
+        auto const bottomTables = tables.data() + rowUpperTiles[rowIdx];
+        auto const rowWeight = rowWeights[rowIdx];
+
+        // The a + (b - a) * t form of clahe(), which is exact when a == b or t == 0
+        for (auto const & span : horizontalSpans)
+        {
+            auto const & topLeft = topTables[span.lowerTile];
+            auto const & topRight = topTables[span.upperTile];
+            auto const & bottomLeft = bottomTables[span.lowerTile];
+            auto const & bottomRight = bottomTables[span.upperTile];
+            for (auto colIdx = span.begin; colIdx < span.end; ++colIdx)
+            {
+                auto const intensity = inputRow[colIdx];
+                auto const columnWeight = columnWeights[colIdx];
+                float const top = topLeft[intensity] +
+                                  (static_cast<float>(topRight[intensity]) - topLeft[intensity]) * columnWeight;
+                float const bottom =
+                    bottomLeft[intensity] +
+                    (static_cast<float>(bottomRight[intensity]) - bottomLeft[intensity]) * columnWeight;
+                outputRow[colIdx] = static_cast<uint8_t>(top + (bottom - top) * rowWeight);
+            }
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * file: wcetclahe.hpp
+ * purpose: Declaration of a CLAHE engine whose frame time does not depend on
+ *          the pixel data, for deployments which must bound their worst case
+ *          execution time.
+ */
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "clahe.hpp"
+#include "tiles.hpp"
+#include "utility.hpp"
+
+/*
+ * Equalizes frames of one size with the default gray level mapping, the
+ * output is identical to clahe().
+ *
+ * clahe() picks an interpolation kernel per region from the tables it has
+ * just built, allocates its tables and plan per frame, and counts histograms
+ * with one counter per bin, so a flat tile, where every pixel increments the
+ * same counter, counts slower than a textured one. This engine does the same
+ * work for every frame of its size whatever the pixels are:
+ *
+ *   - everything is allocated by the constructor, apply() allocates nothing
+ *     and takes no lock, and the output must already be allocated;
+ *   - every tile is counted into four interleaved histograms, so repeated
+ *     values do not serialize on one counter;
+ *   - clipping and mapping run a fixed 256 iterations per tile without
+ *     data-dependent branches;
+ *   - every pixel is blended from four tables with precomputed weights, the
+ *     border regions simply blend a table with itself, so the loops only
+ *     depend on the frame size.
+ *
+ * What remains data dependent is which table entries a pixel reads, and all
+ * of the tables fit in 16 KB. lockMemory() keeps the engine's buffers
+ * resident; callers certifying a frame time also lock the input and output,
+ * i.e. with mlockall(), and run at a real time priority.
+ *
+ *     WcetClahe equalizer(1280, 720);
+ *     cv::Mat output(720, 1280, CV_8UC1);
+ *     equalizer.apply(input, output);
+ */
+class WcetClahe
+{
+public:
+    /*
+     * _columns, _rows- The size of every frame, at least 8 x 8.
+     * _clipLimit- The limit for a single bin of the histogram.
+     */
+    WcetClahe(unsigned int _columns, unsigned int _rows, double _clipLimit = 40.0);
+
+    /*
+     * Equalizes a grayscale frame of the engine's size into output, which
+     * must already be a frame of the same size and type. Returns 0 on success
+     * and -1 on failure.
+     */
+    [[nodiscard]] int apply(cv::Mat const & input, cv::Mat & output) noexcept;
+
+    /*
+     * Locks the engine's buffers into memory so apply() cannot page fault on
+     * them. Returns 0 on success and -1 if the platform refuses, i.e. over
+     * RLIMIT_MEMLOCK.
+     */
+    [[nodiscard]] int lockMemory() noexcept;
+
+private:
+    // The histograms a tile is counted into, one per column modulo 4
+    static unsigned int const interleave = 4;
+
+    void countTileRow(cv::Mat const & input, unsigned int tileY) noexcept;
+
+    void mapTileRow(unsigned int tileY) noexcept;
+
+    void interpolate(cv::Mat const & input, cv::Mat & output) const noexcept;
+
+    unsigned int const columns;
+    unsigned int const rows;
+    double const clipLimit;
+    bool const valid;
+
+    // Tile boundaries, the last tile also covers the pixels left over
+    std::vector<unsigned int> tileColumns;
+    std::vector<unsigned int> tileRows;
+    // One row of tiles, interleave histograms per tile
+    std::vector<ImageHistogram> histograms;
+    // Row-major, one table per tile
+    std::vector<LookupTable> tables;
+    // The columns sharing the same tables, and each column's weight
+    std::vector<InterpolationSpan> horizontalSpans;
+    std::vector<float> columnWeights;
+    // The tables each row blends, as the index of the first table of a row of
+    // tiles, and their weight
+    std::vector<unsigned int> rowLowerTiles;
+    std::vector<unsigned int> rowUpperTiles;
+    std::vector<float> rowWeights;
+};